@@ -62,6 +62,8 @@ endif
 
 SRCS-${CONFIG_EMU_THREAD_SPECIFICS} += src/arch/emu_thread_specifics.c
 
+SRCS-${CONFIG_PROPBENCH} += src/prop/prop_bench.c
+
 BUNDLES += resources/metadb
 BUNDLES += resources/cachedb
 
@@ -210,6 +212,8 @@ SRCS += src/audio/audio.c \
 	src/audio/audio_decoder.c \
 	src/audio/audio_fifo.c \
 	src/audio/audio_iec958.c \
+	src/audio/audio_matrix.c \
+	src/audio/audio_resampler.c \
 
 SRCS-$(CONFIG_LIBASOUND)  += src/audio/alsa/alsa_audio.c
 SRCS-$(CONFIG_LIBPULSE)   += src/audio/pulseaudio/pulseaudio.c
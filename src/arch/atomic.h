@@ -109,4 +109,14 @@ atomic_add(volatile int *ptr, int val)
 #error Missing atomic ops
 #endif
 
+
+/**
+ * Full memory barrier, orders all loads and stores on both sides
+ */
+static inline void
+atomic_barrier(void)
+{
+  __sync_synchronize();
+}
+
 #endif /* HTSATOMIC_H__ */
@@ -28,6 +28,7 @@
 #include "audio_defs.h"
 #include "audio_fifo.h"
 #include "audio_decoder.h"
+#include "audio_resampler.h"
 #include "notifications.h"
 
 audio_mode_t *audio_mode_current;
@@ -45,6 +46,12 @@ static int audio_run = 1;
 static hts_thread_t audio_thread_id;
 audio_fifo_t af0, *thefifo;
 
+static const char *resample_quality_ids[] = {
+  [AUDIO_RESAMPLER_FAST]   = "0",
+  [AUDIO_RESAMPLER_NORMAL] = "1",
+  [AUDIO_RESAMPLER_HIGH]   = "2",
+};
+
 
 /**
  *
@@ -237,12 +244,25 @@ audio_mode_save_settings(audio_mode_t *am)
   htsmsg_add_u32(m, "force_downmix", am->am_force_downmix);
   htsmsg_add_u32(m, "swap_surround", am->am_swap_surround);
   htsmsg_add_s32(m, "delay", am->am_audio_delay);
+  htsmsg_add_str(m, "resample_quality",
+		 resample_quality_ids[am->am_resample_quality]);
 
   htsmsg_store_save(m, "audio/devices/%s", am->am_id);
   htsmsg_destroy(m);
 }
 
 
+/**
+ *
+ */
+static void
+am_set_resample_quality(void *opaque, const char *str)
+{
+  audio_mode_t *am = opaque;
+  am->am_resample_quality = atoi(str);
+  audio_mode_save_settings(am);
+}
+
 /**
  *
  */
@@ -319,6 +339,7 @@ audio_mode_register(audio_mode_t *am)
 {
   prop_t *r;
   htsmsg_t *m;
+  setting_t *x;
 
   TAILQ_INSERT_TAIL(&audio_modes, am, am_link);
 
@@ -335,6 +356,17 @@ audio_mode_register(audio_mode_t *am)
 		      0, m, -1000, 1000, 10, am_set_av_sync, am,
 		      SETTINGS_INITIAL_UPDATE, "ms", NULL, NULL, NULL);
 
+  x = settings_create_multiopt(r, "resample_quality",
+			       _p("Resampling quality"));
+  settings_multiopt_add_opt(x, resample_quality_ids[AUDIO_RESAMPLER_FAST],
+			    _p("Fast"), 0);
+  settings_multiopt_add_opt(x, resample_quality_ids[AUDIO_RESAMPLER_NORMAL],
+			    _p("Normal"), 1);
+  settings_multiopt_add_opt(x, resample_quality_ids[AUDIO_RESAMPLER_HIGH],
+			    _p("High"), 0);
+  settings_multiopt_initiate(x, am_set_resample_quality, am, NULL,
+			     m, NULL, NULL);
+
   if(am->am_multich_controls) {
     settings_create_bool(r, "phantom_center", _p("Phantom center"),
 			 0, m, am_set_phantom_center, am,
@@ -28,6 +28,7 @@
 #include "showtime.h"
 #include "audio_decoder.h"
 #include "audio_defs.h"
+#include "audio_resampler.h"
 #include "event.h"
 #include "misc/strtab.h"
 #include "arch/halloc.h"
@@ -41,17 +42,8 @@ static void audio_mix1(audio_decoder_t *ad, audio_mode_t *am,
 		       int16_t *data0, int frames, int64_t pts, int epoch,
 		       media_pipe_t *mp);
 
-static void audio_mix2(audio_decoder_t *ad, audio_mode_t *am, 
-		       int channels, int rate,
-		       int16_t *data0, int frames, int64_t pts, int epoch,
-		       media_pipe_t *mp);
-
 static void close_resampler(audio_decoder_t *ad);
 
-static int resample(audio_decoder_t *ad, int16_t *dstmix, int dstavail,
-		    int *writtenp, int16_t *srcmix, int srcframes,
-		    int channels);
-
 static void ad_decode_buf(audio_decoder_t *ad, media_pipe_t *mp,
 			  media_queue_t *mq, media_buf_t *mb);
 
@@ -61,6 +53,14 @@ static void audio_deliver(audio_decoder_t *ad, audio_mode_t *am,
 			  int epoch, media_pipe_t *mp,
 			  int isfloat);
 
+static int ad_can_mix_float(audio_decoder_t *ad, audio_mode_t *am,
+			    int channels);
+
+static void audio_mix_deliver_flt(audio_decoder_t *ad, audio_mode_t *am,
+				  const audio_matrix_t *mx, const float *src,
+				  int frames, int rate, int64_t pts, int epoch,
+				  media_pipe_t *mp);
+
 static void *ad_thread(void *aux);
 
 
@@ -241,7 +241,7 @@ ad_thread(void *aux)
       abort();
     }
     hts_mutex_lock(&mp->mp_mutex);
-    media_buf_free_locked(mp, mb);
+    media_buf_retire_locked(mp, mq, mb);
   }
   hts_mutex_unlock(&mp->mp_mutex);
   audio_fifo_purge(thefifo, ad, NULL);
@@ -258,7 +258,7 @@ audio_deliver_passthru(media_buf_t *mb, audio_decoder_t *ad, int format,
   audio_fifo_t *af = thefifo;
   audio_buf_t *ab;
 
-  ab = af_alloc(mb->mb_size, mp);
+  ab = af_alloc(af, mb->mb_size, mp);
   ab->ab_channels = 2;
   ab->ab_format   = format;
   ab->ab_samplerate= 48000;
@@ -449,11 +449,12 @@ ad_decode_buf(audio_decoder_t *ad, media_pipe_t *mp, media_queue_t *mq,
 	if(ctx->sample_fmt == SAMPLE_FMT_FLT && am->am_float && 
 	   (am->am_sample_rates & AM_SR_ANY ||
 	    audio_rateflag_from_rate(rate) & am->am_sample_rates) &&
-	   channels_to_format(channels) & am->am_formats) {
+	   ad_can_mix_float(ad, am, channels)) {
 	  
 	  frames /= channels;
-	  audio_deliver(ad, am, ad->ad_outbuf, channels, frames,
-			rate, pts, mb->mb_epoch, mp, 1);
+	  audio_mix_deliver_flt(ad, am, &ad->ad_mix12,
+				(const float *)ad->ad_outbuf, frames,
+				rate, pts, mb->mb_epoch, mp);
 
 	} else {
 
@@ -619,6 +620,26 @@ astats(audio_decoder_t *ad, media_pipe_t *mp, int64_t pts, int epoch,
 }
 
 
+/**
+ * Gain used by phantom speakers and mono to stereo expansion (-3dB)
+ */
+#define MIX_PHANTOM (46334.0f / 65536.0f)
+
+typedef float mixop_t[AUDIO_MATRIX_MAX_CHANNELS][AUDIO_MATRIX_MAX_CHANNELS];
+
+/**
+ *
+ */
+static void
+mixop_identity(mixop_t op, int channels)
+{
+  int i;
+  memset(op, 0, sizeof(mixop_t));
+  for(i = 0; i < channels; i++)
+    op[i][i] = 1.0f;
+}
+
+
 /**
  * Audio mixing stage 1
  *
@@ -626,70 +647,49 @@ astats(audio_decoder_t *ad, media_pipe_t *mp, int64_t pts, int epoch,
  * This reduces the CPU load required during the (optional) resampling.
  */
 static void
-audio_mix1(audio_decoder_t *ad, audio_mode_t *am, 
-	   int channels, int rate, int64_t chlayout,
-	   int16_t *data0, int frames, int64_t pts, int epoch,
-	   media_pipe_t *mp)
+mix_stage1(audio_matrix_t *m, const audio_mode_t *am, int channels)
 {
-  int x, y, z, i;
-  int16_t *data, *src, *dst;
-  int rf = audio_rateflag_from_rate(rate);
+  mixop_t op;
 
-  astats(ad, mp, pts, epoch, data0, frames, channels, chlayout, rate);
+  audio_matrix_init(m, channels);
 
   if(channels == 5) {
-    // 5.0 -> 5.1 
-    src = data0 + frames * 5;
-    dst = data0 + frames * 6;
-    
-    for(i = 0; i < frames; i++) {
-      src -= 5;
-      dst -= 6;
-      
-      dst[5] = src[4];
-      dst[4] = src[3];
-      dst[3] = 0;
-      dst[2] = src[2];
-      dst[1] = src[1];
-      dst[0] = src[0];
-    }
-    channels = 6;      
+    // 5.0 -> 5.1
+    mixop_identity(op, 3);
+    op[4][3] = 1.0f;
+    op[5][4] = 1.0f;
+    audio_matrix_apply(m, 6, op);
+    channels = 6;
+  }
+
+  /**
+   * 7.1 to 5.1, fold side channels into surround
+   */
+  if(channels == 8 && (audio_mode_stereo_only(am) ||
+		       !(am->am_formats & AM_FORMAT_PCM_7DOT1))) {
+    mixop_identity(op, 4);
+    op[4][4] = op[4][6] = M_SQRT1_2;
+    op[5][5] = op[5][7] = M_SQRT1_2;
+    audio_matrix_apply(m, 6, op);
+    channels = 6;
   }
 
   /**
    * 5.1 to stereo downmixing, coeffs are stolen from AAC spec
    */
   if(channels == 6 && audio_mode_stereo_only(am)) {
-
-    src = data0;
-    dst = data0;
-
-    for(i = 0; i < frames; i++) {
-
-      x = (src[0] * 26869) >> 16;
-      y = (src[1] * 26869) >> 16;
-
-      z = (src[2] * 19196) >> 16;
-      x += z;
-      y += z;
-
-      z = (src[3] * 13571) >> 16;
-      x += z;
-      y += z;
-
-      z = (src[4] * 13571) >> 16;
-      x -= z;
-      y += z;
-
-      z = (src[5] * 19196) >> 16;
-      x -= z;
-      y += z;
-
-      src += 6;
-
-      *dst++ = CLIP16(x);
-      *dst++ = CLIP16(y);
-    }
+    memset(op, 0, sizeof(op));
+    op[0][0] =  26869 / 65536.0f;
+    op[1][1] =  26869 / 65536.0f;
+    op[0][2] =  19196 / 65536.0f;
+    op[1][2] =  19196 / 65536.0f;
+    op[0][3] =  13571 / 65536.0f;
+    op[1][3] =  13571 / 65536.0f;
+    op[0][4] = -13571 / 65536.0f;
+    op[1][4] =  13571 / 65536.0f;
+    op[0][5] = -19196 / 65536.0f;
+    op[1][5] =  19196 / 65536.0f;
+    audio_matrix_apply(m, 2, op);
     channels = 2;
   }
 
@@ -697,230 +697,273 @@ audio_mix1(audio_decoder_t *ad, audio_mode_t *am,
    * Phantom LFE, mix it into front speakers
    */
   if(am->am_phantom_lfe && channels > 5) {
-    data = data0;
-    for(i = 0; i < frames; i++) {
-      x = data[0];
-      y = data[1];
-
-      z = (data[3] * 46334) >> 16;
-      x += z;
-      y += z;
-
-      data[0] = CLIP16(x);
-      data[1] = CLIP16(y);
-      data[3] = 0;
-      data += channels;
-    }
+    mixop_identity(op, channels);
+    op[0][3] = op[1][3] = MIX_PHANTOM;
+    op[3][3] = 0;
+    audio_matrix_apply(m, channels, op);
   }
 
-
   /**
    * Phantom center, mix it into front speakers
    */
   if(am->am_phantom_center && channels > 4) {
-    data = data0;
-    for(i = 0; i < frames; i++) {
-      x = data[0];
-      y = data[1];
-
-      z = (data[2] * 46334) >> 16;
-      x += z;
-      y += z;
-
-      data[0] = CLIP16(x);
-      data[1] = CLIP16(y);
-      data[2] = 0;
-      data += channels;
+    mixop_identity(op, channels);
+    op[0][2] = op[1][2] = MIX_PHANTOM;
+    op[2][2] = 0;
+    audio_matrix_apply(m, channels, op);
+  }
+
+  audio_matrix_finalize(m);
+}
+
+
+/**
+ * Audio mixing stage 2
+ *
+ * All stages that increases the number of channels is performed here now
+ * after resampling is done
+ */
+static void
+mix_stage2(audio_matrix_t *m, const audio_mode_t *am, int channels)
+{
+  mixop_t op;
+
+  audio_matrix_init(m, channels);
+  memset(op, 0, sizeof(op));
+
+  /**
+   * Mono expansion (ethier to center speaker or to L + R)
+   * We also mix to LFE if possible
+   */
+  if(channels == 1) {
+
+    if(am->am_formats & AM_FORMAT_PCM_5DOT1 && !am->am_phantom_center &&
+       !am->am_force_downmix) {
+      /* Mix mono to center and LFE */
+      op[2][0] = 1.0f;
+      op[3][0] = 1.0f;
+      channels = 6;
+    } else if(am->am_formats & AM_FORMAT_PCM_5DOT1 && !am->am_force_downmix) {
+      /* Mix mono to L + R and LFE */
+      op[0][0] = op[1][0] = MIX_PHANTOM;
+      op[3][0] = 1.0f;
+      channels = 6;
+    } else {
+      /* Mix mono to L + R  */
+      op[0][0] = op[1][0] = MIX_PHANTOM;
+      channels = 2;
+    }
+    audio_matrix_apply(m, channels, op);
+
+  } else if(am->am_formats & AM_FORMAT_PCM_5DOT1 && am->am_small_front) {
+
+    /**
+     * Small front speakers (need to mix front audio to LFE)
+     */
+    if(channels >= 6) {
+      mixop_identity(op, channels);
+    } else {
+      mixop_identity(op, 2);
+      channels = 6;
     }
+    op[3][0] = op[3][1] = 0.5f;
+    audio_matrix_apply(m, channels, op);
   }
 
   /**
-   * Resampling
+   * Swap Center + LFE with Surround
    */
-  if(rf & am->am_sample_rates || am->am_sample_rates & AM_SR_ANY) {
-    close_resampler(ad);
-    audio_mix2(ad, am, channels, rate, data0, frames, pts, epoch, mp);
-  } else {
+  if(am->am_swap_surround && channels > 5) {
+    mixop_identity(op, channels);
+    op[2][2] = op[3][3] = op[4][4] = op[5][5] = 0;
+    op[2][4] = op[3][5] = op[4][2] = op[5][3] = 1.0f;
+    audio_matrix_apply(m, channels, op);
+  }
 
-    int dstrate = 48000;
-    int consumed;
-    int written;
-    int resbufsize = 4096;
+  audio_matrix_finalize(m);
+}
 
-    if(ad->ad_resampler_srcrate  != rate    || 
-       ad->ad_resampler_dstrate  != dstrate ||
-       ad->ad_resampler_channels != channels) {
 
-      /* Must reconfigure, close */
-      close_resampler(ad);
+/**
+ * (Re)build mixing matrices if input or audio mode settings changed
+ */
+static void
+ad_update_mixer(audio_decoder_t *ad, const audio_mode_t *am, int channels)
+{
+  uint32_t flags = am->am_formats |
+    !!am->am_phantom_center << 16 |
+    !!am->am_phantom_lfe    << 17 |
+    !!am->am_small_front    << 18 |
+    !!am->am_force_downmix  << 19 |
+    !!am->am_swap_surround  << 20;
+
+  if(ad->ad_mix_am == am && ad->ad_mix_flags == flags &&
+     ad->ad_mix_channels == channels)
+    return;
 
-      ad->ad_resampler_srcrate  = rate;
-      ad->ad_resampler_dstrate  = dstrate;
-      ad->ad_resampler_channels = channels;
-    }
+  mix_stage1(&ad->ad_mix1, am, channels);
+  mix_stage2(&ad->ad_mix2, am, ad->ad_mix1.amx_outputs);
+  audio_matrix_compose(&ad->ad_mix12, &ad->ad_mix1, &ad->ad_mix2);
 
-    if(ad->ad_resampler == NULL) {
-      ad->ad_resbuf = malloc(resbufsize * sizeof(int16_t) * 6);
-      ad->ad_resampler = av_resample_init(dstrate, rate, 16, 10, 0, 1.0);
-    }
+  ad->ad_mix_am = am;
+  ad->ad_mix_flags = flags;
+  ad->ad_mix_channels = channels;
+}
 
-    src = data0;
-    rate= dstrate;
 
-    /* If we have something in spill buffer, adjust PTS */
-    /* XXX: need this ?, it's very small */
-    if(pts != AV_NOPTS_VALUE)
-      pts -= 1000000LL * ad->ad_resampler_spill_size / rate;
+/**
+ * Run 16 bit samples through a mixing matrix and pass them on
+ */
+static void
+audio_mix_deliver(audio_decoder_t *ad, audio_mode_t *am,
+		  const audio_matrix_t *mx, const int16_t *src, int frames,
+		  int rate, int64_t pts, int epoch, media_pipe_t *mp)
+{
+  int n;
 
-    while(frames > 0) {
-      consumed = 
-	resample(ad, ad->ad_resbuf, resbufsize,
-		 &written, src, frames, channels);
-      src += consumed * channels;
-      frames -= consumed;
+  if(mx->amx_identity) {
+    audio_deliver(ad, am, src, mx->amx_outputs, frames, rate, pts,
+		  epoch, mp, 0);
+    return;
+  }
 
-      audio_mix2(ad, am, channels, rate, ad->ad_resbuf, written, 
-		 pts, epoch, mp);
-      pts = AV_NOPTS_VALUE;
-      if(consumed == 0 && written == 0)
-	break;
-    }
+  while(frames > 0) {
+    n = MIN(frames, AD_MIX_CHUNK);
+    audio_matrix_mix_s16(mx, ad->ad_mix2buf.s16, src, n);
+    audio_deliver(ad, am, ad->ad_mix2buf.s16, mx->amx_outputs, n, rate, pts,
+		  epoch, mp, 0);
+    pts = AV_NOPTS_VALUE;
+    src += n * mx->amx_inputs;
+    frames -= n;
   }
 }
 
 
- /**
-  * Audio mixing stage 2
-  *
-  * All stages that increases the number of channels is performed here now
-  * after resampling is done
-  */
+/**
+ * Run float samples through a mixing matrix and pass them on
+ */
 static void
-audio_mix2(audio_decoder_t *ad, audio_mode_t *am, 
-	   int channels, int rate, int16_t *data0, int frames, int64_t pts,
-	   int epoch, media_pipe_t *mp)
+audio_mix_deliver_flt(audio_decoder_t *ad, audio_mode_t *am,
+		      const audio_matrix_t *mx, const float *src, int frames,
+		      int rate, int64_t pts, int epoch, media_pipe_t *mp)
 {
-  int x, y, i, c;
-  int16_t *data, *src, *dst;
+  int n;
 
-  /**
-   * Mono expansion (ethier to center speaker or to L + R)
-   * We also mix to LFE if possible
-   */
-  if(channels == 1) {
-    src = data0 + frames;
+  if(mx->amx_identity) {
+    audio_deliver(ad, am, src, mx->amx_outputs, frames, rate, pts,
+		  epoch, mp, 1);
+    return;
+  }
 
-    if(am->am_formats & AM_FORMAT_PCM_5DOT1 && !am->am_phantom_center &&
-       !am->am_force_downmix) {
-      
-      /* Mix mono to center and LFE */
+  while(frames > 0) {
+    n = MIN(frames, AD_MIX_CHUNK);
+    audio_matrix_mix_flt(mx, ad->ad_mix2buf.flt, src, n);
+    audio_deliver(ad, am, ad->ad_mix2buf.flt, mx->amx_outputs, n, rate, pts,
+		  epoch, mp, 1);
+    pts = AV_NOPTS_VALUE;
+    src += n * mx->amx_inputs;
+    frames -= n;
+  }
+}
 
-      dst = data0 + frames * 6;
-      for(i = 0; i < frames; i++) {
-	src--;
-	dst -= 6;
 
-	x = *src;
+/**
+ * Check if float output can be delivered without going through the
+ * 16 bit path, ie. the mixed layout is supported by the output
+ */
+static int
+ad_can_mix_float(audio_decoder_t *ad, audio_mode_t *am, int channels)
+{
+  ad_update_mixer(ad, am, channels);
+  return channels_to_format(ad->ad_mix12.amx_outputs) & am->am_formats;
+}
 
-	dst[0] = 0;
-	dst[1] = 0;
-	dst[2] = x;
-	dst[3] = x;
-	dst[4] = 0;
-	dst[5] = 0;
-      }
-      channels = 6;
-    } else if(am->am_formats & AM_FORMAT_PCM_5DOT1 && !am->am_force_downmix) {
 
-      /* Mix mono to L + R and LFE */
+/**
+ * Mix, resample (if needed) and deliver 16 bit audio
+ *
+ * Channel reduction is done before resampling and expansion after
+ * to keep resampling cost down. Without resampling both stages are
+ * done in one pass.
+ */
+static void
+audio_mix1(audio_decoder_t *ad, audio_mode_t *am, 
+	   int channels, int rate, int64_t chlayout,
+	   int16_t *data0, int frames, int64_t pts, int epoch,
+	   media_pipe_t *mp)
+{
+  int rf = audio_rateflag_from_rate(rate);
+  const int16_t *src;
+  int16_t *resbuf;
+  int dstrate = 48000;
+  int consumed, written, n;
 
-      dst = data0 + frames * 6;
-      for(i = 0; i < frames; i++) {
-	src--;
-	dst -= 6;
+  astats(ad, mp, pts, epoch, data0, frames, channels, chlayout, rate);
 
-	x = *src;
+  ad_update_mixer(ad, am, channels);
 
-	dst[3] = x;
-	x = (x * 46334) >> 16;
-	dst[0] = x;
-	dst[1] = x;
-	dst[2] = 0;
-	dst[4] = 0;
-	dst[5] = 0;
-      }
-      channels = 6;
-    } else {
-      /* Mix mono to L + R  */
+  if(rf & am->am_sample_rates || am->am_sample_rates & AM_SR_ANY) {
+    close_resampler(ad);
+    audio_mix_deliver(ad, am, &ad->ad_mix12, data0, frames, rate, pts,
+		      epoch, mp);
+    return;
+  }
 
-      dst = data0 + frames * 2;
-      for(i = 0; i < frames; i++) {
-	src--;
-	dst -= 2;
+  /**
+   * Resampling
+   */
+  channels = ad->ad_mix1.amx_outputs;
 
-	x = *src;
+  if(ad->ad_resampler_srcrate  != rate    || 
+     ad->ad_resampler_dstrate  != dstrate ||
+     ad->ad_resampler_channels != channels ||
+     ad->ad_resampler_quality  != am->am_resample_quality) {
 
-	x = (x * 46334) >> 16;
+    /* Must reconfigure, close */
+    close_resampler(ad);
 
-	dst[0] = x;
-	dst[1] = x;
-      }
-      channels = 2;
-    }
-  } else /* 'Small front' already dealt with */ { 
+    ad->ad_resampler_srcrate  = rate;
+    ad->ad_resampler_dstrate  = dstrate;
+    ad->ad_resampler_channels = channels;
+    ad->ad_resampler_quality  = am->am_resample_quality;
+  }
 
-    /**
-     * Small front speakers (need to mix front audio to LFE)
-     */
-    if(am->am_formats & AM_FORMAT_PCM_5DOT1 && am->am_small_front) {
-      if(channels >= 6) {
-	data = data0;
-	for(i = 0; i < frames; i++) {
-	  x = data[3] + (data[0] + data[1]) / 2;
-	  data[3] = CLIP16(x);
-	  data += channels;
-	}
-      } else {
-	src = data0 + frames * channels;
-	dst = data0 + frames * 6;
+  if(ad->ad_resampler == NULL) {
+    ad->ad_resampler = audio_resampler_create(channels, rate, dstrate,
+					      am->am_resample_quality);
+    if(ad->ad_resampler == NULL)
+      return;
+  }
 
-	for(i = 0; i < frames; i++) {
-	  src -= channels;
-	  dst -= 6;
+  /* If we have something in spill buffer, adjust PTS */
+  if(pts != AV_NOPTS_VALUE)
+    pts -= 1000000LL * audio_resampler_delay(ad->ad_resampler) / rate;
 
-	  x = (src[0] + src[1]) / 2;
-	
-	  for(c = 0; c < channels; c++)
-	    dst[c] = src[c];
+  while(frames > 0) {
+    n = MIN(frames, AD_MIX_CHUNK);
 
-	  dst[2] = 0;
-	  dst[3] = x;
-	  dst[4] = 0;
-	  dst[5] = 0;
-	}
-	channels = 6;
-      }
+    if(ad->ad_mix1.amx_identity) {
+      src = data0;
+    } else {
+      audio_matrix_mix_s16(&ad->ad_mix1, ad->ad_mix1buf, data0, n);
+      src = ad->ad_mix1buf;
     }
-  }
+    data0 += n * ad->ad_mix1.amx_inputs;
+    frames -= n;
 
-  /**
-   * Swap Center + LFE with Surround
-   */
-  if(am->am_swap_surround && channels > 5) {
-    data = data0;
-    for(i = 0; i < frames; i++) {
-      x = data[4];
-      y = data[5];
-      data[4] = data[2];
-      data[5] = data[3];
-      data[2] = x;
-      data[3] = y;
-      
-      data += channels;
+    while(n > 0) {
+      consumed = audio_resampler_process(ad->ad_resampler, src, n,
+					 &resbuf, &written);
+      src += consumed * channels;
+      n -= consumed;
+
+      audio_mix_deliver(ad, am, &ad->ad_mix2, resbuf, written, dstrate,
+			pts, epoch, mp);
+      pts = AV_NOPTS_VALUE;
+      if(consumed == 0 && written == 0)
+	return;
     }
   }
-
-  audio_deliver(ad, am, data0, channels, frames, rate, pts, epoch, mp, 0);
 }
 
 
@@ -951,7 +994,7 @@ audio_deliver(audio_decoder_t *ad, audio_mode_t *am, const void *src,
     }
 
     if(ab == NULL) {
-      ab = af_alloc(sample_size * channels * outsize, mp);
+      ab = af_alloc(af, sample_size * channels * outsize, mp);
       ab->ab_channels = channels;
       ab->ab_alloced = outsize;
       ab->ab_format = format;
@@ -1007,102 +1050,13 @@ audio_deliver(audio_decoder_t *ad, audio_mode_t *am, const void *src,
 static void
 close_resampler(audio_decoder_t *ad)
 {
-  int c;
-
   if(ad->ad_resampler == NULL) 
     return;
 
-  free(ad->ad_resbuf);
-  ad->ad_resbuf = NULL;
-
-  av_resample_close(ad->ad_resampler);
-  
-  for(c = 0; c < 8; c++) {
-    free(ad->ad_resampler_spill[c]);
-    ad->ad_resampler_spill[c] = NULL;
-  }
-
-  ad->ad_resampler_spill_size = 0;
-  ad->ad_resampler_channels = 0;
+  audio_resampler_destroy(ad->ad_resampler);
   ad->ad_resampler = NULL;
+  ad->ad_resampler_channels = 0;
 }
 
 
-/**
- *
- */
-static int
-resample(audio_decoder_t *ad, int16_t *dstmix, int dstavail,
-	 int *writtenp, int16_t *srcmix, int srcframes, int channels)
-{
-  int c, i, j;
-  int16_t *src;
-  int16_t *dst;
-  int written = 0;
-  int consumed;
-  int srcsize;
-  int spill = ad->ad_resampler_spill_size;
-  
-   if(spill > srcframes)
-     srcframes = 0;
-
-   dst = malloc(dstavail * sizeof(uint16_t));
-
-   for(c = 0; c < channels; c++) {
-
-     if(ad->ad_resampler_spill[c] != NULL) {
-
-       srcsize = spill + srcframes;
-
-       src = malloc(srcsize * sizeof(uint16_t));
-
-       j = 0;
-
-       for(i = 0; i < spill; i++)
-	 src[j++] = ad->ad_resampler_spill[c][i];
-
-       for(i = 0; i < srcframes; i++)
-	 src[j++] = srcmix[i * channels + c];
-
-       free(ad->ad_resampler_spill[c]);
-       ad->ad_resampler_spill[c] = NULL;
-
-     } else {
-
-       srcsize = srcframes;
-
-       src = malloc(srcsize * sizeof(uint16_t));
-
-       for(i = 0; i < srcframes; i++)
-	 src[i] = srcmix[i * channels + c];
-
-     }
-
-     written = av_resample(ad->ad_resampler, dst, src, &consumed, 
-			   srcsize, dstavail, c == channels - 1);
-
-     if(consumed != srcsize) {
-       ad->ad_resampler_spill_size = srcsize - consumed;
-
-       ad->ad_resampler_spill[c] = 
-	 malloc(ad->ad_resampler_spill_size * sizeof(uint16_t));
-
-       memcpy(ad->ad_resampler_spill[c], src + consumed, 
-	      ad->ad_resampler_spill_size * sizeof(uint16_t));
-     }
-
-     for(i = 0; i < written; i++)
-       dstmix[i * channels + c] = dst[i];
-
-     free(src);
-   }
-
-   *writtenp = written;
-
-   free(dst);
-
-   return srcframes;
- }
-
-
 
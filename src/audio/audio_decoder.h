@@ -21,6 +21,7 @@
 
 #include "media.h"
 #include "audio_defs.h"
+#include "audio_matrix.h"
 
 TAILQ_HEAD(audio_decoder_queue, audio_decoder);
 
@@ -36,14 +37,28 @@ typedef struct audio_decoder {
   int ad_do_flush;
   int ad_send_flush;
 
-  struct AVResampleContext *ad_resampler;
-  int16_t *ad_resampler_spill[8];
-  int ad_resampler_spill_size;
+  struct audio_resampler *ad_resampler;
   int ad_resampler_channels;
   int ad_resampler_srcrate;
   int ad_resampler_dstrate;
+  int ad_resampler_quality;
 
-  int16_t *ad_resbuf;
+  /* Channel mixing, see ad_update_mixer() */
+
+#define AD_MIX_CHUNK 1024  // Frames mixed per pass
+
+  audio_matrix_t ad_mix1;   // Before resampling
+  audio_matrix_t ad_mix2;   // After resampling
+  audio_matrix_t ad_mix12;  // Both, when not resampling
+  const struct audio_mode *ad_mix_am;
+  uint32_t ad_mix_flags;
+  int ad_mix_channels;
+
+  int16_t ad_mix1buf[AD_MIX_CHUNK * 8 + AUDIO_MATRIX_SLACK];
+  union {
+    int16_t s16[AD_MIX_CHUNK * 8 + AUDIO_MATRIX_SLACK];
+    float flt[AD_MIX_CHUNK * 8 + AUDIO_MATRIX_SLACK];
+  } ad_mix2buf;
 
   int64_t ad_silence_last_rt;
   int64_t ad_silence_last_pts;
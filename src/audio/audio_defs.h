@@ -62,6 +62,7 @@ typedef struct audio_mode {
   uint32_t am_small_front;
   uint32_t am_force_downmix;
   uint32_t am_swap_surround;  /* Swap center+LFE with surround channels */
+  int am_resample_quality;    /* AUDIO_RESAMPLER_ profile */
   int am_audio_delay;
 
   int am_preferred_size;
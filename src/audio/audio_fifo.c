@@ -25,18 +25,82 @@
 #include "showtime.h"
 #include "audio_fifo.h"
 #include "audio_defs.h"
+#include "arch/atomic.h"
 
 extern audio_mode_t *audio_mode_current;
 
+#define AF_RING_MASK (AF_RING_SIZE - 1)
+#define AF_POOL_MASK (AF_POOL_SIZE - 1)
+
+
+/**
+ * Take a buffer from the block pool. Returns NULL if the pool is empty
+ * or if ab_free() is busy returning a buffer right now.
+ */
+static audio_buf_t *
+af_pool_get(audio_fifo_t *af, size_t size)
+{
+  audio_buf_t *ab = NULL;
+  unsigned int t;
+
+  if(atomic_add(&af->af_pool_get, 1) == 0) {
+    t = af->af_pool_tail;
+    if(t != af->af_pool_head) {
+      atomic_barrier();
+      ab = af->af_pool[t & AF_POOL_MASK];
+      atomic_barrier();
+      af->af_pool_tail = t + 1;
+    }
+  }
+  atomic_add(&af->af_pool_get, -1);
+
+  if(ab != NULL && ab->ab_size < size) {
+    free(ab);
+    ab = NULL;
+  }
+  return ab;
+}
+
+
+/**
+ * Return a buffer to the block pool, returns 0 if it did not fit
+ */
+static int
+af_pool_put(audio_fifo_t *af, audio_buf_t *ab)
+{
+  unsigned int h;
+  int r = 0;
+
+  if(atomic_add(&af->af_pool_put, 1) == 0) {
+    h = af->af_pool_head;
+    if(h - af->af_pool_tail < AF_POOL_SIZE) {
+      atomic_barrier();
+      af->af_pool[h & AF_POOL_MASK] = ab;
+      atomic_barrier();
+      af->af_pool_head = h + 1;
+      r = 1;
+    }
+  }
+  atomic_add(&af->af_pool_put, -1);
+  return r;
+}
+
 
 /**
  *
  */
 audio_buf_t *
-af_alloc(size_t size, media_pipe_t *mp)
+af_alloc(audio_fifo_t *af, size_t size, media_pipe_t *mp)
 {
   audio_buf_t *ab;
-  ab = malloc(size + sizeof(audio_buf_t));
+
+  if((ab = af_pool_get(af, size)) == NULL) {
+    // Round up so buffers of slightly varying size (passthru) recycle
+    size = (size + 4095) & ~4095;
+    ab = malloc(size + sizeof(audio_buf_t));
+    ab->ab_size = size;
+  }
+  ab->ab_af = af;
   ab->ab_flush = 0;
   ab->ab_tmp = 0;
   ab->ab_mp = mp;
@@ -46,22 +110,15 @@ af_alloc(size_t size, media_pipe_t *mp)
   return ab;
 }
 
+
 /**
- *
+ * Wake whoever sleeps on the fifo
  */
-void
-af_enq(audio_fifo_t *af, audio_buf_t *ab)
+static void
+af_wake(audio_fifo_t *af)
 {
   hts_mutex_lock(&af->af_lock);
-
-  while(af->af_len > af->af_maxlen)
-    hts_cond_wait(&af->af_cond, &af->af_lock);
-
-  af->af_len += ab->ab_frames;
-
-  TAILQ_INSERT_TAIL(&af->af_queue, ab, link);
   hts_cond_broadcast(&af->af_cond);
-
   hts_mutex_unlock(&af->af_lock);
 }
 
@@ -69,68 +126,185 @@ af_enq(audio_fifo_t *af, audio_buf_t *ab)
 /**
  *
  */
-audio_buf_t *
-af_peek(audio_fifo_t *af)
+static int
+af_full(const audio_fifo_t *af, int checklen)
 {
-  audio_buf_t *ab;
-
-  ab = TAILQ_FIRST(&af->af_queue);
+  return af->af_head - af->af_tail >= AF_RING_SIZE ||
+    (checklen && af->af_len > af->af_maxlen);
+}
 
-  if(af->af_hysteresis) {
 
-    if(ab == NULL)
-      af->af_satisfied = 0;
-    else if(af->af_len < af->af_hysteresis && af->af_satisfied == 0)
-      ab = NULL;
-    else
-      af->af_satisfied = 1;
+/**
+ * Wait until there is room in the ring. Must be called with af_plock
+ * held, it's dropped while sleeping so audio_fifo_purge() can run
+ */
+static void
+af_wait_space(audio_fifo_t *af, int checklen)
+{
+  while(af_full(af, checklen)) {
+    hts_mutex_unlock(&af->af_plock);
+
+    hts_mutex_lock(&af->af_lock);
+    af->af_pwait = 1;
+    atomic_barrier();
+    if(af_full(af, checklen))
+      hts_cond_wait(&af->af_cond, &af->af_lock);
+    af->af_pwait = 0;
+    hts_mutex_unlock(&af->af_lock);
+
+    hts_mutex_lock(&af->af_plock);
   }
-  
-  return ab;
 }
 
+
+/**
+ * Publish 'ab' to the consumer. Caller must hold af_plock
+ */
+static void
+af_put(audio_fifo_t *af, audio_buf_t *ab)
+{
+  af->af_ring[af->af_head & AF_RING_MASK] = ab;
+  atomic_add(&af->af_len, ab->ab_frames);
+  atomic_barrier();
+  af->af_head++;
+}
+
+
 /**
  *
  */
 static void
-af_remove(audio_fifo_t *af, audio_buf_t *ab)
+af_put_done(audio_fifo_t *af)
 {
-  af->af_len -= ab->ab_frames;
-  TAILQ_REMOVE(&af->af_queue, ab, link);
-  hts_cond_broadcast(&af->af_cond);
+  atomic_barrier();
+  if(af->af_cwait)
+    af_wake(af);
 }
 
 
 /**
  *
  */
-audio_buf_t *
-af_deq2(audio_fifo_t *af, int wait, struct audio_mode *am)
+void
+af_enq(audio_fifo_t *af, audio_buf_t *ab)
+{
+  hts_mutex_lock(&af->af_plock);
+  af_wait_space(af, 1);
+  af_put(af, ab);
+  af_put_done(af);
+  hts_mutex_unlock(&af->af_plock);
+}
+
+
+/**
+ * Check if the consumer may take from a non-empty ring. A full ring
+ * always counts, or small buffers could fill all the slots before
+ * af_len reaches the hysteresis and both sides would sleep forever
+ */
+static int
+af_can_take(const audio_fifo_t *af, unsigned int tail)
+{
+  return !af->af_hysteresis || af->af_satisfied ||
+    af->af_len >= af->af_hysteresis ||
+    af->af_head - tail >= AF_RING_SIZE;
+}
+
+
+/**
+ * Check if the consumer can take a buffer without touching any state
+ */
+static int
+af_ready(const audio_fifo_t *af)
+{
+  if(af->af_head == af->af_tail)
+    return 0;
+
+  return af_can_take(af, af->af_tail);
+}
+
+
+/**
+ * Consumer side of the ring, lock free unless a purge is in progress
+ */
+static audio_buf_t *
+af_take(audio_fifo_t *af)
 {
   audio_buf_t *ab = NULL;
+  unsigned int t;
 
-  af_lock(af);
   while(1) {
+    af->af_cbusy = 1;
+    atomic_barrier();
+    if(!af->af_purging)
+      break;
 
-    if(am != audio_mode_current) {
-      af_unlock(af);
-      return AF_EXIT;
-    }
+    // Purge in progress, let it know we're out of the way and wait
+    af->af_cbusy = 0;
+    hts_mutex_lock(&af->af_lock);
+    hts_cond_broadcast(&af->af_cond);
+    while(af->af_purging)
+      hts_cond_wait(&af->af_cond, &af->af_lock);
+    hts_mutex_unlock(&af->af_lock);
+  }
 
-    ab = af_peek(af);
-    
-    if(ab != NULL || !wait)
-      break;
-    hts_cond_wait(&af->af_cond, &af->af_lock);
+  t = af->af_tail;
+
+  if(af->af_head == t) {
+    af->af_satisfied = 0;
+  } else if(af_can_take(af, t)) {
+    af->af_satisfied = 1;
+    atomic_barrier();
+    ab = af->af_ring[t & AF_RING_MASK];
+    atomic_add(&af->af_len, -ab->ab_frames);
+    atomic_barrier();
+    af->af_tail = t + 1;
   }
 
-  if(ab != NULL)
-    af_remove(af, ab);
+  atomic_barrier();
+  af->af_cbusy = 0;
+  atomic_barrier();
+
+  if(af->af_purging)
+    af_wake(af);
 
-  af_unlock(af);
+  if(ab != NULL) {
+    atomic_barrier();
+    if(af->af_pwait)
+      af_wake(af);
+  }
   return ab;
 }
 
+
+/**
+ *
+ */
+audio_buf_t *
+af_deq2(audio_fifo_t *af, int wait, struct audio_mode *am)
+{
+  audio_buf_t *ab;
+
+  while(1) {
+
+    if(am != audio_mode_current)
+      return AF_EXIT;
+
+    ab = af_take(af);
+
+    if(ab != NULL || !wait)
+      return ab;
+
+    hts_mutex_lock(&af->af_lock);
+    af->af_cwait = 1;
+    atomic_barrier();
+    if(am == audio_mode_current && !af_ready(af))
+      hts_cond_wait(&af->af_cond, &af->af_lock);
+    af->af_cwait = 0;
+    hts_mutex_unlock(&af->af_lock);
+  }
+}
+
+
 /**
  *
  */
@@ -139,7 +313,9 @@ ab_free(audio_buf_t *ab)
 {
   if(ab->ab_mp != NULL)
     mp_ref_dec(ab->ab_mp);
-  free(ab);
+
+  if(ab->ab_af == NULL || !af_pool_put(ab->ab_af, ab))
+    free(ab);
 }
 
 
@@ -149,15 +325,15 @@ ab_free(audio_buf_t *ab)
 void
 audio_fifo_init(audio_fifo_t *af, int maxlen, int hysteresis)
 {
+  memset(af, 0, sizeof(audio_fifo_t));
   hts_mutex_init(&af->af_lock);
   hts_cond_init(&af->af_cond, &af->af_lock);
-  TAILQ_INIT(&af->af_queue);
-  af->af_satisfied = 0;
+  hts_mutex_init(&af->af_plock);
   af->af_hysteresis = hysteresis;
-  af->af_len = 0;
   af->af_maxlen = maxlen;
 }
 
+
 /**
  * Remove all buffer entries from the given reference and
  * optionally put them on queue 'q'
@@ -165,17 +341,27 @@ audio_fifo_init(audio_fifo_t *af, int maxlen, int hysteresis)
 void
 audio_fifo_purge(audio_fifo_t *af, void *ref, struct audio_buf_queue *q)
 {
-  audio_buf_t *ab, *n;
+  audio_buf_t *ab;
+  unsigned int i, n;
 
+  hts_mutex_lock(&af->af_plock);
   hts_mutex_lock(&af->af_lock);
 
-  for(ab = TAILQ_FIRST(&af->af_queue); ab != NULL; ab = n) {
-    n = TAILQ_NEXT(ab, link);
-    if(ref != NULL && ab->ab_ref != ref)
+  af->af_purging = 1;
+  atomic_barrier();
+  while(af->af_cbusy)
+    hts_cond_wait(&af->af_cond, &af->af_lock);
+
+  n = af->af_tail;
+  for(i = af->af_tail; i != af->af_head; i++) {
+    ab = af->af_ring[i & AF_RING_MASK];
+
+    if(ref != NULL && ab->ab_ref != ref) {
+      af->af_ring[n++ & AF_RING_MASK] = ab;
       continue;
+    }
 
-    TAILQ_REMOVE(&af->af_queue, ab, link);
-    af->af_len -= ab->ab_frames;
+    atomic_add(&af->af_len, -ab->ab_frames);
 
     if(q != NULL) {
       TAILQ_INSERT_TAIL(q, ab, link);
@@ -183,31 +369,35 @@ audio_fifo_purge(audio_fifo_t *af, void *ref, struct audio_buf_queue *q)
       ab_free(ab);
     }
   }
+  af->af_head = n;
+
+  atomic_barrier();
+  af->af_purging = 0;
 
   hts_cond_broadcast(&af->af_cond);
-  hts_mutex_unlock(&af->af_lock);  
+  hts_mutex_unlock(&af->af_lock);
+  hts_mutex_unlock(&af->af_plock);
 }
 
 
 /**
- * Remove all buffer entries from the given reference and
- * optionally put them on queue 'q'
+ * Put buffers previously removed with audio_fifo_purge() back
  */
 void
 audio_fifo_reinsert(audio_fifo_t *af, struct audio_buf_queue *q)
 {
   audio_buf_t *ab;
 
-  hts_mutex_lock(&af->af_lock);
+  hts_mutex_lock(&af->af_plock);
 
   while((ab = TAILQ_FIRST(q)) != NULL) {
     TAILQ_REMOVE(q, ab, link);
-    af->af_len += ab->ab_frames;
-    TAILQ_INSERT_TAIL(&af->af_queue, ab, link);
+    af_wait_space(af, 0);
+    af_put(af, ab);
+    af_put_done(af);
   }
 
-  hts_cond_broadcast(&af->af_cond);
-  hts_mutex_unlock(&af->af_lock);  
+  hts_mutex_unlock(&af->af_plock);
 }
 
 
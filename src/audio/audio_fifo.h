@@ -23,6 +23,8 @@
 
 TAILQ_HEAD(audio_buf_queue, audio_buf);
 
+struct audio_fifo;
+
 typedef struct audio_buf {
   TAILQ_ENTRY(audio_buf) link;
   unsigned int ab_flush;
@@ -37,27 +39,65 @@ typedef struct audio_buf {
   int ab_frames;
   int ab_alloced;
   int ab_tmp;    // For output devices only
+  struct audio_fifo *ab_af; // Fifo whose block pool we return to
+  size_t ab_size;           // Size of ab_data
   char ab_data[0];
 } audio_buf_t;
 
 
+#define AF_RING_SIZE 256 // Max number of queued buffers, power of two
+#define AF_POOL_SIZE 64  // Max number of recycled buffers, power of two
+
+/**
+ * Single producer (audio decoder) / single consumer (audio output) ring.
+ *
+ * Indices are free running, only the producer writes af_head and only
+ * the consumer writes af_tail. Neither side takes a lock unless it
+ * must sleep because the fifo is empty (or below hysteresis) or full.
+ * The sleeping side sets af_cwait / af_pwait and the other side only
+ * wakes it when that flag is set.
+ *
+ * audio_fifo_purge() may rewrite the ring from any thread. It holds
+ * af_plock to keep producers out and sets af_purging to divert the
+ * consumer to af_lock until done.
+ */
 typedef struct audio_fifo {
 
-  hts_mutex_t af_lock;
+  hts_mutex_t af_lock;   // Only used for sleeping and purging
   hts_cond_t af_cond;
 
-  struct audio_buf_queue af_queue;
+  hts_mutex_t af_plock;  // Serializes producers, never taken by consumer
+
+  audio_buf_t *af_ring[AF_RING_SIZE];
+  volatile unsigned int af_head;
+  volatile unsigned int af_tail;
 
-  int af_len;
+  volatile int af_len;   // Frames in ring
   int af_maxlen;
   int af_hysteresis;
-  int af_satisfied;
+  int af_satisfied;      // Consumer only
+
+  volatile int af_cwait;
+  volatile int af_pwait;
+  volatile int af_cbusy;
+  volatile int af_purging;
+
+  /**
+   * Buffers returned by ab_free() for reuse by af_alloc(). Each side
+   * claims its end with atomic_add() and simply falls back to
+   * free() / malloc() in the rare case both threads collide.
+   */
+  audio_buf_t *af_pool[AF_POOL_SIZE];
+  volatile unsigned int af_pool_head;
+  volatile unsigned int af_pool_tail;
+  volatile int af_pool_put;
+  volatile int af_pool_get;
 
 } audio_fifo_t;
 
 #define ab_dataptr(ab) ((void *)&(ab)->af_data[0])
 
-audio_buf_t *af_alloc(size_t size, media_pipe_t *mp);
+audio_buf_t *af_alloc(audio_fifo_t *af, size_t size, media_pipe_t *mp);
 
 void af_enq(audio_fifo_t *af, audio_buf_t *ab);
 
@@ -65,10 +105,6 @@ void af_enq(audio_fifo_t *af, audio_buf_t *ab);
 
 #define af_unlock(af) hts_mutex_unlock(&(af)->af_lock);
 
-audio_buf_t *af_peek(audio_fifo_t *af);
-
-audio_buf_t *af_wait(audio_fifo_t *af);
-
 struct audio_mode;
 audio_buf_t *af_deq2(audio_fifo_t *af, int wait, struct audio_mode *am);
 
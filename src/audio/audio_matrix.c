@@ -0,0 +1,244 @@
+/*
+ *  Audio channel mixing matrix
+ *  Copyright (C) 2012 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AMX_NEON 1
+#endif
+
+#include "audio_matrix.h"
+
+#define Q14 16384
+
+/**
+ *
+ */
+void
+audio_matrix_init(audio_matrix_t *m, int channels)
+{
+  int i;
+
+  memset(m, 0, sizeof(audio_matrix_t));
+  m->amx_inputs = channels;
+  m->amx_outputs = channels;
+  for(i = 0; i < channels; i++)
+    m->amx_gain[i][i] = 1.0f;
+}
+
+
+/**
+ * Run the current outputs of 'm' through 'op' (indexed [out][in]),
+ * yielding 'outputs' channels
+ */
+void
+audio_matrix_apply(audio_matrix_t *m, int outputs,
+		   const float op[][AUDIO_MATRIX_MAX_CHANNELS])
+{
+  float g[AUDIO_MATRIX_MAX_CHANNELS][AUDIO_MATRIX_MAX_CHANNELS] = {{0}};
+  int o, i, k;
+
+  for(o = 0; o < outputs; o++)
+    for(i = 0; i < m->amx_inputs; i++)
+      for(k = 0; k < m->amx_outputs; k++)
+	g[o][i] += op[o][k] * m->amx_gain[k][i];
+
+  memcpy(m->amx_gain, g, sizeof(g));
+  m->amx_outputs = outputs;
+}
+
+
+/**
+ * 'dst' = 'a' followed by 'b'
+ */
+void
+audio_matrix_compose(audio_matrix_t *dst, const audio_matrix_t *a,
+		     const audio_matrix_t *b)
+{
+  audio_matrix_t tmp = *a;
+  audio_matrix_apply(&tmp, b->amx_outputs, b->amx_gain);
+  audio_matrix_finalize(&tmp);
+  *dst = tmp;
+}
+
+
+/**
+ *
+ */
+static int16_t
+gain_to_q14(float g)
+{
+  long v = lrintf(g * Q14);
+  return v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+}
+
+
+/**
+ * Derive kernel coefficient layouts from the gains
+ */
+void
+audio_matrix_finalize(audio_matrix_t *m)
+{
+  int o, i;
+
+  m->amx_identity = m->amx_inputs == m->amx_outputs;
+
+  memset(m->amx_col,  0, sizeof(m->amx_col));
+  memset(m->amx_pair, 0, sizeof(m->amx_pair));
+  memset(m->amx_fcol, 0, sizeof(m->amx_fcol));
+
+  for(o = 0; o < m->amx_outputs; o++) {
+    for(i = 0; i < m->amx_inputs; i++) {
+      float g = m->amx_gain[o][i];
+
+      if(g != (o == i ? 1.0f : 0.0f))
+	m->amx_identity = 0;
+
+      m->amx_col[i][o] = gain_to_q14(g);
+      m->amx_pair[i / 2][o][i & 1] = gain_to_q14(g);
+      m->amx_fcol[i][o] = g;
+    }
+  }
+}
+
+
+/**
+ *
+ */
+static inline int16_t
+clip16(int32_t v)
+{
+  return v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+}
+
+
+/**
+ * Mix 16 bit samples. 'dst' must not overlap 'src' and must have room
+ * for AUDIO_MATRIX_SLACK extra samples.
+ */
+void
+audio_matrix_mix_s16(const audio_matrix_t *m, int16_t *dst,
+		     const int16_t *src, int frames)
+{
+  const int inputs = m->amx_inputs;
+  const int outputs = m->amx_outputs;
+  int f = 0, o, k;
+
+#if defined(__SSE2__)
+  const __m128i rnd = _mm_set1_epi32(1 << 13);
+  const int pairs = (inputs + 1) / 2;
+  // With an odd channel count the last pair reads one sample into the
+  // next frame (with zero gain), so leave the last frame to scalar code
+  const int vframes = inputs & 1 ? frames - 1 : frames;
+
+  for(; f < vframes; f++) {
+    __m128i lo = rnd, hi = rnd;
+    for(k = 0; k < pairs; k++) {
+      int32_t v;
+      memcpy(&v, src + k * 2, sizeof(v));
+      __m128i b = _mm_set1_epi32(v);
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(b, _mm_load_si128((const __m128i *)&m->amx_pair[k][0][0])));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(b, _mm_load_si128((const __m128i *)&m->amx_pair[k][4][0])));
+    }
+    lo = _mm_srai_epi32(lo, 14);
+    hi = _mm_srai_epi32(hi, 14);
+    _mm_storeu_si128((__m128i *)dst, _mm_packs_epi32(lo, hi));
+    src += inputs;
+    dst += outputs;
+  }
+#elif defined(AMX_NEON)
+  for(; f < frames; f++) {
+    int32x4_t lo = vdupq_n_s32(0), hi = vdupq_n_s32(0);
+    for(k = 0; k < inputs; k++) {
+      lo = vmlal_n_s16(lo, vld1_s16(&m->amx_col[k][0]), src[k]);
+      hi = vmlal_n_s16(hi, vld1_s16(&m->amx_col[k][4]), src[k]);
+    }
+    vst1q_s16(dst, vcombine_s16(vqrshrn_n_s32(lo, 14),
+				vqrshrn_n_s32(hi, 14)));
+    src += inputs;
+    dst += outputs;
+  }
+#endif
+
+  for(; f < frames; f++) {
+    for(o = 0; o < outputs; o++) {
+      int32_t acc = 1 << 13;
+      for(k = 0; k < inputs; k++)
+	acc += m->amx_col[k][o] * src[k];
+      dst[o] = clip16(acc >> 14);
+    }
+    src += inputs;
+    dst += outputs;
+  }
+}
+
+
+/**
+ * Mix float samples. 'dst' must not overlap 'src' and must have room
+ * for AUDIO_MATRIX_SLACK extra samples.
+ */
+void
+audio_matrix_mix_flt(const audio_matrix_t *m, float *dst,
+		     const float *src, int frames)
+{
+  const int inputs = m->amx_inputs;
+  const int outputs = m->amx_outputs;
+  int f = 0, o, k;
+
+#if defined(__SSE2__)
+  for(; f < frames; f++) {
+    __m128 lo = _mm_setzero_ps(), hi = _mm_setzero_ps();
+    for(k = 0; k < inputs; k++) {
+      __m128 s = _mm_set1_ps(src[k]);
+      lo = _mm_add_ps(lo, _mm_mul_ps(s, _mm_load_ps(&m->amx_fcol[k][0])));
+      hi = _mm_add_ps(hi, _mm_mul_ps(s, _mm_load_ps(&m->amx_fcol[k][4])));
+    }
+    _mm_storeu_ps(dst, lo);
+    _mm_storeu_ps(dst + 4, hi);
+    src += inputs;
+    dst += outputs;
+  }
+#elif defined(AMX_NEON)
+  for(; f < frames; f++) {
+    float32x4_t lo = vdupq_n_f32(0), hi = vdupq_n_f32(0);
+    for(k = 0; k < inputs; k++) {
+      lo = vmlaq_n_f32(lo, vld1q_f32(&m->amx_fcol[k][0]), src[k]);
+      hi = vmlaq_n_f32(hi, vld1q_f32(&m->amx_fcol[k][4]), src[k]);
+    }
+    vst1q_f32(dst, lo);
+    vst1q_f32(dst + 4, hi);
+    src += inputs;
+    dst += outputs;
+  }
+#endif
+
+  for(; f < frames; f++) {
+    for(o = 0; o < outputs; o++) {
+      float acc = 0;
+      for(k = 0; k < inputs; k++)
+	acc += m->amx_fcol[k][o] * src[k];
+      dst[o] = acc;
+    }
+    src += inputs;
+    dst += outputs;
+  }
+}
@@ -0,0 +1,76 @@
+/*
+ *  Audio channel mixing matrix
+ *  Copyright (C) 2012 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_MATRIX_H
+#define AUDIO_MATRIX_H
+
+#include <stdint.h>
+
+#define AUDIO_MATRIX_MAX_CHANNELS 8
+
+/**
+ * Output frames must have room for this many extra samples after the
+ * last frame, the SIMD kernels store full vectors.
+ */
+#define AUDIO_MATRIX_SLACK 8
+
+/**
+ * Linear map from 'amx_inputs' to 'amx_outputs' interleaved channels.
+ *
+ * Gains are built in floating point with audio_matrix_init() and
+ * audio_matrix_apply(). audio_matrix_finalize() then derives the
+ * layouts used by the mixing kernels.
+ */
+typedef struct audio_matrix {
+  int amx_inputs;
+  int amx_outputs;
+  int amx_identity;
+
+  float amx_gain[AUDIO_MATRIX_MAX_CHANNELS][AUDIO_MATRIX_MAX_CHANNELS];
+
+  /* [input][output], Q14 */
+  int16_t amx_col[AUDIO_MATRIX_MAX_CHANNELS][AUDIO_MATRIX_MAX_CHANNELS]
+  __attribute__((aligned(16)));
+
+  /* [input pair][output][2], Q14, for multiply-add of two inputs */
+  int16_t amx_pair[AUDIO_MATRIX_MAX_CHANNELS / 2][AUDIO_MATRIX_MAX_CHANNELS][2]
+  __attribute__((aligned(16)));
+
+  /* [input][output] */
+  float amx_fcol[AUDIO_MATRIX_MAX_CHANNELS][AUDIO_MATRIX_MAX_CHANNELS]
+  __attribute__((aligned(16)));
+
+} audio_matrix_t;
+
+void audio_matrix_init(audio_matrix_t *m, int channels);
+
+void audio_matrix_apply(audio_matrix_t *m, int outputs,
+			const float op[][AUDIO_MATRIX_MAX_CHANNELS]);
+
+void audio_matrix_compose(audio_matrix_t *dst, const audio_matrix_t *a,
+			  const audio_matrix_t *b);
+
+void audio_matrix_finalize(audio_matrix_t *m);
+
+void audio_matrix_mix_s16(const audio_matrix_t *m, int16_t *dst,
+			  const int16_t *src, int frames);
+
+void audio_matrix_mix_flt(const audio_matrix_t *m, float *dst,
+			  const float *src, int frames);
+
+#endif /* AUDIO_MATRIX_H */
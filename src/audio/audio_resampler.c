@@ -0,0 +1,355 @@
+/*
+ *  Audio resampler
+ *  Copyright (C) 2012 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AR_NEON 1
+#endif
+
+#include "showtime.h"
+#include "audio_resampler.h"
+
+#define AR_CHUNK     1024 // Max source frames deinterleaved per pass
+#define AR_SPILL_MAX 256  // Room for source frames left by av_resample()
+
+/**
+ * Source frames are deinterleaved into per channel planes after any
+ * frames left over from the previous pass. All buffers are allocated
+ * once, so resampling does no heap traffic in steady state.
+ */
+struct audio_resampler {
+  struct AVResampleContext *ar_ctx;
+  int ar_channels;
+  int ar_spill;     // Unconsumed source frames at head of each ar_src plane
+  int ar_dstcap;    // Output capacity (frames)
+
+  int16_t *ar_src[8];
+  int16_t *ar_dst[8];
+  int16_t *ar_out;  // Interleaved output
+};
+
+
+/**
+ * Arguments to av_resample_init() for each quality profile
+ */
+static const struct {
+  int filter_length;
+  int log2_phase_count;
+  int linear;
+  double cutoff;
+} ar_profiles[] = {
+  [AUDIO_RESAMPLER_FAST]   = {  8,  6, 0, 0.80 },
+  [AUDIO_RESAMPLER_NORMAL] = { 16, 10, 0, 1.00 },
+  [AUDIO_RESAMPLER_HIGH]   = { 32, 10, 1, 0.95 },
+};
+
+
+#if defined(__SSE2__)
+/**
+ * Transpose 8 frames of 8 channels into 8 channels of 8 frames (or
+ * the other way around, it's its own inverse)
+ */
+static inline void
+transpose8x8(__m128i *r)
+{
+  __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+  __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+  __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+  __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+  __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+  __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+  __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+  __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+  __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+  r[0] = _mm_unpacklo_epi64(b0, b4);
+  r[1] = _mm_unpackhi_epi64(b0, b4);
+  r[2] = _mm_unpacklo_epi64(b1, b5);
+  r[3] = _mm_unpackhi_epi64(b1, b5);
+  r[4] = _mm_unpacklo_epi64(b2, b6);
+  r[5] = _mm_unpackhi_epi64(b2, b6);
+  r[6] = _mm_unpacklo_epi64(b3, b7);
+  r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+#endif
+
+
+/**
+ *
+ */
+static void
+deinterleave(int16_t **planes, int offset, const int16_t *src,
+	     int frames, int channels)
+{
+  int i = 0, c;
+
+  if(channels == 2) {
+    int16_t *l = planes[0] + offset;
+    int16_t *r = planes[1] + offset;
+#if defined(__SSE2__)
+    for(; i + 8 <= frames; i += 8) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(src + i * 2));
+      __m128i b = _mm_loadu_si128((const __m128i *)(src + i * 2 + 8));
+      __m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+      __m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+      __m128i ra = _mm_srai_epi32(a, 16);
+      __m128i rb = _mm_srai_epi32(b, 16);
+      _mm_storeu_si128((__m128i *)(l + i), _mm_packs_epi32(la, lb));
+      _mm_storeu_si128((__m128i *)(r + i), _mm_packs_epi32(ra, rb));
+    }
+#elif defined(AR_NEON)
+    for(; i + 8 <= frames; i += 8) {
+      int16x8x2_t v = vld2q_s16(src + i * 2);
+      vst1q_s16(l + i, v.val[0]);
+      vst1q_s16(r + i, v.val[1]);
+    }
+#endif
+    for(; i < frames; i++) {
+      l[i] = src[i * 2];
+      r[i] = src[i * 2 + 1];
+    }
+    return;
+  }
+
+  if(channels == 8) {
+#if defined(__SSE2__)
+    __m128i r[8];
+    for(; i + 8 <= frames; i += 8) {
+      for(c = 0; c < 8; c++)
+	r[c] = _mm_loadu_si128((const __m128i *)(src + (i + c) * 8));
+      transpose8x8(r);
+      for(c = 0; c < 8; c++)
+	_mm_storeu_si128((__m128i *)(planes[c] + offset + i), r[c]);
+    }
+#elif defined(AR_NEON)
+    /* Load channel pairs as 32 bit lanes, then split each pair */
+    for(; i + 8 <= frames; i += 8) {
+      int32x4x4_t a = vld4q_s32((const int32_t *)(src + i * 8));
+      int32x4x4_t b = vld4q_s32((const int32_t *)(src + i * 8 + 32));
+      for(c = 0; c < 4; c++) {
+	int16x8x2_t v = vuzpq_s16(vreinterpretq_s16_s32(a.val[c]),
+				  vreinterpretq_s16_s32(b.val[c]));
+	vst1q_s16(planes[c * 2]     + offset + i, v.val[0]);
+	vst1q_s16(planes[c * 2 + 1] + offset + i, v.val[1]);
+      }
+    }
+#endif
+  }
+
+  for(c = 0; c < channels; c++) {
+    int16_t *d = planes[c] + offset;
+    const int16_t *s = src + c;
+    int j;
+    for(j = i; j < frames; j++)
+      d[j] = s[j * channels];
+  }
+}
+
+
+/**
+ *
+ */
+static void
+interleave(int16_t *dst, int16_t **planes, int frames, int channels)
+{
+  int i = 0, c;
+
+  if(channels == 2) {
+    const int16_t *l = planes[0];
+    const int16_t *r = planes[1];
+#if defined(__SSE2__)
+    for(; i + 8 <= frames; i += 8) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(l + i));
+      __m128i b = _mm_loadu_si128((const __m128i *)(r + i));
+      _mm_storeu_si128((__m128i *)(dst + i * 2),     _mm_unpacklo_epi16(a, b));
+      _mm_storeu_si128((__m128i *)(dst + i * 2 + 8), _mm_unpackhi_epi16(a, b));
+    }
+#elif defined(AR_NEON)
+    for(; i + 8 <= frames; i += 8) {
+      int16x8x2_t v;
+      v.val[0] = vld1q_s16(l + i);
+      v.val[1] = vld1q_s16(r + i);
+      vst2q_s16(dst + i * 2, v);
+    }
+#endif
+    for(; i < frames; i++) {
+      dst[i * 2]     = l[i];
+      dst[i * 2 + 1] = r[i];
+    }
+    return;
+  }
+
+  if(channels == 8) {
+#if defined(__SSE2__)
+    __m128i r[8];
+    for(; i + 8 <= frames; i += 8) {
+      for(c = 0; c < 8; c++)
+	r[c] = _mm_loadu_si128((const __m128i *)(planes[c] + i));
+      transpose8x8(r);
+      for(c = 0; c < 8; c++)
+	_mm_storeu_si128((__m128i *)(dst + (i + c) * 8), r[c]);
+    }
+#elif defined(AR_NEON)
+    for(; i + 8 <= frames; i += 8) {
+      int32x4x4_t a, b;
+      for(c = 0; c < 4; c++) {
+	int16x8x2_t v = vzipq_s16(vld1q_s16(planes[c * 2] + i),
+				  vld1q_s16(planes[c * 2 + 1] + i));
+	a.val[c] = vreinterpretq_s32_s16(v.val[0]);
+	b.val[c] = vreinterpretq_s32_s16(v.val[1]);
+      }
+      vst4q_s32((int32_t *)(dst + i * 8), a);
+      vst4q_s32((int32_t *)(dst + i * 8 + 32), b);
+    }
+#endif
+  }
+
+  for(c = 0; c < channels; c++) {
+    int16_t *d = dst + c;
+    const int16_t *s = planes[c];
+    int j;
+    for(j = i; j < frames; j++)
+      d[j * channels] = s[j];
+  }
+}
+
+
+/**
+ *
+ */
+audio_resampler_t *
+audio_resampler_create(int channels, int srcrate, int dstrate, int quality)
+{
+  audio_resampler_t *ar;
+  int c, srccap, dstcap;
+  int16_t *mem;
+
+  if(channels < 1 || channels > 8)
+    return NULL;
+
+  if(quality < AUDIO_RESAMPLER_FAST || quality > AUDIO_RESAMPLER_HIGH)
+    quality = AUDIO_RESAMPLER_NORMAL;
+
+  // Keep each plane 16 byte aligned
+  srccap = (AR_CHUNK + AR_SPILL_MAX + 7) & ~7;
+  dstcap = ((int64_t)srccap * dstrate / srcrate + 16 + 7) & ~7;
+
+  ar = calloc(1, sizeof(audio_resampler_t) + 15 +
+	      (srccap + dstcap * 2) * channels * sizeof(int16_t));
+
+  ar->ar_ctx = av_resample_init(dstrate, srcrate,
+				ar_profiles[quality].filter_length,
+				ar_profiles[quality].log2_phase_count,
+				ar_profiles[quality].linear,
+				ar_profiles[quality].cutoff);
+  if(ar->ar_ctx == NULL) {
+    free(ar);
+    return NULL;
+  }
+
+  ar->ar_channels = channels;
+  ar->ar_dstcap = dstcap;
+
+  mem = (int16_t *)(((intptr_t)(ar + 1) + 15) & ~(intptr_t)15);
+
+  for(c = 0; c < channels; c++) {
+    ar->ar_src[c] = mem;
+    mem += srccap;
+    ar->ar_dst[c] = mem;
+    mem += dstcap;
+  }
+  ar->ar_out = mem;
+  return ar;
+}
+
+
+/**
+ *
+ */
+void
+audio_resampler_destroy(audio_resampler_t *ar)
+{
+  av_resample_close(ar->ar_ctx);
+  free(ar);
+}
+
+
+/**
+ * Resample up to AR_CHUNK frames from 'src'. Output is interleaved and
+ * owned by the resampler, valid until next call.
+ *
+ * Returns number of source frames consumed
+ */
+int
+audio_resampler_process(audio_resampler_t *ar,
+			const int16_t *src, int srcframes,
+			int16_t **dstp, int *writtenp)
+{
+  const int channels = ar->ar_channels;
+  int n = MIN(srcframes, AR_CHUNK + AR_SPILL_MAX - ar->ar_spill);
+  int c, srcsize, consumed = 0, written = 0;
+
+  deinterleave(ar->ar_src, ar->ar_spill, src, n, channels);
+  srcsize = ar->ar_spill + n;
+
+  /*
+   * All channels share one context. It's only updated on the last
+   * channel so every channel resamples from the same phase
+   */
+  for(c = 0; c < channels; c++)
+    written = av_resample(ar->ar_ctx, ar->ar_dst[c], ar->ar_src[c],
+			  &consumed, srcsize, ar->ar_dstcap,
+			  c == channels - 1);
+
+  ar->ar_spill = srcsize - consumed;
+  if(ar->ar_spill > 0 && consumed > 0)
+    for(c = 0; c < channels; c++)
+      memmove(ar->ar_src[c], ar->ar_src[c] + consumed,
+	      ar->ar_spill * sizeof(int16_t));
+
+  interleave(ar->ar_out, ar->ar_dst, written, channels);
+
+  *dstp = ar->ar_out;
+  *writtenp = written;
+  return n;
+}
+
+
+/**
+ * Source frames buffered but not yet resampled
+ */
+int
+audio_resampler_delay(const audio_resampler_t *ar)
+{
+  return ar->ar_spill;
+}
@@ -0,0 +1,41 @@
+/*
+ *  Audio resampler
+ *  Copyright (C) 2012 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_RESAMPLER_H
+#define AUDIO_RESAMPLER_H
+
+#include <stdint.h>
+
+#define AUDIO_RESAMPLER_FAST   0
+#define AUDIO_RESAMPLER_NORMAL 1
+#define AUDIO_RESAMPLER_HIGH   2
+
+typedef struct audio_resampler audio_resampler_t;
+
+audio_resampler_t *audio_resampler_create(int channels, int srcrate,
+					  int dstrate, int quality);
+
+void audio_resampler_destroy(audio_resampler_t *ar);
+
+int audio_resampler_process(audio_resampler_t *ar,
+			    const int16_t *src, int srcframes,
+			    int16_t **dstp, int *writtenp);
+
+int audio_resampler_delay(const audio_resampler_t *ar);
+
+#endif /* AUDIO_RESAMPLER_H */
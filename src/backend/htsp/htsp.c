@@ -195,7 +195,8 @@ htsp_recv(htsp_connection_t *hc)
   if(l > 16 * 1024 * 1024)
     return NULL;
 
-  buf = malloc(l);
+  // Padded so muxpkt payloads can be handed to decoders as is
+  buf = malloc(l + FF_INPUT_BUFFER_PADDING_SIZE);
 
   if(buf == NULL || tc->read(tc, buf, l, 1) < 0) {
     free(buf);
@@ -1677,6 +1678,16 @@ htsp_find_subscription_by_msg(htsp_connection_t *hc, htsmsg_t *m)
 }
 
 
+/**
+ *
+ */
+static void
+htsp_payload_release(media_payload_t *mpl)
+{
+  free(mpl->mpl_opaque);
+}
+
+
 /**
  * Transport input
  */
@@ -1690,6 +1701,8 @@ htsp_mux_input(htsp_connection_t *hc, htsmsg_t *m)
   const void *bin;
   size_t binlen;
   media_buf_t *mb;
+  media_payload_t *mpl;
+  void *buf;
 
   if(htsmsg_get_u32(m, "stream", &stream)  ||
      htsmsg_get_bin(m, "payload", &bin, &binlen))
@@ -1709,7 +1722,19 @@ htsp_mux_input(htsp_connection_t *hc, htsmsg_t *m)
       
     if(hss != NULL) {
 
-      mb = media_buf_alloc_unlocked(mp, binlen);
+      if((buf = htsmsg_detach_data(m)) != NULL) {
+	/*
+	 * The payload is the only binary field in a muxpkt and all
+	 * other fields are already parsed, so the padding can be
+	 * cleared in place and the receive buffer handed over as is
+	 */
+	memset((uint8_t *)bin + binlen, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+	mpl = media_payload_create(htsp_payload_release, buf);
+	mb = media_buf_from_payload_unlocked(mp, mpl, (void *)bin, binlen);
+      } else {
+	mb = media_buf_alloc_unlocked(mp, binlen);
+	memcpy(mb->mb_data, bin, binlen);
+      }
       mb->mb_data_type = hss->hss_data_type;
       mb->mb_stream = hss->hss_index;
 
@@ -1727,10 +1752,6 @@ htsp_mux_input(htsp_connection_t *hc, htsmsg_t *m)
       if(hss->hss_cw != NULL)
 	mb->mb_cw = media_codec_ref(hss->hss_cw);
 
-      memcpy(mb->mb_data, bin, binlen);
-  
-      mb->mb_size = binlen;
-
       if(mb_enqueue_no_block(mp, hss->hss_mq, mb,
 			     mb->mb_data_type == MB_SUBTITLE ? 
 			     mb->mb_data_type : -1))
@@ -2841,6 +2841,10 @@ pl_create(sp_playlist *plist, const char *name,
 			 pl->pl_flags & PL_SORT_ON_TIME ? "node.metadata.timestamp" : NULL,
 			 PROP_NF_AUTODESTROY | PROP_NF_SORT_DESC);
 
+    prop_nf_index_add(pnf, "node.metadata.title");
+    prop_nf_index_add(pnf, "node.metadata.artist");
+    prop_nf_index_add(pnf, "node.metadata.album");
+
     prop_nf_pred_int_add(pnf, "node.metadata.available",
 			 PROP_NF_CMP_EQ, 0, NULL, 
 			 PROP_NF_MODE_EXCLUDE);
@@ -67,11 +67,10 @@ blobcache_put0(sqlite3 *db, const char *key, const char *stash,
   sqlite3_stmt *stmt;
 
  restart:
-  rc = db_prepare(db,
-		  "INSERT OR REPLACE INTO item "
-		  "(k, stash, payload, lastaccess, expiry, etag, modtime) " 
-		  "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7)",
-		  -1, &stmt, NULL);
+  rc = db_stmt_prepare(db,
+		       "INSERT OR REPLACE INTO item "
+		       "(k, stash, payload, lastaccess, expiry, etag, modtime) " 
+		       "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7)", &stmt);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error %d at %s:%d",
 	  rc, __FUNCTION__, __LINE__);
@@ -93,7 +92,7 @@ blobcache_put0(sqlite3 *db, const char *key, const char *stash,
     sqlite3_bind_int(stmt,  7, mtime);
 
   rc = db_step(stmt);
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
 
   if(rc == SQLITE_LOCKED)
     goto restart;
@@ -140,10 +139,9 @@ blobcache_get0(sqlite3 *db, const char *key, const char *stash,
   if(db_begin(db))
     return NULL;
 
-  rc = db_prepare(db, 
-		  "SELECT payload,expiry,etag,modtime FROM item "
-		  "WHERE k=?1 AND stash=?2",
-		  -1, &stmt, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT payload,expiry,etag,modtime FROM item "
+		       "WHERE k=?1 AND stash=?2", &stmt);
   if(rc) {
     db_rollback(db);
     if(rc == SQLITE_LOCKED)
@@ -160,7 +158,7 @@ blobcache_get0(sqlite3 *db, const char *key, const char *stash,
   rc = db_step(stmt);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(stmt);
+    db_stmt_release(stmt);
     db_rollback(db);
     if(rc == SQLITE_LOCKED)
       goto restart;
@@ -193,15 +191,14 @@ blobcache_get0(sqlite3 *db, const char *key, const char *stash,
     *mtimep = sqlite3_column_int(stmt, 3);
 
 
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
 
   // Update atime
 
-  rc = db_prepare(db,
-		  "UPDATE item SET "
-		  "lastaccess = ?3 "
-		  "WHERE k = ?1 AND stash = ?2",
-		  -1, &stmt, NULL);
+  rc = db_stmt_prepare(db,
+		       "UPDATE item SET "
+		       "lastaccess = ?3 "
+		       "WHERE k = ?1 AND stash = ?2", &stmt);
   
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error %d at %s:%d",
@@ -213,7 +210,7 @@ blobcache_get0(sqlite3 *db, const char *key, const char *stash,
     sqlite3_bind_text(stmt, 2, stash, -1, SQLITE_STATIC);
     sqlite3_bind_int(stmt, 3, time(NULL));
     rc = db_step(stmt);
-    sqlite3_finalize(stmt);
+    db_stmt_release(stmt);
   }
 
   db_commit(db);
@@ -260,10 +257,9 @@ blobcache_get_meta0(sqlite3 *db, const char *key, const char *stash,
   time_t now;
 
  restart:
-  rc = db_prepare(db, 
-		  "SELECT etag,modtime FROM item "
-		  "WHERE k=?1 AND stash=?2",
-		  -1, &stmt, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT etag,modtime FROM item "
+		       "WHERE k=?1 AND stash=?2", &stmt);
   if(rc) {
     if(rc == SQLITE_LOCKED)
       goto restart;
@@ -276,7 +272,7 @@ blobcache_get_meta0(sqlite3 *db, const char *key, const char *stash,
   rc = db_step(stmt);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(stmt);
+    db_stmt_release(stmt);
     if(rc == SQLITE_LOCKED)
       goto restart;
     return -1;
@@ -289,7 +285,7 @@ blobcache_get_meta0(sqlite3 *db, const char *key, const char *stash,
   if(mtimep != NULL)
     *mtimep = sqlite3_column_int(stmt, 1);
 
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
   return 0;
 }
 
@@ -425,11 +421,10 @@ blobcache_prune(sqlite3 *db)
     return;
   }
 
-  rc = db_prepare(db, 
-		  "SELECT _rowid_,length(payload) "
-		  "FROM item "
-		  "ORDER BY lastaccess",
-		  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT _rowid_,length(payload) "
+		       "FROM item "
+		       "ORDER BY lastaccess", &sel);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error %d at %s:%d",
 	  rc, __FUNCTION__, __LINE__);
@@ -441,21 +436,20 @@ blobcache_prune(sqlite3 *db)
     int itemsize = sqlite3_column_int(sel, 1);
     int64_t id = sqlite3_column_int64(sel, 0);
 
-    rc = db_prepare(db, "DELETE FROM item WHERE _rowid_ = ?1",
-		    -1, &del, NULL);
+    rc = db_stmt_prepare(db, "DELETE FROM item WHERE _rowid_ = ?1", &del);
     if(rc != SQLITE_OK) {
       TRACE(TRACE_ERROR, "SQLITE", "SQL Error %d at %s:%d",
 	    rc, __FUNCTION__, __LINE__);
-      sqlite3_finalize(sel);
+      db_stmt_release(sel);
       db_rollback(db);
       return;
     }
     sqlite3_bind_int(del, 1, id);
     rc = db_step(del);
-    sqlite3_finalize(del);
+    db_stmt_release(del);
 
     if(rc != SQLITE_DONE) {
-      sqlite3_finalize(sel);
+      db_stmt_release(sel);
       db_rollback(db);
       return;
     }
@@ -470,7 +464,7 @@ blobcache_prune(sqlite3 *db)
 	"Pruned %d items, %"PRId64" bytes from cache",
 	pruned_items, pruned_bytes);
   estimated_cache_size = currentsize;
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
   db_commit(db);
   
 }
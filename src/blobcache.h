@@ -20,9 +20,26 @@
 #ifndef BLOBCACHE_H__
 #define BLOBCACHE_H__
 
+/**
+ * Refcounted, read only view of a cached blob
+ */
+typedef struct blob {
+  int b_refcount;
+  const void *b_data;
+  size_t b_size;
+  size_t b_maplen;  // Non-zero if b_data is mmap()ed
+} blob_t;
+
 void *blobcache_get(const char *key, const char *stash, size_t *sizep, int pad,
 		    int *is_expired, char **etag, time_t *mtime);
 
+blob_t *blobcache_get_blob(const char *key, const char *stash, int pad,
+			   int *is_expired, time_t *mtime);
+
+blob_t *blob_dup(blob_t *b);
+
+void blob_release(blob_t *b);
+
 int blobcache_get_meta(const char *key, const char *stash,
 		       char **etag, time_t *mtime);
 
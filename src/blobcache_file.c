@@ -40,16 +40,25 @@
 #include "settings.h"
 #include "notifications.h"
 
+#if ENABLE_MMAP
+#include <sys/mman.h>
+#endif
+
 #define BC2_MAGIC 0x62630201
 
+LIST_HEAD(blobcache_item_list, blobcache_item);
+TAILQ_HEAD(blobcache_item_queue, blobcache_item);
+
 typedef struct blobcache_item {
-  struct blobcache_item *bi_link;
+  LIST_ENTRY(blobcache_item) bi_link;
+  TAILQ_ENTRY(blobcache_item) bi_lru_link;
   uint64_t bi_key_hash;
   uint64_t bi_content_hash;
   uint32_t bi_lastaccess;
   uint32_t bi_expiry;
   uint32_t bi_modtime;
   uint32_t bi_size;
+  uint32_t bi_seq;  // Access order, used to compare items across shards
 } blobcache_item_t;
 
 typedef struct blobcache_diskitem {
@@ -61,17 +70,34 @@ typedef struct blobcache_diskitem {
   uint32_t di_size;
 } __attribute__((packed)) blobcache_diskitem_t;
 
-#define ITEM_HASH_SIZE 256
-#define ITEM_HASH_MASK (ITEM_HASH_SIZE - 1)
 
-static blobcache_item_t *hashvector[ITEM_HASH_SIZE];
-
-static pool_t *item_pool;
-static hts_mutex_t cache_lock;
+/**
+ * The index is split into shards, each with its own lock, hash table
+ * and LRU list (least recently used item first). The shard is selected
+ * by the top bits of the key hash and the bucket by the low bits.
+ *
+ * Hash tables start at BC_HASH_INITIAL buckets and are doubled when
+ * the average chain length exceeds two
+ */
+#define BC_SHARDS       16
+#define BC_SHARD(dk)    ((dk) >> 60)
+#define BC_HASH_INITIAL 64
 
+typedef struct blobcache_shard {
+  hts_mutex_t bs_mutex;
+  struct blobcache_item_list *bs_hash;
+  unsigned int bs_hashsize;
+  unsigned int bs_count;
+  uint64_t bs_size;
+  struct blobcache_item_queue bs_lru;
+} blobcache_shard_t;
 
+static blobcache_shard_t shards[BC_SHARDS];
 
+static pool_t *item_pool;
 
+static int tmpfile_tally;
+static int access_tally;
 
 static callout_t blobcache_callout;
 
@@ -80,15 +106,31 @@ static void blobcache_do_prune(struct callout *c, void *opaque);
 #define BLOB_CACHE_MINSIZE  (10 * 1000 * 1000)
 #define BLOB_CACHE_MAXSIZE (500 * 1000 * 1000)
 
-static uint64_t current_cache_size;
+/**
+ *
+ */
+static uint64_t
+current_cache_size(void)
+{
+  uint64_t size = 0;
+  int i;
+
+  for(i = 0; i < BC_SHARDS; i++) {
+    hts_mutex_lock(&shards[i].bs_mutex);
+    size += shards[i].bs_size;
+    hts_mutex_unlock(&shards[i].bs_mutex);
+  }
+  return size;
+}
+
 
 /**
  *
  */
 static uint64_t 
-blobcache_compute_maxsize(void)
+blobcache_compute_maxsize(uint64_t csize)
 {
-  uint64_t avail = arch_cache_avail_bytes() + current_cache_size;
+  uint64_t avail = arch_cache_avail_bytes() + csize;
   avail = MAX(BLOB_CACHE_MINSIZE, MIN(avail / 10, BLOB_CACHE_MAXSIZE));
   return avail;
 }
@@ -131,6 +173,86 @@ digest_content(const void *data, size_t len)
 }
 
 
+/**
+ * Assume shard is locked
+ */
+static blobcache_item_t *
+shard_lookup(blobcache_shard_t *bs, uint64_t dk)
+{
+  blobcache_item_t *p;
+  LIST_FOREACH(p, &bs->bs_hash[dk & (bs->bs_hashsize - 1)], bi_link)
+    if(p->bi_key_hash == dk)
+      return p;
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+shard_rehash(blobcache_shard_t *bs, unsigned int newsize)
+{
+  struct blobcache_item_list *h = calloc(newsize, sizeof(*h));
+  blobcache_item_t *p;
+  unsigned int i;
+
+  for(i = 0; i < bs->bs_hashsize; i++) {
+    while((p = LIST_FIRST(&bs->bs_hash[i])) != NULL) {
+      LIST_REMOVE(p, bi_link);
+      LIST_INSERT_HEAD(&h[p->bi_key_hash & (newsize - 1)], p, bi_link);
+    }
+  }
+  free(bs->bs_hash);
+  bs->bs_hash = h;
+  bs->bs_hashsize = newsize;
+}
+
+
+/**
+ * Insert a new item as most recently used. Assume shard is locked
+ */
+static void
+shard_insert(blobcache_shard_t *bs, blobcache_item_t *p)
+{
+  if(bs->bs_count >= bs->bs_hashsize * 2)
+    shard_rehash(bs, bs->bs_hashsize * 2);
+
+  LIST_INSERT_HEAD(&bs->bs_hash[p->bi_key_hash & (bs->bs_hashsize - 1)],
+		   p, bi_link);
+  TAILQ_INSERT_TAIL(&bs->bs_lru, p, bi_lru_link);
+  p->bi_seq = atomic_add(&access_tally, 1);
+  bs->bs_count++;
+  bs->bs_size += p->bi_size;
+}
+
+
+/**
+ * Assume shard is locked
+ */
+static void
+shard_remove(blobcache_shard_t *bs, blobcache_item_t *p)
+{
+  LIST_REMOVE(p, bi_link);
+  TAILQ_REMOVE(&bs->bs_lru, p, bi_lru_link);
+  bs->bs_count--;
+  bs->bs_size -= p->bi_size;
+}
+
+
+/**
+ * Mark item as most recently used. Assume shard is locked
+ */
+static void
+shard_touch(blobcache_shard_t *bs, blobcache_item_t *p, uint32_t now)
+{
+  p->bi_lastaccess = now;
+  p->bi_seq = atomic_add(&access_tally, 1);
+  TAILQ_REMOVE(&bs->bs_lru, p, bi_lru_link);
+  TAILQ_INSERT_TAIL(&bs->bs_lru, p, bi_lru_link);
+}
+
+
 /**
  *
  */
@@ -164,20 +286,25 @@ save_index(void)
   if(fd == -1)
     return;
 
-  hts_mutex_lock(&cache_lock);
-  int tot = pool_num(item_pool);
+  for(i = 0; i < BC_SHARDS; i++)
+    hts_mutex_lock(&shards[i].bs_mutex);
+
+  int tot = 0;
+  for(i = 0; i < BC_SHARDS; i++)
+    tot += shards[i].bs_count;
 
   siz = 4 + tot * sizeof(blobcache_diskitem_t) + 20;
   out = mymalloc(siz);
   if(out == NULL) {
-    hts_mutex_unlock(&cache_lock);
+    for(i = 0; i < BC_SHARDS; i++)
+      hts_mutex_unlock(&shards[i].bs_mutex);
     close(fd);
     return;
   }
   *(uint32_t *)out = BC2_MAGIC;
   j = 0;
-  for(i = 0; i < ITEM_HASH_SIZE; i++) {
-    for(p = hashvector[i]; p != NULL; p = p->bi_link) {
+  for(i = 0; i < BC_SHARDS; i++) {
+    TAILQ_FOREACH(p, &shards[i].bs_lru, bi_lru_link) {
       di = &((blobcache_diskitem_t *)(out + 4))[j++];
       di->di_key_hash     = p->bi_key_hash;
       di->di_content_hash = p->bi_content_hash;
@@ -187,7 +314,9 @@ save_index(void)
       di->di_size         = p->bi_size;
     }
   }
-  hts_mutex_unlock(&cache_lock);
+
+  for(i = 0; i < BC_SHARDS; i++)
+    hts_mutex_unlock(&shards[i].bs_mutex);
 
   sha1_decl(shactx);
   sha1_init(shactx);
@@ -203,6 +332,20 @@ save_index(void)
 
 
 
+/**
+ *
+ */
+static int
+accesstimecmp(const void *A, const void *B)
+{
+  const blobcache_diskitem_t *a = A;
+  const blobcache_diskitem_t *b = B;
+  if(a->di_lastaccess < b->di_lastaccess)
+    return -1;
+  return a->di_lastaccess > b->di_lastaccess;
+}
+
+
 /**
  *
  */
@@ -261,8 +404,16 @@ load_index(void)
     return;
   }
 
+  /* Rebuild LRU lists in access time order */
+  qsort(in + 4, items, sizeof(blobcache_diskitem_t), accesstimecmp);
+
   for(i = 0; i < items; i++) {
     di = &((blobcache_diskitem_t *)(in + 4))[i];
+    blobcache_shard_t *bs = &shards[BC_SHARD(di->di_key_hash)];
+
+    if(shard_lookup(bs, di->di_key_hash) != NULL)
+      continue;
+
     p = pool_get(item_pool);
 
     p->bi_key_hash     = di->di_key_hash;
@@ -271,9 +422,7 @@ load_index(void)
     p->bi_expiry       = di->di_expiry;
     p->bi_modtime      = di->di_modtime;
     p->bi_size         = di->di_size;
-    p->bi_link = hashvector[p->bi_key_hash & ITEM_HASH_MASK];
-    hashvector[p->bi_key_hash & ITEM_HASH_MASK] = p;
-    current_cache_size += p->bi_size;
+    shard_insert(bs, p);
   }
   free(in);
 }
@@ -292,84 +441,114 @@ blobcache_put(const char *key, const char *stash,
   uint64_t dc = digest_content(data, size);
   uint32_t now = time(NULL);
   char filename[PATH_MAX];
+  char tmpname[PATH_MAX];
   blobcache_item_t *p;
+  blobcache_shard_t *bs = &shards[BC_SHARD(dk)];
+  int64_t expiry = (int64_t)maxage + now;
 
-  hts_mutex_lock(&cache_lock);
-  for(p = hashvector[dk & ITEM_HASH_MASK]; p != NULL; p = p->bi_link)
-    if(p->bi_key_hash == dk)
-      break;
+  hts_mutex_lock(&bs->bs_mutex);
+  p = shard_lookup(bs, dk);
 
   if(p != NULL && p->bi_content_hash == dc && p->bi_size == size) {
     p->bi_modtime = mtime;
-    p->bi_expiry = now + maxage;
-    p->bi_lastaccess = now;
-    hts_mutex_unlock(&cache_lock);
+    p->bi_expiry = MIN(INT32_MAX, expiry);
+    shard_touch(bs, p, now);
+    hts_mutex_unlock(&bs->bs_mutex);
     return 1;
   }
+  hts_mutex_unlock(&bs->bs_mutex);
 
+  /* Write outside of lock. The file is renamed into place so readers
+     never see a partially written file */
   make_filename(filename, sizeof(filename), dk, 1);
-  int fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
-  if(fd == -1) {
-    hts_mutex_unlock(&cache_lock);
+  snprintf(tmpname, sizeof(tmpname), "%s.%x", filename,
+	   atomic_add(&tmpfile_tally, 1));
+
+  int fd = open(tmpname, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+  if(fd == -1)
     return 0;
-  }
 
   if(write(fd, data, size) != size) {
-    unlink(filename);
-    hts_mutex_unlock(&cache_lock);
+    close(fd);
+    unlink(tmpname);
     return 0;
   }
   close(fd);
 
-  if(p == NULL) {
-    p = pool_get(item_pool);
-    p->bi_key_hash = dk;
-    p->bi_size = 0;
+  /* Rename under the lock so a concurrent prune of this key can't
+     unlink the new file before it's in the index */
+  hts_mutex_lock(&bs->bs_mutex);
+
+  if(rename(tmpname, filename)) {
+    hts_mutex_unlock(&bs->bs_mutex);
+    unlink(tmpname);
+    return 0;
   }
 
-  int64_t expiry = (int64_t)maxage + now;
+  if((p = shard_lookup(bs, dk)) != NULL)
+    shard_remove(bs, p);
+  else
+    p = pool_get(item_pool);
 
+  p->bi_key_hash = dk;
   p->bi_modtime = mtime;
   p->bi_expiry = MIN(INT32_MAX, expiry);
   p->bi_lastaccess = now;
   p->bi_content_hash = dc;
-  current_cache_size -= p->bi_size;
   p->bi_size = size;
-  current_cache_size += p->bi_size;
+  shard_insert(bs, p);
 
-  p->bi_link = hashvector[dk & ITEM_HASH_MASK];
-  hashvector[dk & ITEM_HASH_MASK] = p;
+  hts_mutex_unlock(&bs->bs_mutex);
 
-  if(blobcache_compute_maxsize() < current_cache_size &&
+  uint64_t csize = current_cache_size();
+  if(blobcache_compute_maxsize(csize) < csize &&
      !callout_isarmed(&blobcache_callout))
-    callout_arm(&blobcache_callout, blobcache_do_prune, NULL, 5);
+    callout_arm_pooled(&blobcache_callout, blobcache_do_prune, NULL, 5);
 
-  hts_mutex_unlock(&cache_lock);
   return 0;
 }
 
 
 /**
- *
+ * Drop an item that turned out to be bad, unless it has been
+ * replaced by someone else in the meantime
  */
-void *
-blobcache_get(const char *key, const char *stash, size_t *sizep, int pad,
-	      int *ignore_expiry, char **etagp, time_t *mtimep)
+static void
+drop_item(blobcache_shard_t *bs, uint64_t dk, uint64_t dc)
+{
+  blobcache_item_t *p;
+
+  hts_mutex_lock(&bs->bs_mutex);
+  p = shard_lookup(bs, dk);
+  if(p != NULL && p->bi_content_hash == dc) {
+    shard_remove(bs, p);
+    pool_put(item_pool, p);
+  }
+  hts_mutex_unlock(&bs->bs_mutex);
+}
+
+
+/**
+ * Lookup item and open its file. Returns -1 if not found
+ */
+static int
+blobcache_open(const char *key, const char *stash, int *ignore_expiry,
+	       time_t *mtimep, size_t *sizep)
 {
   uint64_t dk = digest_key(key, stash);
-  blobcache_item_t *p, **q;
+  blobcache_shard_t *bs = &shards[BC_SHARD(dk)];
+  blobcache_item_t *p;
   char filename[PATH_MAX];
   struct stat st;
-  uint32_t now;
+  uint32_t now, size, modtime;
+  uint64_t dc;
 
-  hts_mutex_lock(&cache_lock);
-  for(q = &hashvector[dk & ITEM_HASH_MASK]; (p = *q); q = &p->bi_link)
-    if(p->bi_key_hash == dk)
-      break;
+  hts_mutex_lock(&bs->bs_mutex);
+  p = shard_lookup(bs, dk);
   
   if(p == NULL) {
-    hts_mutex_unlock(&cache_lock);
-    return NULL;
+    hts_mutex_unlock(&bs->bs_mutex);
+    return -1;
   }
   
   now = time(NULL);
@@ -377,57 +556,163 @@ blobcache_get(const char *key, const char *stash, size_t *sizep, int pad,
   int expired = now > p->bi_expiry;
 
   if(expired && ignore_expiry == NULL) {
-    hts_mutex_unlock(&cache_lock);
-    goto bad;
+    shard_remove(bs, p);
+    pool_put(item_pool, p);
+    hts_mutex_unlock(&bs->bs_mutex);
+    return -1;
   }
 
-  make_filename(filename, sizeof(filename), p->bi_key_hash, 0);
+  shard_touch(bs, p, now);
+  size = p->bi_size;
+  modtime = p->bi_modtime;
+  dc = p->bi_content_hash;
+  hts_mutex_unlock(&bs->bs_mutex);
+
+  make_filename(filename, sizeof(filename), dk, 0);
   int fd = open(filename, O_RDONLY, 0);
   if(fd == -1) {
-  bad:
-    *q = p->bi_link;
-    pool_put(item_pool, p);
-    hts_mutex_unlock(&cache_lock);
-    return NULL;
+    drop_item(bs, dk, dc);
+    return -1;
   }
   
-  if(fstat(fd, &st))
-    goto bad;
-
-  if(st.st_size != p->bi_size) {
-    unlink(filename);
-    goto bad;
+  if(fstat(fd, &st) || st.st_size != size) {
+    close(fd);
+    drop_item(bs, dk, dc);
+    return -1;
   }
 
   if(mtimep)
-    *mtimep = p->bi_modtime;
-
-  p->bi_lastaccess = now;
-
-  hts_mutex_unlock(&cache_lock);
+    *mtimep = modtime;
 
   if(ignore_expiry != NULL)
     *ignore_expiry = expired;
 
-  uint8_t *r = mymalloc(st.st_size + pad);
-  if(r == NULL) {
-    close(fd);
+  *sizep = st.st_size;
+  return fd;
+}
+
+
+/**
+ *
+ */
+static void *
+read_file(int fd, size_t size, int pad)
+{
+  uint8_t *r = mymalloc(size + pad);
+  if(r == NULL)
     return NULL;
-  }
 
-  if(read(fd, r, st.st_size) != st.st_size) {
+  if(read(fd, r, size) != size) {
     free(r);
-    close(fd);
     return NULL;
   }
-  memset(r + st.st_size, 0, pad);
-  close(fd);
+  memset(r + size, 0, pad);
+  return r;
+}
 
-  *sizep = st.st_size;
+
+/**
+ *
+ */
+void *
+blobcache_get(const char *key, const char *stash, size_t *sizep, int pad,
+	      int *ignore_expiry, char **etagp, time_t *mtimep)
+{
+  size_t size;
+  void *r;
+  int fd = blobcache_open(key, stash, ignore_expiry, mtimep, &size);
+
+  if(fd == -1)
+    return NULL;
+
+  r = read_file(fd, size, pad);
+  close(fd);
+  if(r != NULL)
+    *sizep = size;
   return r;
 }
 
 
+/**
+ * Like blobcache_get() but returns a refcounted read only view of the
+ * data. The file is mapped directly into memory if the slack at the
+ * end of its last page can hold the requested (zeroed) padding,
+ * otherwise it is read into a malloc()ed buffer
+ */
+blob_t *
+blobcache_get_blob(const char *key, const char *stash, int pad,
+		   int *ignore_expiry, time_t *mtimep)
+{
+  size_t size;
+  void *data = NULL;
+  blob_t *b;
+  int fd = blobcache_open(key, stash, ignore_expiry, mtimep, &size);
+
+  if(fd == -1)
+    return NULL;
+
+  b = malloc(sizeof(blob_t));
+  b->b_refcount = 1;
+  b->b_size = size;
+  b->b_maplen = 0;
+
+#if ENABLE_MMAP
+  size_t pagesize = sysconf(_SC_PAGESIZE);
+  size_t slack = size % pagesize ? pagesize - size % pagesize : 0;
+
+  if(slack >= pad) {
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED)
+      data = NULL;
+    else
+      b->b_maplen = size;
+  }
+#endif
+
+  if(data == NULL)
+    data = read_file(fd, size, pad);
+
+  close(fd);
+
+  if(data == NULL) {
+    free(b);
+    return NULL;
+  }
+  b->b_data = data;
+  return b;
+}
+
+
+/**
+ *
+ */
+blob_t *
+blob_dup(blob_t *b)
+{
+  atomic_add(&b->b_refcount, 1);
+  return b;
+}
+
+
+/**
+ *
+ */
+void
+blob_release(blob_t *b)
+{
+  if(atomic_add(&b->b_refcount, -1) > 1)
+    return;
+
+#if ENABLE_MMAP
+  if(b->b_maplen)
+    munmap((void *)b->b_data, b->b_maplen);
+  else
+#endif
+    free((void *)b->b_data);
+  free(b);
+}
+
+
 
 
 
@@ -439,13 +724,12 @@ blobcache_get_meta(const char *key, const char *stash,
 		   char **etagp, time_t *mtimep)
 {
   uint64_t dk = digest_key(key, stash);
+  blobcache_shard_t *bs = &shards[BC_SHARD(dk)];
   blobcache_item_t *p;
   int r;
-  hts_mutex_lock(&cache_lock);
-  for(p = hashvector[dk & ITEM_HASH_MASK]; p != NULL; p = p->bi_link)
-    if(p->bi_key_hash == dk)
-      break;
-  
+  hts_mutex_lock(&bs->bs_mutex);
+  p = shard_lookup(bs, dk);
+
   if(p != NULL) {
     r = 0;
 
@@ -456,22 +740,23 @@ blobcache_get_meta(const char *key, const char *stash,
     r = -1;
   }
 
-  hts_mutex_unlock(&cache_lock);
+  hts_mutex_unlock(&bs->bs_mutex);
   return r;
 }
 
 
 /**
- * Assume we're locked
+ *
  */
-static blobcache_item_t *
-lookup_item(uint64_t dk)
+static int
+item_exists(uint64_t dk)
 {
-  blobcache_item_t *p;
-  for(p = hashvector[dk & ITEM_HASH_MASK]; p != NULL; p = p->bi_link)
-    if(p->bi_key_hash == dk)
-      return p;
-  return NULL;
+  blobcache_shard_t *bs = &shards[BC_SHARD(dk)];
+  int r;
+  hts_mutex_lock(&bs->bs_mutex);
+  r = shard_lookup(bs, dk) != NULL;
+  hts_mutex_unlock(&bs->bs_mutex);
+  return r;
 }
 
 /**
@@ -505,8 +790,9 @@ prune_stale(void)
 		     showtime_cache_path, de1->d_name,
 		     de2->d_name);
 
-	    if(sscanf(de2->d_name, "%016"PRIx64, &k) != 1 ||
-	       lookup_item(k) == NULL) {
+	    if(strlen(de2->d_name) != 16 ||
+	       sscanf(de2->d_name, "%016"PRIx64, &k) != 1 ||
+	       !item_exists(k)) {
 	      TRACE(TRACE_DEBUG, "Blobcache", "Removed stale file %s", path3);
 	      unlink(path3);
 	    }
@@ -524,7 +810,7 @@ prune_stale(void)
 
 
 /**
- *
+ * Shard lock must be held
  */
 static void
 prune_item(blobcache_item_t *p)
@@ -537,59 +823,56 @@ prune_item(blobcache_item_t *p)
 
 
 /**
+ * Evict least recently used items until we are below the size limit.
  *
- */
-static int
-accesstimecmp(const void *A, const void *B)
-{
-  const blobcache_item_t *a = *(const blobcache_item_t **)A;
-  const blobcache_item_t *b = *(const blobcache_item_t **)B;
-  return a->bi_lastaccess - b->bi_lastaccess;
-}
-
-
-/**
- *
+ * Each shard's LRU list is ordered, so the globally oldest item is at
+ * the head of one of them. Cost per evicted item is O(BC_SHARDS).
+ * bi_lastaccess only has second resolution so heads are compared
+ * using the access sequence number instead
  */
 static void
 prune_to_size(void)
 {
-  int i, tot, j = 0;
-  uint64_t maxsize = blobcache_compute_maxsize();
-  blobcache_item_t *p, **sv;
-
-  hts_mutex_lock(&cache_lock);
-  tot = pool_num(item_pool);
-
-  sv = malloc(sizeof(blobcache_item_t *) * tot);
-  current_cache_size = 0;
-  for(i = 0; i < ITEM_HASH_SIZE; i++) {
-    for(p = hashvector[i]; p != NULL; p = p->bi_link) {
-      sv[j++] = p;
-      current_cache_size += p->bi_size;
-    }
-    hashvector[i] = NULL;
-  }
+  uint64_t csize = current_cache_size();
+  uint64_t maxsize = blobcache_compute_maxsize(csize);
+  blobcache_item_t *p;
+  blobcache_shard_t *bs, *victim;
+  uint32_t oldest = 0;
+  int i;
 
-  assert(j == tot);
+  while(csize > maxsize) {
 
-  qsort(sv, j, sizeof(blobcache_item_t *), accesstimecmp);
-  for(i = 0; i < j; i++) {
-    p = sv[i];
-    if(current_cache_size < maxsize)
+    victim = NULL;
+
+    for(i = 0; i < BC_SHARDS; i++) {
+      bs = &shards[i];
+      hts_mutex_lock(&bs->bs_mutex);
+      p = TAILQ_FIRST(&bs->bs_lru);
+      if(p != NULL &&
+	 (victim == NULL || (int32_t)(p->bi_seq - oldest) < 0)) {
+	oldest = p->bi_seq;
+	victim = bs;
+      }
+      hts_mutex_unlock(&bs->bs_mutex);
+    }
+
+    if(victim == NULL)
       break;
-    current_cache_size -= p->bi_size;
-    prune_item(p);
-  }
 
-  for(; i < j; i++) {
-    p = sv[i];
-    p->bi_link = hashvector[p->bi_key_hash & ITEM_HASH_MASK];
-    hashvector[p->bi_key_hash & ITEM_HASH_MASK] = p;
+    /* The item may have been touched or removed after we peeked at it,
+       just take whatever is oldest in the shard now */
+    hts_mutex_lock(&victim->bs_mutex);
+    p = TAILQ_FIRST(&victim->bs_lru);
+    if(p != NULL) {
+      csize -= MIN(csize, p->bi_size);
+      shard_remove(victim, p);
+      /* Unlink under the shard lock, or a concurrent put of the same
+         key could have its fresh file removed */
+      prune_item(p);
+    }
+    hts_mutex_unlock(&victim->bs_mutex);
   }
 
-  free(sv);
-  hts_mutex_unlock(&cache_lock);
   save_index();
 }
 
@@ -647,19 +930,18 @@ static void
 cache_clear(void *opaque, prop_event_t event, ...)
 {
   int i;
-  blobcache_item_t *p, *n;
-
-  hts_mutex_lock(&cache_lock);
+  blobcache_item_t *p;
+  blobcache_shard_t *bs;
 
-  for(i = 0; i < ITEM_HASH_SIZE; i++) {
-    for(p = hashvector[i]; p != NULL; p = n) {
-      n = p->bi_link;
+  for(i = 0; i < BC_SHARDS; i++) {
+    bs = &shards[i];
+    hts_mutex_lock(&bs->bs_mutex);
+    while((p = TAILQ_FIRST(&bs->bs_lru)) != NULL) {
+      shard_remove(bs, p);
       prune_item(p);
     }
-    hashvector[i] = NULL;
+    hts_mutex_unlock(&bs->bs_mutex);
   }
-  current_cache_size = 0;
-  hts_mutex_unlock(&cache_lock);
   save_index();
   notify_add(NULL, NOTIFY_INFO, NULL, 3, _("Cache cleared"));
 }
@@ -671,6 +953,7 @@ void
 blobcache_init(void)
 {
   char buf[256];
+  int i;
 
   blobcache_prune_old();
   snprintf(buf, sizeof(buf), "%s/bc2", showtime_cache_path);
@@ -678,15 +961,22 @@ blobcache_init(void)
     TRACE(TRACE_ERROR, "blobcache", "Unable to create cache dir %s -- %s",
 	  buf, strerror(errno));
 
-  hts_mutex_init(&cache_lock);
-  item_pool = pool_create("blobcacheitems", sizeof(blobcache_item_t), 0);
+  for(i = 0; i < BC_SHARDS; i++) {
+    blobcache_shard_t *bs = &shards[i];
+    hts_mutex_init(&bs->bs_mutex);
+    bs->bs_hashsize = BC_HASH_INITIAL;
+    bs->bs_hash = calloc(bs->bs_hashsize, sizeof(*bs->bs_hash));
+    TAILQ_INIT(&bs->bs_lru);
+  }
+  item_pool = pool_create("blobcacheitems", sizeof(blobcache_item_t),
+			  POOL_REENTRANT);
 
   load_index();
   prune_stale();
   prune_to_size();
   TRACE(TRACE_INFO, "blobcache",
 	"Initialized: %d items consuming %"PRId64" bytes on disk in %s",
-	pool_num(item_pool), current_cache_size, buf);
+	pool_num(item_pool), current_cache_size(), buf);
 
   settings_create_action(settings_general, _p("Clear cached files"),
 			 cache_clear, NULL, NULL);
@@ -93,6 +93,187 @@ db_prepare(sqlite3 *db, const char *zSql, int nSql,
   return rc;
 }
 
+/**
+ * Per connection cache of prepared statements, keyed by SQL text.
+ *
+ * A connection is only used by one thread at a time so the entries
+ * themselves are not locked, db_stmt_mutex only protects the lookup
+ * from connection to cache
+ */
+#define DB_STMT_CACHE_SIZE 32
+#define DB_STMT_CACHE_HASH 16
+
+typedef struct db_stmt_entry {
+  sqlite3_stmt *dse_stmt;
+  unsigned int dse_hash;
+  int dse_inuse;
+  int dse_lastuse;
+} db_stmt_entry_t;
+
+typedef struct db_stmt_cache {
+  LIST_ENTRY(db_stmt_cache) dsc_link;
+  sqlite3 *dsc_db;
+  int dsc_tally;
+  db_stmt_entry_t dsc_entries[DB_STMT_CACHE_SIZE];
+} db_stmt_cache_t;
+
+static LIST_HEAD(, db_stmt_cache) db_stmt_caches[DB_STMT_CACHE_HASH];
+static hts_mutex_t db_stmt_mutex;
+
+#define DB_STMT_CACHE_BUCKET(db) \
+  ((((uintptr_t)(db)) / sizeof(void *)) % DB_STMT_CACHE_HASH)
+
+
+/**
+ *
+ */
+void
+db_init(void)
+{
+  hts_mutex_init(&db_stmt_mutex);
+}
+
+
+/**
+ *
+ */
+static db_stmt_cache_t *
+db_stmt_cache_get(sqlite3 *db, int create)
+{
+  db_stmt_cache_t *dsc;
+  unsigned int bucket = DB_STMT_CACHE_BUCKET(db);
+
+  hts_mutex_lock(&db_stmt_mutex);
+  LIST_FOREACH(dsc, &db_stmt_caches[bucket], dsc_link)
+    if(dsc->dsc_db == db)
+      break;
+
+  if(dsc == NULL && create) {
+    dsc = calloc(1, sizeof(db_stmt_cache_t));
+    dsc->dsc_db = db;
+    LIST_INSERT_HEAD(&db_stmt_caches[bucket], dsc, dsc_link);
+  }
+  hts_mutex_unlock(&db_stmt_mutex);
+  return dsc;
+}
+
+
+/**
+ * Prepare a statement, reusing a previously prepared one for the same
+ * SQL text on this connection if possible. The statement must be
+ * returned with db_stmt_release() rather than sqlite3_finalize()
+ */
+int
+db_stmt_prepare(sqlite3 *db, const char *sql, sqlite3_stmt **ppStmt)
+{
+  db_stmt_cache_t *dsc = db_stmt_cache_get(db, 1);
+  db_stmt_entry_t *dse, *victim = NULL;
+  unsigned int hash = mystrhash(sql);
+  int i, rc;
+
+  for(i = 0; i < DB_STMT_CACHE_SIZE; i++) {
+    dse = &dsc->dsc_entries[i];
+
+    if(dse->dse_stmt == NULL) {
+      if(victim == NULL || victim->dse_stmt != NULL)
+	victim = dse;
+      continue;
+    }
+
+    if(dse->dse_inuse)
+      continue;
+
+    if(dse->dse_hash == hash && !strcmp(sqlite3_sql(dse->dse_stmt), sql)) {
+      dse->dse_inuse = 1;
+      dse->dse_lastuse = ++dsc->dsc_tally;
+      *ppStmt = dse->dse_stmt;
+      return SQLITE_OK;
+    }
+
+    if(victim == NULL ||
+       (victim->dse_stmt != NULL && dse->dse_lastuse < victim->dse_lastuse))
+      victim = dse;
+  }
+
+  rc = db_prepare(db, sql, -1, ppStmt, NULL);
+  if(rc != SQLITE_OK || victim == NULL)
+    return rc; // All slots busy, statement will not be cached
+
+  if(victim->dse_stmt != NULL)
+    sqlite3_finalize(victim->dse_stmt);
+
+  victim->dse_stmt = *ppStmt;
+  victim->dse_hash = hash;
+  victim->dse_inuse = 1;
+  victim->dse_lastuse = ++dsc->dsc_tally;
+  return SQLITE_OK;
+}
+
+
+/**
+ *
+ */
+void
+db_stmt_release(sqlite3_stmt *stmt)
+{
+  db_stmt_cache_t *dsc = db_stmt_cache_get(sqlite3_db_handle(stmt), 0);
+  int i;
+
+  if(dsc != NULL) {
+    for(i = 0; i < DB_STMT_CACHE_SIZE; i++) {
+      db_stmt_entry_t *dse = &dsc->dsc_entries[i];
+      if(dse->dse_stmt == stmt) {
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	dse->dse_inuse = 0;
+	return;
+      }
+    }
+  }
+  sqlite3_finalize(stmt);
+}
+
+
+/**
+ * Finalize all cached statements for the connection
+ */
+static void
+db_stmt_cache_flush(sqlite3 *db)
+{
+  db_stmt_cache_t *dsc = db_stmt_cache_get(db, 0);
+  int i;
+
+  if(dsc == NULL)
+    return;
+
+  hts_mutex_lock(&db_stmt_mutex);
+  LIST_REMOVE(dsc, dsc_link);
+  hts_mutex_unlock(&db_stmt_mutex);
+
+  for(i = 0; i < DB_STMT_CACHE_SIZE; i++) {
+    db_stmt_entry_t *dse = &dsc->dsc_entries[i];
+    if(dse->dse_stmt == NULL)
+      continue;
+    if(dse->dse_inuse)
+      TRACE(TRACE_ERROR, "DB", "Statement not released: %s",
+	    sqlite3_sql(dse->dse_stmt));
+    sqlite3_finalize(dse->dse_stmt);
+  }
+  free(dsc);
+}
+
+
+/**
+ *
+ */
+static void
+db_close(sqlite3 *db)
+{
+  db_stmt_cache_flush(db);
+  sqlite3_close(db);
+}
+
+
 /**
  *
  */
@@ -381,7 +562,7 @@ db_pool_put(db_pool_t *dp, sqlite3 *db)
     TRACE(TRACE_ERROR, "DB",
 	  "%s: db handle returned to pool while in transaction, closing handle",
 	  dp->dp_path);
-    sqlite3_close(db);
+    db_close(db);
     return;
   }
 
@@ -395,7 +576,7 @@ db_pool_put(db_pool_t *dp, sqlite3 *db)
   }
 
   hts_mutex_unlock(&dp->dp_mutex);
-  sqlite3_close(db);
+  db_close(db);
 }
 
 
@@ -413,6 +594,6 @@ db_pool_close(db_pool_t *dp)
   dp->dp_closed = 1;
   for(i = 0; i < dp->dp_size; i++)
     if(dp->dp_pool[i] != NULL)
-      sqlite3_close(dp->dp_pool[i]);
+      db_close(dp->dp_pool[i]);
   hts_mutex_unlock(&dp->dp_mutex);
 }
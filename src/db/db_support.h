@@ -19,6 +19,12 @@ int db_step(sqlite3_stmt *pStmt);
 int db_prepare(sqlite3 *db, const char *zSql, int nSql,
 	       sqlite3_stmt **ppStmt, const char **pz);
 
+void db_init(void);
+
+int db_stmt_prepare(sqlite3 *db, const char *sql, sqlite3_stmt **ppStmt);
+
+void db_stmt_release(sqlite3_stmt *stmt);
+
 #define db_begin(db)    db_begin0(db, __FUNCTION__)
 #define db_commit(db)   db_commit0(db, __FUNCTION__)
 #define db_rollback(db) db_rollback0(db, __FUNCTION__)
@@ -22,12 +22,14 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <dirent.h>
 
 #include <arch/threads.h>
 #include "showtime.h"
 #include "fileaccess.h"
 #include "fa_proto.h"
 #include "misc/redblack.h"
+#include "misc/sha.h"
 
 
 TAILQ_HEAD(cached_segment_queue, cached_segment);
@@ -38,6 +40,7 @@ TAILQ_HEAD(cached_file_queue, cached_file);
 LIST_HEAD(cached_file_handle_list, cached_file_handle);
 
 static char *cachefile;
+static char *cachedir;
 
 static hts_mutex_t cache_mutex;
 
@@ -47,11 +50,33 @@ static struct cached_file_queue cached_files;
 #define PAGE_SIZE (1 << PAGE_SHIFT)
 #define PAGE_MASK (PAGE_SIZE - 1)
 
+/**
+ * Upper bound of the persistent page cache (all files in facache/)
+ */
+#define FAC_CACHE_MAXSIZE (1024 * 1024 * 1024)
+
+#define FAC_INDEX_MAGIC 0x46414331 // FAC1
+
+/**
+ * Number of fetch threads per file. Each one owns a source handle
+ * of its own so this many page requests can be in flight at once
+ */
+#define FAC_WORKERS 3
+
+/**
+ * Read-ahead window limits (in pages). The window grows when the
+ * reader stalls and otherwise tracks how much data we need to keep
+ * ahead of the reader to hide FAC_HORIZON fetch latencies
+ */
+#define FAC_WINDOW_MIN   (FAC_WORKERS * 2)
+#define FAC_HORIZON      4
+
 /**
  *
  */
 typedef struct cached_page {
   int cp_file_offset;
+  int cp_fetching;
 } cached_page_t;
 
 
@@ -63,13 +88,20 @@ typedef struct cached_file {
 
   int cf_ref_count;
 
+  TAILQ_ENTRY(cached_file) cf_link;
+  uint64_t cf_key;
+  int cf_persistent;
+  time_t cf_mtime;
+
   uint64_t cf_pos;
   hts_cond_t cf_cond_req;
   hts_cond_t cf_cond_resp;
   int cf_pending;
+  int cf_miss_page;
 
   fa_handle_t *cf_src;
-  uint64_t cf_src_pos;
+  char *cf_url;
+  int cf_flags;
 
   uint64_t cf_size;
   int cf_fd[2];
@@ -89,8 +121,26 @@ typedef struct cached_file {
   int cf_page_mask;
   int cf_num_pages;
 
+  int cf_window;
+  int cf_inflight;
+
+  /**
+   * Running averages (in bytes/s and µs) used to size the window
+   */
+  int64_t cf_consume_ts;
+  int64_t cf_consumed;
+  int cf_consume_rate;
+  int cf_fetch_rate;
+  int cf_latency;
+
+  int cf_hits;
+  int cf_misses;
+
   prop_t *cf_stats_cachesize;
   prop_t *cf_stats_cachemax;
+  prop_t *cf_stats_hits;
+  prop_t *cf_stats_misses;
+  prop_t *cf_stats_latency;
 
 } cached_file_t;
 
@@ -124,6 +174,7 @@ cf_setup_segment_vector(cached_file_t *cf)
   memset(cf->cf_pages, 0xff, sizeof(cached_page_t) * num_pages);
   cf->cf_page_mask = num_pages - 1;
   cf->cf_num_pages = num_pages;
+  cf->cf_window = FAC_WINDOW_MIN;
 }
 
 /**
@@ -151,6 +202,311 @@ get_anon_file(int fd[2])
 }
 
 
+/**
+ * On-disk index of a persistent page file. The header is followed by
+ * the URL (fih_urllen bytes) and fih_num_ranges fac_index_range_t
+ * describing which pages of the source are present.
+ *
+ * Pages are stored direct mapped, page N of the source lives at
+ * (N & page_mask) * PAGE_SIZE in the page file
+ */
+typedef struct fac_index_hdr {
+  uint32_t fih_magic;
+  uint32_t fih_num_pages;
+  uint64_t fih_size;
+  int64_t fih_mtime;
+  uint32_t fih_urllen;
+  uint32_t fih_num_ranges;
+} fac_index_hdr_t;
+
+typedef struct fac_index_range {
+  int32_t fir_page;
+  int32_t fir_count;
+} fac_index_range_t;
+
+
+/**
+ *
+ */
+static uint64_t
+digest_key(const char *url)
+{
+  union {
+    uint8_t d[20];
+    uint64_t u64;
+  } u;
+  sha1_decl(shactx);
+  sha1_init(shactx);
+  sha1_update(shactx, (const uint8_t *)url, strlen(url));
+  sha1_final(shactx, u.d);
+  return u.u64;
+}
+
+
+/**
+ *
+ */
+static void
+cf_path(char *buf, size_t len, uint64_t key, const char *suffix)
+{
+  snprintf(buf, len, "%s/%016"PRIx64".%s", cachedir, key, suffix);
+}
+
+
+/**
+ *
+ */
+static int
+int32_cmp(const void *A, const void *B)
+{
+  const int32_t *a = A, *b = B;
+  return *a < *b ? -1 : *a > *b;
+}
+
+
+/**
+ * Load the range index for a persistent file. The index is removed
+ * once loaded so a crash while the file is open can't leave an index
+ * that no longer matches the page file behind.
+ *
+ * Returns number of pages loaded or -1 if there is no usable index
+ */
+static int
+cf_load_index(cached_file_t *cf, const char *url)
+{
+  char path[512];
+  fac_index_hdr_t fih;
+  fac_index_range_t *fir = NULL;
+  char *u = NULL;
+  int i, j, fd, r = -1;
+
+  cf_path(path, sizeof(path), cf->cf_key, "idx");
+  if((fd = open(path, O_RDONLY)) == -1)
+    return -1;
+  unlink(path);
+
+  if(read(fd, &fih, sizeof(fih)) != sizeof(fih) ||
+     fih.fih_magic != FAC_INDEX_MAGIC ||
+     fih.fih_num_pages != cf->cf_num_pages ||
+     fih.fih_size != cf->cf_size ||
+     fih.fih_mtime != cf->cf_mtime ||
+     fih.fih_urllen != strlen(url) ||
+     fih.fih_num_ranges > cf->cf_num_pages)
+    goto out;
+
+  u = malloc(fih.fih_urllen);
+  if(read(fd, u, fih.fih_urllen) != fih.fih_urllen ||
+     memcmp(u, url, fih.fih_urllen))
+    goto out;
+
+  size_t rsize = sizeof(fac_index_range_t) * fih.fih_num_ranges;
+  fir = malloc(rsize);
+  if(read(fd, fir, rsize) != rsize)
+    goto out;
+
+  int maxpage = (cf->cf_size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  r = 0;
+  for(i = 0; i < fih.fih_num_ranges; i++) {
+    for(j = 0; j < fir[i].fir_count; j++) {
+      int vpage = fir[i].fir_page + j;
+      if(vpage < 0 || vpage >= maxpage)
+	break;
+      cf->cf_pages[vpage & cf->cf_page_mask].cp_file_offset = vpage;
+      r++;
+    }
+  }
+ out:
+  free(u);
+  free(fir);
+  close(fd);
+  return r;
+}
+
+
+/**
+ * Write the range index for a persistent file. Called once all
+ * workers are gone so the page table is stable
+ */
+static void
+cf_save_index(cached_file_t *cf)
+{
+  char path[512];
+  fac_index_hdr_t fih;
+  int32_t *pages = malloc(sizeof(int32_t) * cf->cf_num_pages);
+  fac_index_range_t *fir = malloc(sizeof(fac_index_range_t) *
+				  cf->cf_num_pages);
+  int i, n = 0, nr = 0;
+
+  for(i = 0; i < cf->cf_num_pages; i++)
+    if(cf->cf_pages[i].cp_file_offset != -1)
+      pages[n++] = cf->cf_pages[i].cp_file_offset;
+
+  qsort(pages, n, sizeof(int32_t), int32_cmp);
+
+  for(i = 0; i < n; i++) {
+    if(nr > 0 && fir[nr - 1].fir_page + fir[nr - 1].fir_count == pages[i]) {
+      fir[nr - 1].fir_count++;
+    } else {
+      fir[nr].fir_page = pages[i];
+      fir[nr].fir_count = 1;
+      nr++;
+    }
+  }
+
+  const char *url = cf->cf_url;
+  fih.fih_magic = FAC_INDEX_MAGIC;
+  fih.fih_num_pages = cf->cf_num_pages;
+  fih.fih_size = cf->cf_size;
+  fih.fih_mtime = cf->cf_mtime;
+  fih.fih_urllen = strlen(url);
+  fih.fih_num_ranges = nr;
+
+  cf_path(path, sizeof(path), cf->cf_key, "idx");
+
+  int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+  if(fd != -1) {
+    size_t rsize = sizeof(fac_index_range_t) * nr;
+    if(write(fd, &fih, sizeof(fih)) != sizeof(fih) ||
+       write(fd, url, fih.fih_urllen) != fih.fih_urllen ||
+       write(fd, fir, rsize) != rsize) {
+      unlink(path);
+    }
+    close(fd);
+  }
+
+  TRACE(TRACE_DEBUG, "Read-ahead", "Saved %d pages in %d ranges for %s",
+	n, nr, url);
+  free(pages);
+  free(fir);
+}
+
+
+/**
+ * Open the persistent page file for cf, loading any pages stored
+ * by an earlier session
+ */
+static int
+cf_open_persistent(cached_file_t *cf, const char *url)
+{
+  char path[512];
+  int n = cf_load_index(cf, url);
+  int trunc = n == -1 ? O_TRUNC : 0;
+
+  cf_path(path, sizeof(path), cf->cf_key, "pages");
+
+  cf->cf_fd[0] = open(path, O_CREAT | O_WRONLY | trunc, 0666);
+  cf->cf_fd[1] = open(path, O_RDONLY);
+
+  if(cf->cf_fd[0] == -1 || cf->cf_fd[1] == -1) {
+    if(cf->cf_fd[0] != -1)
+      close(cf->cf_fd[0]);
+    if(cf->cf_fd[1] != -1)
+      close(cf->cf_fd[1]);
+    memset(cf->cf_pages, 0xff, sizeof(cached_page_t) * cf->cf_num_pages);
+    return -1;
+  }
+
+  if(n > 0)
+    TRACE(TRACE_DEBUG, "Read-ahead", "Reusing %d cached pages for %s",
+	  n, url);
+  return 0;
+}
+
+
+/**
+ *
+ */
+typedef struct fac_entry {
+  uint64_t fe_key;
+  time_t fe_atime;
+  int64_t fe_size;
+} fac_entry_t;
+
+
+/**
+ *
+ */
+static int
+fac_entry_cmp(const void *A, const void *B)
+{
+  const fac_entry_t *a = A, *b = B;
+  return a->fe_atime < b->fe_atime ? -1 : a->fe_atime > b->fe_atime;
+}
+
+
+/**
+ * Keep the persistent cache below FAC_CACHE_MAXSIZE by removing the
+ * least recently closed files. Page files without an index are either
+ * open right now or left over from a crash, only the latter are removed
+ *
+ * Must be called with cache_mutex locked
+ */
+static void
+fac_prune(void)
+{
+  char path[512];
+  struct dirent *d;
+  struct stat st;
+  cached_file_t *cf;
+  DIR *dir;
+  fac_entry_t *v = NULL;
+  int i, n = 0, cap = 0;
+  int64_t total = 0;
+  uint64_t key;
+
+  if((dir = opendir(cachedir)) == NULL)
+    return;
+
+  while((d = readdir(dir)) != NULL) {
+    if(strlen(d->d_name) != 22 || strcmp(d->d_name + 16, ".pages") ||
+       sscanf(d->d_name, "%016"PRIx64, &key) != 1)
+      continue;
+
+    cf_path(path, sizeof(path), key, "pages");
+    if(stat(path, &st))
+      continue;
+
+    int64_t size = (int64_t)st.st_blocks * 512;
+
+    cf_path(path, sizeof(path), key, "idx");
+    if(stat(path, &st)) {
+      TAILQ_FOREACH(cf, &cached_files, cf_link)
+	if(cf->cf_key == key)
+	  break;
+      if(cf == NULL) {
+	cf_path(path, sizeof(path), key, "pages");
+	unlink(path);
+      } else {
+	total += size;
+      }
+      continue;
+    }
+
+    if(n == cap) {
+      cap = cap * 2 + 16;
+      v = realloc(v, cap * sizeof(fac_entry_t));
+    }
+    v[n].fe_key = key;
+    v[n].fe_atime = st.st_mtime;
+    v[n].fe_size = size;
+    total += size;
+    n++;
+  }
+  closedir(dir);
+
+  qsort(v, n, sizeof(fac_entry_t), fac_entry_cmp);
+
+  for(i = 0; i < n && total > FAC_CACHE_MAXSIZE; i++) {
+    cf_path(path, sizeof(path), v[i].fe_key, "idx");
+    unlink(path);
+    cf_path(path, sizeof(path), v[i].fe_key, "pages");
+    unlink(path);
+    total -= v[i].fe_size;
+  }
+  free(v);
+}
+
+
 /**
  *
  */
@@ -160,13 +516,27 @@ cf_release(cached_file_t *cf)
   if(atomic_add(&cf->cf_ref_count, -1) > 1)
     return;
   
+  if(cf->cf_persistent) {
+    cf_save_index(cf);
+    hts_mutex_lock(&cache_mutex);
+    TAILQ_REMOVE(&cached_files, cf, cf_link);
+    fac_prune();
+    hts_mutex_unlock(&cache_mutex);
+  }
+
   close(cf->cf_fd[0]);
   close(cf->cf_fd[1]);
-  fa_close(cf->cf_src);
+  if(cf->cf_src != NULL)
+    fa_close(cf->cf_src);
   hts_mutex_destroy(&cf->cf_mutex);
   hts_cond_destroy(&cf->cf_cond_req);
   hts_cond_destroy(&cf->cf_cond_resp);
   prop_ref_dec(cf->cf_stats_cachesize);
+  prop_ref_dec(cf->cf_stats_hits);
+  prop_ref_dec(cf->cf_stats_misses);
+  prop_ref_dec(cf->cf_stats_latency);
+  free(cf->cf_pages);
+  free(cf->cf_url);
   free(cf);
 }
 
@@ -181,7 +551,7 @@ fac_close(fa_handle_t *handle)
 
   hts_mutex_lock(&cf->cf_mutex);
   cf->cf_thread_running = 0;
-  hts_cond_signal(&cf->cf_cond_req);
+  hts_cond_broadcast(&cf->cf_cond_req);
   hts_mutex_unlock(&cf->cf_mutex);
   cf_release(cf);
 }
@@ -223,7 +593,7 @@ fac_seek(fa_handle_t *handle, int64_t pos, int whence)
 
   if(cf->cf_pos != np) {
     cf->cf_pos = np;
-    hts_cond_signal(&cf->cf_cond_req);
+    hts_cond_broadcast(&cf->cf_cond_req);
   }
   hts_mutex_unlock(&cf->cf_mutex);
   return np;
@@ -242,72 +612,135 @@ fac_fsize(fa_handle_t *handle)
 
 
 /**
+ * Exponential moving average with a weight of 1/8 for new samples
+ */
+static int
+ewma(int avg, int64_t sample)
+{
+  if(avg == 0)
+    return sample;
+  return (avg * 7 + sample) / 8;
+}
+
+
+/**
+ * Recompute the read-ahead window. We want to keep FAC_HORIZON fetch
+ * latencies worth of consumption buffered ahead of the reader. If the
+ * source can't keep up with the reader there is no point in shrinking
+ * since we are going to stall anyway
+ *
+ * Must be called with cf_mutex locked
+ */
+static void
+fac_update_window(cached_file_t *cf)
+{
+  int maxwin = cf->cf_num_pages - 10;
+  int64_t want = (int64_t)cf->cf_consume_rate * cf->cf_latency *
+    FAC_HORIZON / 1000000 / PAGE_SIZE;
+  int w = cf->cf_window;
+
+  if(want > w)
+    w = want;
+  else if(cf->cf_fetch_rate > cf->cf_consume_rate && want < w / 2)
+    w--;
+
+  cf->cf_window = MIN(MAX(w, FAC_WINDOW_MIN), maxwin);
+}
+
+
+/**
+ * Pick next page to fetch. A reader blocking on a miss always goes
+ * first, after that we fill the window ahead of the current position
+ *
+ * Must be called with cf_mutex locked
+ */
+static int
+fac_next_page(cached_file_t *cf)
+{
+  cached_page_t *cp;
+  int i, vpage;
+
+  if(cf->cf_pending == 1) {
+    vpage = cf->cf_miss_page;
+    cp = cf->cf_pages + (vpage & cf->cf_page_mask);
+    if(cp->cp_file_offset != vpage && cp->cp_fetching == -1)
+      return vpage;
+  }
+
+  int basepage = cf->cf_pos >> PAGE_SHIFT;
+  int ra = 0;
+
+  for(i = 0; i < cf->cf_window; i++) {
+    vpage = basepage + i;
+    if((int64_t)vpage << PAGE_SHIFT >= cf->cf_size)
+      break;
+
+    cp = cf->cf_pages + (vpage & cf->cf_page_mask);
+    if(cp->cp_file_offset == vpage) {
+      if(ra == i)
+        ra++;
+      continue;
+    }
+    if(cp->cp_fetching != -1)
+      continue;
+
+    prop_set_int(cf->cf_stats_cachesize, (int64_t)ra * PAGE_SIZE);
+    return vpage;
+  }
+  prop_set_int(cf->cf_stats_cachesize, (int64_t)ra * PAGE_SIZE);
+  return -1;
+}
+
+
+/**
+ * Fetch a page from the source into the page file
  *
+ * Called with cf_mutex locked, but it is released during I/O
  */
 static int
-cache_page(cached_file_t *cf, int vpage, void *buf)
+cache_page(cached_file_t *cf, fa_handle_t *src, int vpage, void *buf)
 {
   int dpage = vpage & cf->cf_page_mask;
   cached_page_t *cp = cf->cf_pages + dpage;
-  
-  if(cp->cp_file_offset == vpage)
-    return 0;
-
   int64_t srcoffset = (int64_t) vpage << PAGE_SHIFT;
-  
-  if(srcoffset >= cf->cf_size)
-    return 0;
 
   cp->cp_file_offset = -1;
+  cp->cp_fetching = vpage;
+  cf->cf_inflight++;
   hts_mutex_unlock(&cf->cf_mutex);
 
+  int64_t ts = showtime_get_ts();
   int r;
 
-  if(fa_seek(cf->cf_src, srcoffset, SEEK_SET) == srcoffset) {
-    r = fa_read(cf->cf_src, buf, PAGE_SIZE);
+  if(fa_seek(src, srcoffset, SEEK_SET) == srcoffset) {
+    r = fa_read(src, buf, PAGE_SIZE);
   } else {
     r = -1;
   }
 
-  if(r <= 0) {
-    hts_mutex_lock(&cf->cf_mutex);
-    return -1;
-  }
+  int64_t delta = showtime_get_ts() - ts;
 
-  int64_t voff = dpage << PAGE_SHIFT;
+  if(r > 0) {
+    int64_t voff = (int64_t)dpage << PAGE_SHIFT;
+    if(pwrite(cf->cf_fd[0], buf, r, voff) != r)
+      r = -1;
+  }
 
-  r = lseek(cf->cf_fd[0], voff, SEEK_SET) != voff ||
-    write(cf->cf_fd[0], buf, r) <= 0;
-  
   hts_mutex_lock(&cf->cf_mutex);
-  if(r)
-    return -1;
+  cf->cf_inflight--;
+  cp->cp_fetching = -1;
 
-  cp->cp_file_offset = vpage;
-  return 1;
-}
+  if(r <= 0)
+    return -1;
 
+  cf->cf_latency = ewma(cf->cf_latency, delta);
+  if(delta > 0)
+    cf->cf_fetch_rate = ewma(cf->cf_fetch_rate, (int64_t)r * 1000000 *
+			     (cf->cf_inflight + 1) / delta);
+  prop_set_int(cf->cf_stats_latency, cf->cf_latency / 1000);
 
-/**
- *
- */
-static void
-cache_pages(cached_file_t *cf, void *buf)
-{
-  int i;
-  int basepage = cf->cf_pos >> PAGE_SHIFT;
-  int ra = 0;
-
-  for(i = 0; i < cf->cf_num_pages - 10; i++) {
-    if(cf->cf_pending == 1 || cf->cf_thread_running == 0)
-      break;
-    int r = cache_page(cf, basepage + i, buf);
-    if(r == -1)
-      break;
-    if(r == 1)
-      prop_set_int(cf->cf_stats_cachesize, ra * PAGE_SIZE);
-    ra++;
-  }
+  cp->cp_file_offset = vpage;
+  return 0;
 }
 
 
@@ -318,37 +751,62 @@ static void *
 fac_thread(void *aux)
 {
   cached_file_t *cf = aux;
+  fa_handle_t *src;
+  char errbuf[256];
+
+  hts_mutex_lock(&cf->cf_mutex);
+  src = cf->cf_src;
+  cf->cf_src = NULL;
+  hts_mutex_unlock(&cf->cf_mutex);
+
+  if(src == NULL) {
+    src = fa_open_ex(cf->cf_url, errbuf, sizeof(errbuf), cf->cf_flags, NULL);
+    if(src == NULL) {
+      TRACE(TRACE_DEBUG, "Read-ahead",
+	    "Unable to open additional stream for %s -- %s",
+	    cf->cf_url, errbuf);
+      cf_release(cf);
+      return NULL;
+    }
+  }
+
   void *buf = malloc(PAGE_SIZE);
 
   hts_mutex_lock(&cf->cf_mutex);
 
   while(cf->cf_thread_running == 1) {
 
-    if(cf->cf_pending == 1) {
+    int vpage = fac_next_page(cf);
+
+    if(vpage == -1) {
+      hts_cond_wait(&cf->cf_cond_req, &cf->cf_mutex);
+      continue;
+    }
+
+    int miss = cf->cf_pending == 1 && vpage == cf->cf_miss_page;
+
+    if(miss)
       TRACE(TRACE_DEBUG, "Read-ahead", "Cache miss at position %"PRId64,
 	    cf->cf_pos);
 
-      if(cache_page(cf, cf->cf_pos >> PAGE_SHIFT, buf) == -1) {
+    if(cache_page(cf, src, vpage, buf)) {
+      if(cf->cf_pending == 1 && vpage == cf->cf_miss_page)
 	cf->cf_pending = 2;
-      } else {
-	cf->cf_pending = 0;
+      hts_cond_broadcast(&cf->cf_cond_resp);
+
+      if(!miss) {
+	// Read-ahead failed, wait for reader to move before retrying
+	hts_cond_wait(&cf->cf_cond_req, &cf->cf_mutex);
       }
-      hts_cond_signal(&cf->cf_cond_resp);
       continue;
     }
 
-    cache_pages(cf, buf);
-
-    if(cf->cf_pending)
-      continue;
-
-    if(cf->cf_thread_running == 0)
-      break;
-
-    hts_cond_wait(&cf->cf_cond_req, &cf->cf_mutex);
+    fac_update_window(cf);
+    hts_cond_broadcast(&cf->cf_cond_resp);
   }
   hts_mutex_unlock(&cf->cf_mutex);
   free(buf);
+  fa_close(src);
   cf_release(cf);
   return NULL; 
 }
@@ -370,17 +828,11 @@ fac_load(cached_file_t *cf, void *buf, int64_t offset, int size)
     return 0;
 
   int count = MIN(size, PAGE_SIZE - poffset);
-  int64_t voff = (dpage << PAGE_SHIFT) + poffset;
+  int64_t voff = ((int64_t)dpage << PAGE_SHIFT) + poffset;
 
   hts_mutex_unlock(&cf->cf_mutex);
 
-  int r;
-
-  if(lseek(cf->cf_fd[1], voff, SEEK_SET) != voff) {
-    r = 1;
-  } else {
-    r = read(cf->cf_fd[1], buf, count) != count;
-  }
+  int r = pread(cf->cf_fd[1], buf, count, voff) != count;
 
   hts_mutex_lock(&cf->cf_mutex);
   
@@ -388,6 +840,34 @@ fac_load(cached_file_t *cf, void *buf, int64_t offset, int size)
 }
 
 
+/**
+ * Track how fast the reader consumes data
+ *
+ * Must be called with cf_mutex locked
+ */
+static void
+fac_consumed(cached_file_t *cf, int bytes)
+{
+  int64_t now = showtime_get_ts();
+
+  cf->cf_consumed += bytes;
+
+  if(cf->cf_consume_ts == 0) {
+    cf->cf_consume_ts = now;
+    return;
+  }
+
+  int64_t delta = now - cf->cf_consume_ts;
+  if(delta < 250000)
+    return;
+
+  cf->cf_consume_rate = ewma(cf->cf_consume_rate,
+			     cf->cf_consumed * 1000000 / delta);
+  cf->cf_consumed = 0;
+  cf->cf_consume_ts = now;
+}
+
+
 /**
  *
  */
@@ -407,6 +887,8 @@ fac_read(fa_handle_t *handle, void *buf, size_t size)
 
   hts_mutex_lock(&cf->cf_mutex);
 
+  int page = -1;
+
   while(size > 0) {
     int r = fac_load(cf, buf, off, size);
 
@@ -416,6 +898,10 @@ fac_read(fa_handle_t *handle, void *buf, size_t size)
     }
 
     if(r > 0) {
+      if(page != off >> PAGE_SHIFT) {
+	page = off >> PAGE_SHIFT;
+	cf->cf_hits++;
+      }
       size -= r;
       buf += r;
       off += r;
@@ -423,18 +909,35 @@ fac_read(fa_handle_t *handle, void *buf, size_t size)
       continue;
     }
 
+    /*
+     * Miss. If the page is not already on its way we ask a worker
+     * to fetch it before anything else. Either way the window was
+     * too small, so grow it
+     */
+    page = off >> PAGE_SHIFT;
+    cf->cf_misses++;
+    cf->cf_window = MIN(cf->cf_window * 2, cf->cf_num_pages - 10);
+
+    cf->cf_miss_page = page;
     cf->cf_pending = 1;
-    hts_cond_signal(&cf->cf_cond_req);
-    while(cf->cf_pending == 1)
+    hts_cond_broadcast(&cf->cf_cond_req);
+    while(cf->cf_pending == 1 &&
+	  cf->cf_pages[page & cf->cf_page_mask].cp_file_offset != page)
       hts_cond_wait(&cf->cf_cond_resp, &cf->cf_mutex);
-  
+
     if(cf->cf_pending == 2) {
+      cf->cf_pending = 0;
       hts_mutex_unlock(&cf->cf_mutex);
       return -1;
     }
+    cf->cf_pending = 0;
   }
 
-  hts_cond_signal(&cf->cf_cond_req);
+  fac_consumed(cf, total);
+  prop_set_int(cf->cf_stats_hits, cf->cf_hits);
+  prop_set_int(cf->cf_stats_misses, cf->cf_misses);
+
+  hts_cond_broadcast(&cf->cf_cond_req);
   hts_mutex_unlock(&cf->cf_mutex);
   return total;
 }
@@ -459,8 +962,7 @@ fa_handle_t *
 fa_cache_open(const char *url, char *errbuf, size_t errsize, int flags,
 	      struct prop *stats)
 {
-  fa_handle_t *fh = fa_open_ex(url, errbuf, errsize, flags | FA_HUGE_BUFFER,
-			       stats);
+  fa_handle_t *fh = fa_open_ex(url, errbuf, errsize, flags, stats);
   if(fh == NULL)
     return NULL;
 
@@ -470,8 +972,43 @@ fa_cache_open(const char *url, char *errbuf, size_t errsize, int flags,
   TRACE(TRACE_INFO, "RA", "Enabling read-ahead cache for %s", url);
 
   cached_file_t *cf = calloc(1, sizeof(cached_file_t));
-  if(get_anon_file(cf->cf_fd)) {
+  struct fa_stat fs;
+  char errbuf2[256];
+
+  cf->cf_size = fa_fsize(fh);
+  if(!fa_stat(url, &fs, errbuf2, sizeof(errbuf2)))
+    cf->cf_mtime = fs.fs_mtime;
+
+  cf_setup_segment_vector(cf);
+
+  /*
+   * Pages are kept on disk across sessions, keyed by URL and validated
+   * against size and mtime. If someone else has the same URL open
+   * right now we fall back to a private anonymous page file
+   */
+  cf->cf_key = digest_key(url);
+
+  hts_mutex_lock(&cache_mutex);
+  cached_file_t *o;
+  TAILQ_FOREACH(o, &cached_files, cf_link)
+    if(o->cf_key == cf->cf_key)
+      break;
+  if(o == NULL && (int64_t)cf->cf_size > 0) {
+    cf->cf_persistent = 1;
+    TAILQ_INSERT_TAIL(&cached_files, cf, cf_link);
+  }
+  hts_mutex_unlock(&cache_mutex);
+
+  if(cf->cf_persistent && cf_open_persistent(cf, url)) {
+    hts_mutex_lock(&cache_mutex);
+    TAILQ_REMOVE(&cached_files, cf, cf_link);
+    hts_mutex_unlock(&cache_mutex);
+    cf->cf_persistent = 0;
+  }
+
+  if(!cf->cf_persistent && get_anon_file(cf->cf_fd)) {
     TRACE(TRACE_ERROR, "RA", "Unable to create page file for %s", url);
+    free(cf->cf_pages);
     free(cf);
     return fh;
   }
@@ -480,8 +1017,6 @@ fa_cache_open(const char *url, char *errbuf, size_t errsize, int flags,
   hts_cond_init(&cf->cf_cond_req, &cf->cf_mutex);
   hts_cond_init(&cf->cf_cond_resp, &cf->cf_mutex);
 
-  cf_setup_segment_vector(cf);
-
   // File we cache 
 
   if(stats != NULL) {
@@ -490,15 +1025,22 @@ fa_cache_open(const char *url, char *errbuf, size_t errsize, int flags,
     prop_set_int(prop_create(stats, "cacheSizeValid"), 1);
     prop_set_int(prop_create(stats, "cacheSizeMax"),
 		 cf->cf_num_pages * PAGE_SIZE);
+    cf->cf_stats_hits = prop_ref_inc(prop_create(stats, "cacheHits"));
+    cf->cf_stats_misses = prop_ref_inc(prop_create(stats, "cacheMisses"));
+    cf->cf_stats_latency = prop_ref_inc(prop_create(stats, "cacheLatency"));
   }
 
   cf->cf_src = fh;
-  cf->cf_size = fa_fsize(fh);
-  // Boot thread
+  cf->cf_url = strdup(url);
+  cf->cf_flags = flags;
 
-  cf->cf_ref_count = 2;
+  // Boot threads, first one to start grabs the handle we just opened
+
+  int i;
+  cf->cf_ref_count = 1 + FAC_WORKERS;
   cf->cf_thread_running = 1;
-  hts_thread_create_detached("facache", fac_thread, cf, THREAD_PRIO_NORMAL);
+  for(i = 0; i < FAC_WORKERS; i++)
+    hts_thread_create_detached("facache", fac_thread, cf, THREAD_PRIO_NORMAL);
 
   cf->h.fh_proto = &fa_protocol_cache;
   return &cf->h;
@@ -518,7 +1060,15 @@ fa_cache_init(void)
   snprintf(path, sizeof(path), "%s/facache/tmp", showtime_cache_path);
 
   cachefile = strdup(path);
-  
+
+  snprintf(path, sizeof(path), "%s/facache/pages", showtime_cache_path);
+  mkdir(path, 0777);
+  cachedir = strdup(path);
+
   hts_mutex_init(&cache_mutex);
   TAILQ_INIT(&cached_files);
+
+  hts_mutex_lock(&cache_mutex);
+  fac_prune();
+  hts_mutex_unlock(&cache_mutex);
 }
@@ -32,6 +32,9 @@
 #include "htsmsg/htsmsg_xml.h"
 #include "misc/string.h"
 #include "misc/sha.h"
+#include "misc/callout.h"
+#include "settings.h"
+#include "htsmsg/htsmsg_store.h"
 
 #if ENABLE_SPIDERMONKEY
 #include "js/js.h"
@@ -59,6 +62,14 @@ static uint8_t nonce[20];
  */
 #define STREAMING_LIMIT 128000
 
+/**
+ * Socket receive buffer limits for media streaming (see
+ * http_stream_tune())
+ */
+#define HTTP_RCVBUF_MIN (192 * 1024)
+#define HTTP_RCVBUF_MAX (4 * 1024 * 1024)
+#define HTTP_RCVBUF_WINDOW_MS 250
+
 
 
 static int http_tokenize(char *buf, char **vec, int vecsize, int delimiter);
@@ -126,14 +137,47 @@ http_server_quirk_set_get(const char *hostname, int quirk)
 
 
 /**
- * Connection parking
+ * Connection pool
+ *
+ * Connections are grouped per host (hostname, port, ssl) in a small
+ * hash table. Idle connections are parked on their host and on a
+ * global LRU list which is used to enforce the total limit and the
+ * idle timeout.
+ *
+ * Small GET requests (from http_request()) may be pipelined onto a
+ * connection already busy with other small GETs once the host has
+ * run out of its connection budget. Requests are written under
+ * hc_send_mutex and get a ticket (hc_send_seq). A request may only
+ * read its response when hc_recv_seq has reached its ticket
  */
-TAILQ_HEAD(http_connection_queue , http_connection);
+#define HTTP_HOST_HASH_SIZE 64
+#define HTTP_PIPELINE_DEPTH 4
+
+TAILQ_HEAD(http_connection_queue, http_connection);
+LIST_HEAD(http_host_list, http_host);
 
-static struct http_connection_queue http_connections;
+static struct http_host_list http_hosts[HTTP_HOST_HASH_SIZE];
+static struct http_connection_queue http_parked;
 static int http_parked_connections;
 static hts_mutex_t http_connections_mutex;
 static int http_connection_tally;
+static callout_t http_reaper;
+
+static int http_pool_max_per_host = 6;
+static int http_pool_max_total = 32;
+static int http_pool_idle_timeout = 30;
+
+typedef struct http_host {
+  LIST_ENTRY(http_host) hh_link;
+  struct http_connection_queue hh_parked;
+  struct http_connection_queue hh_active;
+  int hh_num_parked;
+  int hh_num_active; // Including connections being established
+  int hh_port;
+  char hh_ssl;
+  char hh_pipeline; // 1 = Server talks persistent HTTP/1.1, -1 = Don't
+  char hh_hostname[HOSTNAME_MAX];
+} http_host_t;
 
 typedef struct http_connection {
   char hc_hostname[HOSTNAME_MAX];
@@ -141,93 +185,348 @@ typedef struct http_connection {
   int hc_id;
   tcpcon_t *hc_tc;
 
-  TAILQ_ENTRY(http_connection) hc_link;
+  http_host_t *hc_host;
+  TAILQ_ENTRY(http_connection) hc_link;        // hh_parked or hh_active
+  TAILQ_ENTRY(http_connection) hc_parked_link; // http_parked
+  int64_t hc_parked_time;
+
+  hts_mutex_t hc_send_mutex;
+  hts_cond_t hc_cond;
+  int hc_users;
+  int hc_send_seq;
+  int hc_recv_seq;
 
   char hc_ssl;
   char hc_reused;
+  char hc_pipelinable;
+  char hc_broken;
+  char hc_http11;
 
 } http_connection_t;
 
 
+/**
+ * Must be called with http_connections_mutex locked
+ */
+static http_host_t *
+http_host_get(const char *hostname, int port, int ssl)
+{
+  unsigned int h = (mystrhash(hostname) ^ port ^ ssl) % HTTP_HOST_HASH_SIZE;
+  http_host_t *hh;
+
+  LIST_FOREACH(hh, &http_hosts[h], hh_link)
+    if(hh->hh_port == port && hh->hh_ssl == ssl &&
+       !strcmp(hh->hh_hostname, hostname))
+      return hh;
+
+  hh = calloc(1, sizeof(http_host_t));
+  snprintf(hh->hh_hostname, sizeof(hh->hh_hostname), "%s", hostname);
+  hh->hh_port = port;
+  hh->hh_ssl = ssl;
+  TAILQ_INIT(&hh->hh_parked);
+  TAILQ_INIT(&hh->hh_active);
+  LIST_INSERT_HEAD(&http_hosts[h], hh, hh_link);
+  return hh;
+}
+
+
+/**
+ * Must be called with http_connections_mutex locked
+ */
+static void
+http_host_maybe_free(http_host_t *hh)
+{
+  if(hh->hh_num_parked || hh->hh_num_active)
+    return;
+  LIST_REMOVE(hh, hh_link);
+  free(hh);
+}
+
+
+/**
+ * Must be called with http_connections_mutex locked
+ */
+static void
+http_connection_unpark(http_connection_t *hc)
+{
+  http_host_t *hh = hc->hc_host;
+
+  TAILQ_REMOVE(&hh->hh_parked, hc, hc_link);
+  TAILQ_REMOVE(&http_parked, hc, hc_parked_link);
+  hh->hh_num_parked--;
+  http_parked_connections--;
+}
+
+
+/**
+ *
+ */
+static void
+http_connection_destroy(http_connection_t *hc, int dbg)
+{
+  HTTP_TRACE(dbg, "Disconnected from %s:%d (id=%d)",
+	     hc->hc_hostname, hc->hc_port, hc->hc_id);
+  tcp_close(hc->hc_tc);
+  hts_mutex_destroy(&hc->hc_send_mutex);
+  hts_cond_destroy(&hc->hc_cond);
+  free(hc);
+}
+
+
+/**
+ *
+ */
+static void
+http_connections_destroy(struct http_connection_queue *q, int dbg)
+{
+  http_connection_t *hc;
+
+  while((hc = TAILQ_FIRST(q)) != NULL) {
+    TAILQ_REMOVE(q, hc, hc_link);
+    http_connection_destroy(hc, dbg);
+  }
+}
+
+
+/**
+ * Find a busy connection we can pipeline a request on
+ *
+ * Must be called with http_connections_mutex locked
+ */
+static http_connection_t *
+http_connection_find_pipeline(http_host_t *hh)
+{
+  http_connection_t *hc, *best = NULL;
+
+  if(hh->hh_ssl || hh->hh_pipeline != 1 ||
+     hh->hh_num_active < http_pool_max_per_host)
+    return NULL;
+
+  TAILQ_FOREACH(hc, &hh->hh_active, hc_link) {
+    if(!hc->hc_pipelinable || hc->hc_broken ||
+       hc->hc_users >= HTTP_PIPELINE_DEPTH)
+      continue;
+    if(best == NULL || hc->hc_users < best->hc_users)
+      best = hc;
+  }
+  return best;
+}
+
+
 /**
  *
  */
 static http_connection_t *
 http_connection_get(const char *hostname, int port, int ssl,
-		    char *errbuf, int errlen, int dbg)
+		    char *errbuf, int errlen, int dbg, int pipeline)
 {
   http_connection_t *hc;
+  http_host_t *hh;
   tcpcon_t *tc;
   int id;
 
   hts_mutex_lock(&http_connections_mutex);
 
-  TAILQ_FOREACH(hc, &http_connections, hc_link) {
-    if(!strcmp(hc->hc_hostname, hostname) && hc->hc_port == port &&
-       hc->hc_ssl == ssl) {
-      TAILQ_REMOVE(&http_connections, hc, hc_link);
-      http_parked_connections--;
-      hts_mutex_unlock(&http_connections_mutex);
-      HTTP_TRACE(dbg, "Reusing connection to %s:%d (id=%d)",
-		 hc->hc_hostname, hc->hc_port, hc->hc_id);
-      hc->hc_reused = 1;
-      return hc;
-    }
+  hh = http_host_get(hostname, port, ssl);
+
+  if((hc = TAILQ_LAST(&hh->hh_parked, http_connection_queue)) != NULL) {
+    http_connection_unpark(hc);
+    TAILQ_INSERT_TAIL(&hh->hh_active, hc, hc_link);
+    hh->hh_num_active++;
+    hc->hc_users = 1;
+    hc->hc_send_seq = 0;
+    hc->hc_recv_seq = 0;
+    hc->hc_pipelinable = pipeline;
+    hts_mutex_unlock(&http_connections_mutex);
+    HTTP_TRACE(dbg, "Reusing connection to %s:%d (id=%d)",
+	       hc->hc_hostname, hc->hc_port, hc->hc_id);
+    hc->hc_reused = 1;
+    return hc;
+  }
+
+  if(pipeline && (hc = http_connection_find_pipeline(hh)) != NULL) {
+    hc->hc_users++;
+    hts_mutex_unlock(&http_connections_mutex);
+    HTTP_TRACE(dbg, "Pipelining request to %s:%d (id=%d, depth=%d)",
+	       hc->hc_hostname, hc->hc_port, hc->hc_id, hc->hc_users);
+    return hc;
   }
 
+  hh->hh_num_active++;
   id = ++http_connection_tally;
   hts_mutex_unlock(&http_connections_mutex);
 
   if((tc = tcp_connect(hostname, port, errbuf, errlen, 5000, ssl)) == NULL) {
     HTTP_TRACE(dbg, "Connection to %s:%d failed", hostname, port);
+    hts_mutex_lock(&http_connections_mutex);
+    hh->hh_num_active--;
+    http_host_maybe_free(hh);
+    hts_mutex_unlock(&http_connections_mutex);
     return NULL;
   }
   HTTP_TRACE(dbg, "Connected to %s:%d (id=%d)", hostname, port, id);
 
-  hc = malloc(sizeof(http_connection_t));
+  hc = calloc(1, sizeof(http_connection_t));
   snprintf(hc->hc_hostname, sizeof(hc->hc_hostname), "%s", hostname);
   hc->hc_port = port;
   hc->hc_ssl = ssl;
   hc->hc_tc = tc;
-  hc->hc_reused = 0;
   hc->hc_id = id;
+  hc->hc_host = hh;
+  hc->hc_users = 1;
+  hc->hc_pipelinable = pipeline;
+  hts_mutex_init(&hc->hc_send_mutex);
+  hts_cond_init(&hc->hc_cond, &http_connections_mutex);
+
+  hts_mutex_lock(&http_connections_mutex);
+  TAILQ_INSERT_TAIL(&hh->hh_active, hc, hc_link);
+  hts_mutex_unlock(&http_connections_mutex);
   return hc;
 }
 
 
 /**
- *
+ * Write a request and return its pipeline ticket
+ */
+static int
+http_connection_send(http_connection_t *hc, htsbuf_queue_t *q)
+{
+  hts_mutex_lock(&hc->hc_send_mutex);
+  int seq = hc->hc_send_seq++;
+  tcp_write_queue(hc->hc_tc, q);
+  hts_mutex_unlock(&hc->hc_send_mutex);
+  return seq;
+}
+
+
+/**
+ * Wait until the response for ticket 'seq' is next on the connection.
+ * Returns -1 if the connection broke before that
+ */
+static int
+http_connection_wait(http_connection_t *hc, int seq)
+{
+  int r;
+
+  hts_mutex_lock(&http_connections_mutex);
+  while(hc->hc_recv_seq != seq && !hc->hc_broken)
+    hts_cond_wait(&hc->hc_cond, &http_connections_mutex);
+  r = hc->hc_broken ? -1 : 0;
+  hts_mutex_unlock(&http_connections_mutex);
+  return r;
+}
+
+
+/**
+ * A pipelined request failed, don't try that with this host again
  */
 static void
-http_connection_destroy(http_connection_t *hc, int dbg)
+http_connection_pipeline_failed(http_connection_t *hc, int dbg)
 {
-  HTTP_TRACE(dbg, "Disconnected from %s:%d (id=%d)",
-	     hc->hc_hostname, hc->hc_port, hc->hc_id);
-  tcp_close(hc->hc_tc);
-  free(hc);
+  HTTP_TRACE(dbg, "Pipelining to %s:%d failed, disabled for host",
+	     hc->hc_hostname, hc->hc_port);
+  hts_mutex_lock(&http_connections_mutex);
+  hc->hc_host->hh_pipeline = -1;
+  hts_mutex_unlock(&http_connections_mutex);
 }
 
 
 /**
- *
+ * Close parked connections that have been idle for too long
  */
 static void
-http_connection_park(http_connection_t *hc, int dbg)
+http_connection_reaper(callout_t *c, void *aux)
 {
-  HTTP_TRACE(dbg, "Parking connection to %s:%d (id=%d)",
-	     hc->hc_hostname, hc->hc_port, hc->hc_id);
+  struct http_connection_queue q;
+  http_connection_t *hc;
+  int64_t deadline = showtime_get_ts() - http_pool_idle_timeout * 1000000LL;
+
+  TAILQ_INIT(&q);
+
   hts_mutex_lock(&http_connections_mutex);
-  TAILQ_INSERT_TAIL(&http_connections, hc, hc_link);
 
-  if(http_parked_connections == 5) {
-    hc = TAILQ_FIRST(&http_connections);
-    TAILQ_REMOVE(&http_connections, hc, hc_link);
+  while((hc = TAILQ_FIRST(&http_parked)) != NULL &&
+	hc->hc_parked_time < deadline) {
+    http_connection_unpark(hc);
+    http_host_maybe_free(hc->hc_host);
+    TAILQ_INSERT_TAIL(&q, hc, hc_link);
+  }
+
+  if(http_parked_connections)
+    callout_arm(&http_reaper, http_connection_reaper, NULL, 5);
+
+  hts_mutex_unlock(&http_connections_mutex);
+
+  http_connections_destroy(&q, 0);
+}
+
+
+/**
+ * Drop a request's claim on a connection. The last user parks it
+ * (if reusable) or closes it
+ */
+static void
+http_connection_release(http_connection_t *hc, int reusable, int dbg)
+{
+  struct http_connection_queue q;
+  http_host_t *hh = hc->hc_host;
+
+  hts_mutex_lock(&http_connections_mutex);
+
+  hc->hc_recv_seq++;
+  if(!reusable)
+    hc->hc_broken = 1;
+  hts_cond_broadcast(&hc->hc_cond);
+
+  if(--hc->hc_users > 0) {
+    hts_mutex_unlock(&http_connections_mutex);
+    return;
+  }
+
+  TAILQ_REMOVE(&hh->hh_active, hc, hc_link);
+  hh->hh_num_active--;
+
+  if(hc->hc_broken) {
+    http_host_maybe_free(hh);
+    hts_mutex_unlock(&http_connections_mutex);
     http_connection_destroy(hc, dbg);
-  } else {
-    http_parked_connections++;
+    return;
+  }
+
+  HTTP_TRACE(dbg, "Parking connection to %s:%d (id=%d)",
+	     hc->hc_hostname, hc->hc_port, hc->hc_id);
+
+  if(hc->hc_http11 && hh->hh_pipeline == 0)
+    hh->hh_pipeline = 1;
+
+  hc->hc_pipelinable = 0;
+  hc->hc_parked_time = showtime_get_ts();
+  TAILQ_INSERT_TAIL(&hh->hh_parked, hc, hc_link);
+  TAILQ_INSERT_TAIL(&http_parked, hc, hc_parked_link);
+  hh->hh_num_parked++;
+  http_parked_connections++;
+
+  TAILQ_INIT(&q);
+
+  while(hh->hh_num_parked > http_pool_max_per_host) {
+    hc = TAILQ_FIRST(&hh->hh_parked);
+    http_connection_unpark(hc);
+    TAILQ_INSERT_TAIL(&q, hc, hc_link);
+  }
+
+  while(http_parked_connections > http_pool_max_total) {
+    hc = TAILQ_FIRST(&http_parked);
+    http_connection_unpark(hc);
+    http_host_maybe_free(hc->hc_host);
+    TAILQ_INSERT_TAIL(&q, hc, hc_link);
   }
 
+  if(!callout_isarmed(&http_reaper))
+    callout_arm(&http_reaper, http_connection_reaper, NULL, 5);
+
   hts_mutex_unlock(&http_connections_mutex);
+
+  http_connections_destroy(&q, dbg);
 }
 
 
@@ -497,7 +796,16 @@ typedef struct http_file {
 		      * rather than random seeking 
 		      */
 
+  char hf_media_stream; /* Media playback, use one open ended response
+			 * and tune socket buffers for it
+			 */
+  int hf_rcvbuf;
+  int64_t hf_tune_ts;
+  int64_t hf_tune_bytes;
+
   char hf_req_compression;
+
+  char hf_pipeline; // Request may be pipelined on a busy connection
   
   char hf_content_encoding;
 #define HTTP_CE_IDENTITY 0
@@ -1058,6 +1366,7 @@ http_read_response(http_file_t *hf, struct http_header_list *headers)
       while(*q == ' ')
 	q++;
       code = atoi(q);
+      hc->hc_http11 = !strncmp(hf->hf_line, "HTTP/1.1", 8);
       continue;
     }
     
@@ -1171,11 +1480,7 @@ http_detach(http_file_t *hf, int reusable)
   if(hf->hf_connection == NULL)
     return;
 
-  if(reusable) {
-    http_connection_park(hf->hf_connection, hf->hf_debug);
-  } else {
-    http_connection_destroy(hf->hf_connection, hf->hf_debug);
-  }
+  http_connection_release(hf->hf_connection, reusable, hf->hf_debug);
   hf->hf_connection = NULL;
 }
 
@@ -1336,7 +1641,7 @@ http_connect(http_file_t *hf, char *errbuf, int errlen)
     strcpy(hf->hf_path, "/");
 
   hf->hf_connection = http_connection_get(hostname, port, ssl, errbuf, errlen,
-					  hf->hf_debug);
+					  hf->hf_debug, hf->hf_pipeline == 1);
 
   return hf->hf_connection ? 0 : -1;
 }
@@ -1687,6 +1992,7 @@ http_open_ex(fa_protocol_t *fap, const char *url, char *errbuf, size_t errlen,
   hf->hf_url = strdup(url);
   hf->hf_debug = !!(flags & FA_DEBUG);
   hf->hf_streaming = !!(flags & FA_STREAMING);
+  hf->hf_media_stream = !!(flags & FA_MEDIA_STREAM);
 
   if(stats != NULL) {
     hf->hf_stats_speed = prop_ref_inc(prop_create(stats, "bitrate"));
@@ -1732,6 +2038,65 @@ http_seek_is_fast(fa_handle_t *handle)
 }
 
 
+/**
+ * About to issue an open ended request. Size the socket receive buffer
+ * for streaming, media streams reuse whatever size was learned earlier
+ */
+static void
+http_stream_start(http_file_t *hf)
+{
+  tcpcon_t *tc = hf->hf_connection->hc_tc;
+
+  if(!hf->hf_media_stream) {
+    tcp_huge_buffer(tc);
+    return;
+  }
+
+  if(hf->hf_rcvbuf == 0)
+    hf->hf_rcvbuf = HTTP_RCVBUF_MIN;
+  tcp_set_read_buffer(tc, hf->hf_rcvbuf);
+  hf->hf_tune_ts = 0;
+  hf->hf_tune_bytes = 0;
+}
+
+
+/**
+ * Measure the rate we are pulling data off the socket and grow the
+ * receive buffer to hold HTTP_RCVBUF_WINDOW_MS worth of it, so the
+ * TCP window stays open while the demuxer is busy elsewhere
+ */
+static void
+http_stream_tune(http_file_t *hf, int bytes)
+{
+  int64_t now = showtime_get_ts();
+
+  hf->hf_tune_bytes += bytes;
+
+  if(hf->hf_tune_ts == 0) {
+    hf->hf_tune_ts = now;
+    return;
+  }
+
+  int64_t delta = now - hf->hf_tune_ts;
+  if(delta < 1000000)
+    return;
+
+  int64_t rate = hf->hf_tune_bytes * 1000000 / delta;
+  int want = MIN(rate * HTTP_RCVBUF_WINDOW_MS / 1000, HTTP_RCVBUF_MAX);
+
+  hf->hf_tune_ts = now;
+  hf->hf_tune_bytes = 0;
+
+  if(want < hf->hf_rcvbuf + hf->hf_rcvbuf / 2)
+    return;
+
+  HF_TRACE(hf, "%s: %"PRId64" kB/s, receive buffer %d -> %d bytes",
+	   hf->hf_url, rate / 1000, hf->hf_rcvbuf, want);
+  hf->hf_rcvbuf = want;
+  tcp_set_read_buffer(hf->hf_connection->hc_tc, want);
+}
+
+
 /**
  * Read from file
  */
@@ -1788,12 +2153,13 @@ http_read_i(http_file_t *hf, void *buf, const size_t size)
       if(hf->hf_filesize == -1) {
 	range[0] = 0;
 
-      } else if(hf->hf_streaming || hf->hf_consecutive_read > STREAMING_LIMIT) {
-	if(!hf->hf_streaming)
+      } else if(hf->hf_streaming || hf->hf_media_stream ||
+		hf->hf_consecutive_read > STREAMING_LIMIT) {
+	if(!hf->hf_streaming && !hf->hf_media_stream)
 	  TRACE(TRACE_DEBUG, "HTTP", "%s: switching to streaming mode",
 		hf->hf_url);
 	snprintf(range, sizeof(range), "bytes=%"PRId64"-", hf->hf_pos);
-	tcp_huge_buffer(hf->hf_connection->hc_tc);
+	http_stream_start(hf);
 
       } else {
 
@@ -1876,6 +2242,9 @@ http_read_i(http_file_t *hf, void *buf, const size_t size)
       totsize      += read_size;
 
       hf->hf_consecutive_read += read_size;
+
+      if(hf->hf_media_stream)
+	http_stream_tune(hf, read_size);
     } else {
       hf->hf_rsize = 0;
     }
@@ -1985,7 +2354,12 @@ http_seek(fa_handle_t *handle, int64_t pos, int whence)
       int64_t d = np - hf->hf_pos;
       // We allow seek by reading if delta offset is small enough
 
-      if(d > 0 && (d < SEEK_BY_READ_THRES || hf->hf_no_ranges) &&
+      // When streaming media, whatever sits in the socket buffer is
+      // cheaper to read past than a new request
+      int thres = MAX(SEEK_BY_READ_THRES,
+		      hf->hf_media_stream ? hf->hf_rcvbuf : 0);
+
+      if(d > 0 && (d < thres || hf->hf_no_ranges) &&
 	 d < hf->hf_rsize) {
 
 	if(!hf_drain_bytes(hf, d)) {
@@ -2171,19 +2545,51 @@ http_get_last_component(struct fa_protocol *fap, const char *url,
 static void
 http_init(void)
 {
+  static int initialized;
   uint64_t v = arch_get_seed();
 
+  // Shared by http and https
+  if(initialized)
+    return;
+  initialized = 1;
+
   sha1_decl(ctx);
   sha1_init(ctx);
   sha1_update(ctx, (void *)&v, sizeof(v));
   sha1_final(ctx, nonce);
 
-  TAILQ_INIT(&http_connections);
+  int i;
+  for(i = 0; i < HTTP_HOST_HASH_SIZE; i++)
+    LIST_INIT(&http_hosts[i]);
+  TAILQ_INIT(&http_parked);
   hts_mutex_init(&http_connections_mutex);
   hts_mutex_init(&http_redirects_mutex);
   hts_mutex_init(&http_cookies_mutex);
   hts_mutex_init(&http_server_quirk_mutex);
   hts_mutex_init(&http_auth_caches_mutex);
+
+  htsmsg_t *store = htsmsg_store_load("httpclient") ?: htsmsg_create_map();
+
+  settings_create_int(settings_general, "connsperhost",
+		      _p("HTTP connections per server"),
+		      http_pool_max_per_host, store, 1, 32, 1,
+		      settings_generic_set_int, &http_pool_max_per_host,
+		      SETTINGS_INITIAL_UPDATE, NULL, NULL,
+		      settings_generic_save_settings, (void *)"httpclient");
+
+  settings_create_int(settings_general, "idleconns",
+		      _p("Idle HTTP connections"),
+		      http_pool_max_total, store, 0, 128, 4,
+		      settings_generic_set_int, &http_pool_max_total,
+		      SETTINGS_INITIAL_UPDATE, NULL, NULL,
+		      settings_generic_save_settings, (void *)"httpclient");
+
+  settings_create_int(settings_general, "idletimeout",
+		      _p("HTTP idle connection timeout"),
+		      http_pool_idle_timeout, store, 5, 300, 5,
+		      settings_generic_set_int, &http_pool_idle_timeout,
+		      SETTINGS_INITIAL_UPDATE, " s", NULL,
+		      settings_generic_save_settings, (void *)"httpclient");
 }
 
 /**
@@ -2592,7 +2998,7 @@ http_request(const char *url, const char **arguments,
 {
   http_file_t *hf = calloc(1, sizeof(http_file_t));
   htsbuf_queue_t q;
-  int code, r;
+  int code, r, seq;
   int redircount = 0;
   struct http_header_list headers;
 
@@ -2605,6 +3011,10 @@ http_request(const char *url, const char **arguments,
 
  retry:
 
+  if(hf->hf_pipeline != -1)
+    hf->hf_pipeline = postdata == NULL && result != NULL &&
+      (method == NULL || !strcmp(method, "GET"));
+
   http_connect(hf, errbuf, errlen);
 
   if(hf->hf_connection == NULL) {
@@ -2659,7 +3069,7 @@ http_request(const char *url, const char **arguments,
   if(hf->hf_debug)
     htsbuf_dump_raw_stderr(&q);
 
-  tcp_write_queue(hf->hf_connection->hc_tc, &q);
+  seq = http_connection_send(hc, &q);
 
   if(postdata != NULL) {
     if(hf->hf_debug)
@@ -2668,8 +3078,18 @@ http_request(const char *url, const char **arguments,
     tcp_write_queue_dontfree(hf->hf_connection->hc_tc, postdata);
   }
 
-  code = http_read_response(hf, headers_out);
-  if(code == -1 && hf->hf_connection->hc_reused) {
+  if(http_connection_wait(hc, seq))
+    code = -1;
+  else
+    code = http_read_response(hf, headers_out);
+
+  if(code == -1 && (hc->hc_reused || seq > 0)) {
+    if(seq > 0) {
+      // Retry without pipelining
+      if(!hc->hc_broken)
+	http_connection_pipeline_failed(hc, hf->hf_debug);
+      hf->hf_pipeline = -1;
+    }
     http_detach(hf, 0);
     goto retry;
   }
@@ -96,20 +96,34 @@ jpeginfo_mem_reader(void *handle, void *buf, off_t offset, size_t size)
 /**
  * Load entire image into memory using fileaccess load method.
  * Faster than open+read+close.
+ *
+ * When the caller only wants cached data we try to wrap the cached
+ * blob directly (usually mmap()ed) instead of copying it around
  */
 static pixmap_t *
 fa_imageloader2(const char *url, const char **vpaths,
 		char *errbuf, size_t errlen, int *cache_control)
 {
-  uint8_t *p;
+  const uint8_t *p;
   size_t size;
   meminfo_t mi;
   pixmap_type_t fmt;
   int width = -1, height = -1, orientation = 0;
+  blob_t *b = NULL;
+  pixmap_t *pm = NULL;
+
+  if(ONLY_CACHED(cache_control))
+    b = blobcache_get_blob(url, "fa_load", PIXMAP_CODED_PAD,
+			   cache_control, NULL);
 
-  p = fa_load(url, &size, vpaths, errbuf, errlen, cache_control);
-  if(p == NULL || p == NOT_MODIFIED)
-    return (pixmap_t *)p;
+  if(b != NULL) {
+    p = b->b_data;
+    size = b->b_size;
+  } else {
+    p = fa_load(url, &size, vpaths, errbuf, errlen, cache_control);
+    if(p == NULL || p == NOT_MODIFIED)
+      return (pixmap_t *)p;
+  }
 
   mi.data = p;
   mi.size = size;
@@ -126,10 +140,8 @@ fa_imageloader2(const char *url, const char **vpaths,
     
     if(jpeg_info(&ji, jpeginfo_mem_reader, &mi, 
 		 JPEG_INFO_DIMENSIONS | JPEG_INFO_ORIENTATION,
-		 p, size, errbuf, errlen)) {
-      free(p);
-      return NULL;
-    }
+		 p, size, errbuf, errlen))
+      goto out;
 
     fmt = PIXMAP_JPEG;
 
@@ -150,11 +162,15 @@ fa_imageloader2(const char *url, const char **vpaths,
   } else {
   bad:
     snprintf(errbuf, errlen, "Unknown format");
-    free(p);
-    return NULL;
+    goto out;
   }
 
-  pixmap_t *pm = pixmap_alloc_coded(p, size, fmt);
+  // The SVG parser modifies its input so it always needs a copy
+  if(b != NULL && fmt != PIXMAP_SVG)
+    pm = pixmap_alloc_coded_blob(b, fmt);
+  else
+    pm = pixmap_alloc_coded(p, size, fmt);
+
   if(pm != NULL) {
     pm->pm_width = width;
     pm->pm_height = height;
@@ -162,7 +178,11 @@ fa_imageloader2(const char *url, const char **vpaths,
   } else {
     snprintf(errbuf, errlen, "Out of memory");
   }
-  free(p);
+ out:
+  if(b != NULL)
+    blob_release(b);
+  else
+    free((void *)p);
   return pm;
 }
 
@@ -30,9 +30,14 @@
 #include "fa_probe.h"
 #include "playqueue.h"
 #include "misc/strtab.h"
+#include "misc/string.h"
 #include "prop/prop_nodefilter.h"
 
 extern int media_buffer_hungry;
+extern int media_buffer_hungry_wait(int timeout);
+
+#define SCANNER_PROBE_WORKERS  4 // Max concurrent deep probes per scanner
+#define SCANNER_PROBE_PER_HOST 2 // Max concurrent deep probes per remote host
 
 typedef struct scanner {
   int s_refcount;
@@ -222,7 +227,7 @@ type_from_filename(const char *filename)
  *
  */
 static void
-deep_probe(fa_dir_entry_t *fde, scanner_t *s)
+deep_probe(fa_dir_entry_t *fde, scanner_t *s, void *db, metadb_batch_t *mb)
 {
   fde->fde_probestatus = FDE_PROBE_DEEP;
 
@@ -234,7 +239,7 @@ deep_probe(fa_dir_entry_t *fde, scanner_t *s)
     if(!fde->fde_ignore_cache && !fa_dir_entry_stat(fde)) {
       if(fde->fde_md != NULL)
 	metadata_destroy(fde->fde_md);
-      fde->fde_md = metadb_metadata_get(getdb(s), fde->fde_url,
+      fde->fde_md = metadb_metadata_get(db, fde->fde_url,
 					fde->fde_stat.fs_mtime);
     }
 
@@ -252,16 +257,20 @@ deep_probe(fa_dir_entry_t *fde, scanner_t *s)
       metadata_to_proptree(fde->fde_md, meta, 1, NULL);
       
       if(fde->fde_md->md_cached == 0) {
-	metadb_metadata_write(getdb(s), fde->fde_url,
-			      fde->fde_stat.fs_mtime,
-			      fde->fde_md, s->s_url, s->s_mtime);
+	if(mb != NULL)
+	  metadb_batch_write(mb, fde->fde_url, fde->fde_stat.fs_mtime,
+			     fde->fde_md, s->s_url, s->s_mtime);
+	else
+	  metadb_metadata_write(db, fde->fde_url,
+				fde->fde_stat.fs_mtime,
+				fde->fde_md, s->s_url, s->s_mtime);
       }
     }
     prop_ref_dec(meta);
 
     if(!fde->fde_bound_to_metadb) {
       fde->fde_bound_to_metadb = 1;
-      metadb_bind_url_to_prop(getdb(s), fde->fde_url, fde->fde_prop);
+      metadb_bind_url_to_prop(db, fde->fde_url, fde->fde_prop);
     }
   }
   set_type(fde->fde_prop, fde->fde_type);
@@ -290,14 +299,239 @@ tryplay(scanner_t *s)
 }
 
 
+/**
+ * Remote hosts we are currently probing, used to limit the number
+ * of concurrent probes per host across all scanners
+ */
+typedef struct probe_host {
+  LIST_ENTRY(probe_host) ph_link;
+  char *ph_name;
+  int ph_refcount;
+  int ph_active;
+} probe_host_t;
+
+static LIST_HEAD(, probe_host) probe_hosts;
+static hts_mutex_t probe_host_mutex;
+static hts_cond_t probe_host_cond;
+
+
+/**
+ * Returns NULL for URLs that are not subject to per-host limiting
+ */
+static probe_host_t *
+probe_host_get(const char *url)
+{
+  char proto[16], hostname[256];
+  probe_host_t *ph;
+
+  url_split(proto, sizeof(proto), NULL, 0, hostname, sizeof(hostname),
+	    NULL, NULL, 0, url);
+
+  if(!hostname[0] ||
+     (strcmp(proto, "http") && strcmp(proto, "https") && strcmp(proto, "smb")))
+    return NULL;
+
+  hts_mutex_lock(&probe_host_mutex);
+
+  LIST_FOREACH(ph, &probe_hosts, ph_link)
+    if(!strcmp(ph->ph_name, hostname))
+      break;
+
+  if(ph == NULL) {
+    ph = calloc(1, sizeof(probe_host_t));
+    ph->ph_name = strdup(hostname);
+    LIST_INSERT_HEAD(&probe_hosts, ph, ph_link);
+  }
+  ph->ph_refcount++;
+  hts_mutex_unlock(&probe_host_mutex);
+  return ph;
+}
+
+
+/**
+ *
+ */
+static void
+probe_host_put(probe_host_t *ph)
+{
+  if(ph == NULL)
+    return;
+
+  hts_mutex_lock(&probe_host_mutex);
+  ph->ph_refcount--;
+  if(ph->ph_refcount == 0) {
+    LIST_REMOVE(ph, ph_link);
+    free(ph->ph_name);
+    free(ph);
+  }
+  hts_mutex_unlock(&probe_host_mutex);
+}
+
+
+/**
+ * Wait for a free probe slot on the host. Returns -1 if the scanner
+ * was stopped while waiting
+ */
+static int
+probe_host_acquire(probe_host_t *ph, scanner_t *s)
+{
+  if(ph == NULL)
+    return 0;
+
+  hts_mutex_lock(&probe_host_mutex);
+  while(ph->ph_active >= SCANNER_PROBE_PER_HOST && !s->s_stop)
+    hts_cond_wait_timeout(&probe_host_cond, &probe_host_mutex, 1000);
+
+  if(s->s_stop) {
+    hts_mutex_unlock(&probe_host_mutex);
+    return -1;
+  }
+  ph->ph_active++;
+  hts_mutex_unlock(&probe_host_mutex);
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+probe_host_release(probe_host_t *ph)
+{
+  if(ph == NULL)
+    return;
+
+  hts_mutex_lock(&probe_host_mutex);
+  ph->ph_active--;
+  hts_cond_broadcast(&probe_host_cond);
+  hts_mutex_unlock(&probe_host_mutex);
+}
+
+
+/**
+ * A set of entries to be deep probed by one or more workers
+ */
+typedef struct probe_job {
+  scanner_t *pj_scanner;
+  probe_host_t *pj_host;
+  fa_dir_entry_t **pj_vec;
+  int pj_num;
+  int pj_next;
+} probe_job_t;
+
+
+/**
+ *
+ */
+static void
+probe_job_run(probe_job_t *pj, void *db)
+{
+  scanner_t *s = pj->pj_scanner;
+  metadb_batch_t *mb = metadb_batch_create(db);
+  int i;
+
+  while(!s->s_stop) {
+
+    i = atomic_add(&pj->pj_next, 1);
+    if(i >= pj->pj_num)
+      break;
+
+    /* Back off while playback is trying to fill its buffers. Don't sit
+       on pending metadata meanwhile */
+    if(media_buffer_hungry) {
+      metadb_batch_flush(mb);
+      while(media_buffer_hungry && !s->s_stop)
+	media_buffer_hungry_wait(1000);
+    }
+
+    if(probe_host_acquire(pj->pj_host, s))
+      break;
+
+    deep_probe(pj->pj_vec[i], s, db, mb);
+
+    probe_host_release(pj->pj_host);
+  }
+
+  /* Entries (and thus their metadata) stay alive until analyzer()
+     returns so it's safe to defer writing until here */
+  metadb_batch_destroy(mb);
+}
+
+
+/**
+ *
+ */
+static void *
+probe_worker(void *aux)
+{
+  probe_job_t *pj = aux;
+  void *db = metadb_get();
+
+  probe_job_run(pj, db);
+
+  if(db != NULL)
+    metadb_close(db);
+  return NULL;
+}
+
+
+/**
+ * Probe in the order the entries are presented (sorted on filename)
+ * so the top of the list is filled in first
+ */
+static int
+fde_filename_cmp(const void *A, const void *B)
+{
+  const fa_dir_entry_t *a = *(fa_dir_entry_t * const *)A;
+  const fa_dir_entry_t *b = *(fa_dir_entry_t * const *)B;
+  return dictcmp(a->fde_filename, b->fde_filename);
+}
+
+
+/**
+ * Deep probe all entries in 'v'. The calling thread takes part in
+ * the work and returns once all entries have been probed (or the
+ * scanner is stopped)
+ */
+static void
+probe_entries(scanner_t *s, fa_dir_entry_t **v, int num)
+{
+  hts_thread_t tids[SCANNER_PROBE_WORKERS - 1];
+  probe_job_t pj;
+  int i, workers;
+
+  qsort(v, num, sizeof(fa_dir_entry_t *), fde_filename_cmp);
+
+  pj.pj_scanner = s;
+  pj.pj_host = probe_host_get(s->s_url);
+  pj.pj_vec = v;
+  pj.pj_num = num;
+  pj.pj_next = 0;
+
+  workers = MIN(num, pj.pj_host != NULL ?
+		SCANNER_PROBE_PER_HOST : SCANNER_PROBE_WORKERS);
+
+  for(i = 0; i < workers - 1; i++)
+    hts_thread_create_joinable("fa probe", &tids[i], probe_worker, &pj,
+			       THREAD_PRIO_LOW);
+
+  probe_job_run(&pj, getdb(s));
+
+  for(i = 0; i < workers - 1; i++)
+    hts_thread_join(&tids[i]);
+
+  probe_host_put(pj.pj_host);
+}
+
+
 /**
  *
  */
 static void
 analyzer(scanner_t *s, int probe)
 {
-  fa_dir_entry_t *fde;
-  int images = 0;
+  fa_dir_entry_t *fde, **v;
+  int n = 0;
 
   /* Empty */
   if(s->s_fd->fd_count == 0)
@@ -306,15 +540,11 @@ analyzer(scanner_t *s, int probe)
   if(probe)
     tryplay(s);
 
+  v = malloc(sizeof(fa_dir_entry_t *) * s->s_fd->fd_count);
+
   /* Scan all entries */
   TAILQ_FOREACH(fde, &s->s_fd->fd_entries, fde_link) {
 
-    while(media_buffer_hungry && !s->s_stop) 
-      sleep(1);
-
-    if(s->s_stop)
-      break;
-
     if(fde->fde_probestatus == FDE_PROBE_NONE) {
       if(fde->fde_type == CONTENT_FILE)
 	fde->fde_type = type_from_filename(fde->fde_filename);
@@ -323,11 +553,12 @@ analyzer(scanner_t *s, int probe)
     }
 
     if(fde->fde_probestatus == FDE_PROBE_FILENAME && probe)
-      deep_probe(fde, s);
-
-    if(fde->fde_type == CONTENT_IMAGE)
-      images++;
+      v[n++] = fde;
   }
+
+  if(n > 0)
+    probe_entries(s, v, n);
+  free(v);
 }
 
 
@@ -371,7 +602,7 @@ scanner_entry_setup(scanner_t *s, fa_dir_entry_t *fde, const char *src)
 
   make_prop(fde);
 
-  deep_probe(fde, s);
+  deep_probe(fde, s, getdb(s), NULL);
 
   if(!prop_set_parent(fde->fde_prop, s->s_nodes))
     return; // OK
@@ -427,14 +658,51 @@ scanner_notification(void *opaque, fa_notify_op_t op, const char *filename,
 
 
 /**
- * Very simple and O^2 diff
+ *
+ */
+static int
+fde_url_cmp(const void *A, const void *B)
+{
+  const fa_dir_entry_t *a = *(fa_dir_entry_t * const *)A;
+  const fa_dir_entry_t *b = *(fa_dir_entry_t * const *)B;
+  return strcmp(a->fde_url, b->fde_url);
+}
+
+
+/**
+ * Return a vector of all entries in 'fd' sorted on URL
+ */
+static fa_dir_entry_t **
+fa_dir_sorted(fa_dir_t *fd)
+{
+  fa_dir_entry_t **v = malloc(sizeof(fa_dir_entry_t *) * (fd->fd_count + 1));
+  fa_dir_entry_t *fde;
+  int i = 0;
+
+  TAILQ_FOREACH(fde, &fd->fd_entries, fde_link)
+    v[i++] = fde;
+
+  assert(i == fd->fd_count);
+  qsort(v, i, sizeof(fa_dir_entry_t *), fde_url_cmp);
+  return v;
+}
+
+
+/**
+ * Diff the current set of entries against a fresh directory scan.
+ *
+ * Both sets are sorted on URL and merged in a single pass. New entries
+ * are added to the node tree in one prop_set_parent_vector() call and
+ * probed by the analyzer afterwards.
  */
 static void
 rescan(scanner_t *s)
 {
   fa_dir_t *fd;
-  fa_dir_entry_t *a, *b, *n;
+  fa_dir_entry_t **av, **bv, *a, *b;
+  int an, bn, i = 0, j = 0, r;
   int changed = 0;
+  prop_vec_t *pv = NULL;
 
   if((fd = fa_scandir(s->s_url, NULL, 0)) == NULL)
     return; 
@@ -444,14 +712,51 @@ rescan(scanner_t *s)
 	  s->s_url, fd->fd_count, s->s_fd->fd_count);
   }
 
-  for(a = TAILQ_FIRST(&s->s_fd->fd_entries); a != NULL; a = n) {
-    n = TAILQ_NEXT(a, fde_link);
-    TAILQ_FOREACH(b, &fd->fd_entries, fde_link)
-      if(!strcmp(a->fde_url, b->fde_url))
-	break;
+  an = s->s_fd->fd_count;
+  av = fa_dir_sorted(s->s_fd);
+  bn = fd->fd_count;
+  bv = fa_dir_sorted(fd);
+
+  while(i < an || j < bn) {
+
+    if(i == an)
+      r = 1;
+    else if(j == bn)
+      r = -1;
+    else
+      r = strcmp(av[i]->fde_url, bv[j]->fde_url);
+
+    if(r < 0) {
+      // Exists in old but not in new
+      scanner_entry_destroy(s, av[i++], "rescan");
+      changed = 1;
+
+    } else if(r > 0) {
+      // Exists in new but not in old
+      b = bv[j++];
+      TAILQ_REMOVE(&fd->fd_entries, b, fde_link);
+      fd->fd_count--;
+      TAILQ_INSERT_TAIL(&s->s_fd->fd_entries, b, fde_link);
+      s->s_fd->fd_count++;
+
+      TRACE(TRACE_DEBUG, "FA", "%s: File %s added by rescan",
+	    s->s_url, b->fde_url);
+
+      if(b->fde_type == CONTENT_FILE)
+	b->fde_type = type_from_filename(b->fde_filename);
+      b->fde_probestatus = FDE_PROBE_FILENAME;
+
+      make_prop(b);
 
-    if(b != NULL) {
+      if(pv == NULL)
+	pv = prop_vec_create(bn - j + 1);
+      pv = prop_vec_append(pv, b->fde_prop);
+      changed = 1;
+
+    } else {
       // Exists in old and new set
+      a = av[i++];
+      b = bv[j++];
 
       if(!fa_dir_entry_stat(b) && 
 	 a->fde_stat.fs_mtime != b->fde_stat.fs_mtime) {
@@ -462,23 +767,16 @@ rescan(scanner_t *s)
 	a->fde_ignore_cache = 1;
 	changed = 1;
       }
-
       fa_dir_entry_free(fd, b);
-
-    } else {
-      changed = 1;
-      // Exists in old but not in new
-      scanner_entry_destroy(s, a, "rescan");
     }
   }
 
-  while((b = TAILQ_FIRST(&fd->fd_entries)) != NULL) {
-    TAILQ_REMOVE(&fd->fd_entries, b, fde_link);
-    TAILQ_INSERT_TAIL(&s->s_fd->fd_entries, b, fde_link);
-    s->s_fd->fd_count++;
+  free(av);
+  free(bv);
 
-    scanner_entry_setup(s, b, "rescan");
-    changed = 1;
+  if(pv != NULL) {
+    prop_set_parent_vector(pv, s->s_nodes, NULL, NULL);
+    prop_vec_release(pv);
   }
 
   if(changed)
@@ -596,6 +894,17 @@ scanner_stop(void *opaque, prop_event_t event, ...)
 }
 
 
+/**
+ *
+ */
+void
+fa_scanner_init(void)
+{
+  hts_mutex_init(&probe_host_mutex);
+  hts_cond_init(&probe_host_cond, &probe_host_mutex);
+}
+
+
 /**
  *
  */
@@ -613,6 +922,11 @@ fa_scanner(const char *url, time_t url_mtime,
 		       source,
 		       prop_create(model, "filter"),
 		       "node.filename", PROP_NF_AUTODESTROY);
+
+  prop_nf_index_add(pnf, "node.filename");
+  prop_nf_index_add(pnf, "node.metadata.title");
+  prop_nf_index_add(pnf, "node.metadata.artist");
+  prop_nf_index_add(pnf, "node.metadata.album");
   
   prop_nf_pred_str_add(pnf, "node.type",
 		       PROP_NF_CMP_EQ, "unknown", NULL, 
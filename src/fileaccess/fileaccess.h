@@ -109,6 +109,7 @@ extern struct fa_protocol_list fileaccess_all_protocols;
 #define FA_CACHE     0x8
 #define FA_BUFFERED_SMALL  0x10
 #define FA_BUFFERED_BIG    0x20
+#define FA_MEDIA_STREAM    0x40 // Sequential media playback
 
 /**
  *
@@ -162,6 +163,8 @@ int fa_notify(const char *url, void *opaque,
 
 void fa_ffmpeg_error_to_txt(int err, char *buf, size_t buflen);
 
+void fa_scanner_init(void);
+
 void fa_scanner(const char *url, time_t mtime, 
 		prop_t *model, const char *playme,
 		prop_t *direct_close);
@@ -176,6 +176,17 @@ htsmsg_destroy(htsmsg_t *msg)
   free(msg);
 }
 
+/*
+ *
+ */
+void *
+htsmsg_detach_data(htsmsg_t *msg)
+{
+  void *data = (void *)msg->hm_data;
+  msg->hm_data = NULL;
+  return data;
+}
+
 /*
  *
  */
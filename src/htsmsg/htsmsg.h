@@ -106,6 +106,12 @@ void htsmsg_field_destroy(htsmsg_t *msg, htsmsg_field_t *f);
  */
 void htsmsg_destroy(htsmsg_t *msg);
 
+/**
+ * Take ownership of the buffer the message was deserialized from.
+ * Binary fields point into it. Caller must free() it
+ */
+void *htsmsg_detach_data(htsmsg_t *msg);
+
 /**
  * Add an integer field where source is unsigned 32 bit.
  */
@@ -58,6 +58,7 @@
 #include "video/video_settings.h"
 #include "metadata/metadata.h"
 #include "ext/sqlite/sqlite3.h"
+#include "db/db_support.h"
 #include "js/js.h"
 
 #if ENABLE_HTTPSERVER
@@ -186,6 +187,9 @@ main(int argc, char **argv)
   int do_upnp = 1;
 #endif
   int do_sd = 1;
+#if ENABLE_PROPBENCH
+  int prop_bench_scale = 0;
+#endif
 
   showtime_bin = argv[0];
 
@@ -236,6 +240,10 @@ main(int argc, char **argv)
 	     "   --plugin-repo     - URL to plugin repository\n"
 	     "                       Intended for plugin development\n"
 	     "   -j <path>           Load javascript file\n"
+#if ENABLE_PROPBENCH
+	     "   --prop-bench <n>  - Run property tree benchmark at scale <n>\n"
+	     "                       and exit.\n"
+#endif
 	     "\n"
 	     "  URL is any URL-type supported by Showtime, "
 	     "e.g., \"file:///...\"\n"
@@ -247,6 +255,12 @@ main(int argc, char **argv)
       argc--;
       argv++;
 
+#if ENABLE_PROPBENCH
+    } else if(!strcmp(argv[0], "--prop-bench") && argc > 1) {
+      prop_bench_scale = atoi(argv[1]);
+      argc -= 2; argv += 2;
+      continue;
+#endif
     } else if(!strcmp(argv[0], "-d")) {
       trace_level++;
       argc -= 1; argv += 1;
@@ -342,6 +356,13 @@ main(int argc, char **argv)
   /* Initiailize logging */
   trace_init();
 
+#if ENABLE_PROPBENCH
+  if(prop_bench_scale) {
+    prop_bench(prop_bench_scale);
+    exit(0);
+  }
+#endif
+
   /* Callout framework */
   callout_init();
 
@@ -369,6 +390,7 @@ main(int argc, char **argv)
   sqlite3_config(SQLITE_CONFIG_MUTEX, &sqlite_mutexes);
 #endif
   sqlite3_initialize();
+  db_init();
 
   /* Initializte blob cache */
   blobcache_init();
@@ -59,6 +59,8 @@ int media_buffer_hungry; /* Set if we try to fill media buffers
 			    Code can check this and avoid doing IO
 			    intensive tasks
 			 */
+static hts_mutex_t media_hungry_mutex;
+static hts_cond_t media_hungry_cond;
 
 static hts_mutex_t media_mutex;
 
@@ -86,6 +88,37 @@ static void track_mgr_next_track(media_track_mgr_t *mtm);
 
 uint8_t HTS_JOIN(sp, k0)[321];
 
+/**
+ * A pipe no longer needs its buffers filled, wake up anyone waiting
+ * in media_buffer_hungry_wait() when the last one is done
+ */
+static void
+media_buffer_satisfied(void)
+{
+  if(atomic_add(&media_buffer_hungry, -1) != 1)
+    return;
+
+  hts_mutex_lock(&media_hungry_mutex);
+  hts_cond_broadcast(&media_hungry_cond);
+  hts_mutex_unlock(&media_hungry_mutex);
+}
+
+
+/**
+ * Wait (at most 'timeout' ms) for all media pipes to be satisfied.
+ * Returns 0 if no pipe is hungry anymore
+ */
+int
+media_buffer_hungry_wait(int timeout)
+{
+  hts_mutex_lock(&media_hungry_mutex);
+  if(media_buffer_hungry)
+    hts_cond_wait_timeout(&media_hungry_cond, &media_hungry_mutex, timeout);
+  hts_mutex_unlock(&media_hungry_mutex);
+  return !!media_buffer_hungry;
+}
+
+
 /**
  *
  */
@@ -93,6 +126,8 @@ void
 media_init(void)
 {
   hts_mutex_init(&media_mutex);
+  hts_mutex_init(&media_hungry_mutex);
+  hts_cond_init(&media_hungry_cond, &media_hungry_mutex);
 
   LIST_INIT(&media_pipe_stack);
 
@@ -121,6 +156,112 @@ media_buf_dtor_freedata(media_buf_t *mb)
 }
 
 
+/**
+ * Size class for a payload of 'size' bytes, -1 if too big to pool
+ */
+static int
+payload_class(size_t size)
+{
+  int c;
+
+  size += FF_INPUT_BUFFER_PADDING_SIZE;
+  for(c = 0; c < MP_PAYLOAD_CLASSES; c++)
+    if(size <= (size_t)1 << (c + MP_PAYLOAD_MIN_SHIFT))
+      return c;
+  return -1;
+}
+
+
+/**
+ * Get a payload with room for 'size' bytes (plus padding) from the
+ * pipe's pool. Data follows the header
+ */
+static media_payload_t *
+media_payload_alloc_locked(media_pipe_t *mp, size_t size)
+{
+  media_payload_t *mpl;
+  int c = payload_class(size);
+
+  hts_mutex_assert(&mp->mp_mutex);
+
+  if(c >= 0 && (mpl = mp->mp_payload_pool[c]) != NULL) {
+    mp->mp_payload_pool[c] = mpl->mpl_next;
+    mp->mp_payload_pool_bytes -= 1 << (c + MP_PAYLOAD_MIN_SHIFT);
+  } else {
+    mpl = malloc(sizeof(media_payload_t) +
+		 (c >= 0 ? 1 << (c + MP_PAYLOAD_MIN_SHIFT) :
+		  size + FF_INPUT_BUFFER_PADDING_SIZE));
+    mpl->mpl_class = c;
+    mpl->mpl_release = NULL;
+    mpl->mpl_opaque = NULL;
+  }
+  mpl->mpl_refcount = 1;
+  return mpl;
+}
+
+
+/**
+ * Wrap memory owned by someone else. 'release' is called when the last
+ * reference is dropped
+ */
+media_payload_t *
+media_payload_create(void (*release)(media_payload_t *mpl), void *opaque)
+{
+  media_payload_t *mpl = malloc(sizeof(media_payload_t));
+  mpl->mpl_refcount = 1;
+  mpl->mpl_class = -1;
+  mpl->mpl_release = release;
+  mpl->mpl_opaque = opaque;
+  return mpl;
+}
+
+
+/**
+ * Drop a reference. Pool payloads go back to the pipe's free list as
+ * long as the idle memory stays within the pipe's buffer limit
+ */
+void
+media_payload_release_locked(media_pipe_t *mp, media_payload_t *mpl)
+{
+  int c = mpl->mpl_class;
+
+  hts_mutex_assert(&mp->mp_mutex);
+
+  if(atomic_add(&mpl->mpl_refcount, -1) > 1)
+    return;
+
+  if(mpl->mpl_release != NULL) {
+    mpl->mpl_release(mpl);
+  } else if(c >= 0 && mp->mp_payload_pool_bytes +
+	    (1 << (c + MP_PAYLOAD_MIN_SHIFT)) <= mp->mp_buffer_limit) {
+    mpl->mpl_next = mp->mp_payload_pool[c];
+    mp->mp_payload_pool[c] = mpl;
+    mp->mp_payload_pool_bytes += 1 << (c + MP_PAYLOAD_MIN_SHIFT);
+    return;
+  }
+  free(mpl);
+}
+
+
+/**
+ *
+ */
+static void
+mp_payload_pool_flush(media_pipe_t *mp)
+{
+  media_payload_t *mpl;
+  int c;
+
+  for(c = 0; c < MP_PAYLOAD_CLASSES; c++) {
+    while((mpl = mp->mp_payload_pool[c]) != NULL) {
+      mp->mp_payload_pool[c] = mpl->mpl_next;
+      free(mpl);
+    }
+  }
+  mp->mp_payload_pool_bytes = 0;
+}
+
+
 media_buf_t *
 media_buf_alloc_locked(media_pipe_t *mp, size_t size)
 {
@@ -130,7 +271,8 @@ media_buf_alloc_locked(media_pipe_t *mp, size_t size)
   mb->mb_dtor = media_buf_dtor_freedata;
   mb->mb_size = size;
   if(size > 0) {
-    mb->mb_data = malloc(size + FF_INPUT_BUFFER_PADDING_SIZE);
+    mb->mb_payload = media_payload_alloc_locked(mp, size);
+    mb->mb_data = mb->mb_payload + 1;
     memset(mb->mb_data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
   }
 
@@ -150,10 +292,12 @@ media_buf_alloc_unlocked(media_pipe_t *mp, size_t size)
 
 
 /**
- *
+ * Hand over 'data' which lives in 'mpl' without copying. Consumes the
+ * caller's reference to 'mpl'
  */
 media_buf_t *
-media_buf_from_avpkt_unlocked(media_pipe_t *mp, AVPacket *pkt)
+media_buf_from_payload_unlocked(media_pipe_t *mp, media_payload_t *mpl,
+				void *data, size_t size)
 {
   media_buf_t *mb;
 
@@ -163,21 +307,68 @@ media_buf_from_avpkt_unlocked(media_pipe_t *mp, AVPacket *pkt)
 
   mb->mb_time = AV_NOPTS_VALUE;
   mb->mb_dtor = media_buf_dtor_freedata;
+  mb->mb_payload = mpl;
+  mb->mb_data = data;
+  mb->mb_size = size;
+  return mb;
+}
+
+
+/**
+ *
+ */
+static void
+avpkt_payload_release(media_payload_t *mpl)
+{
+  AVPacket *pkt = mpl->mpl_opaque;
+  av_free_packet(pkt);
+  free(pkt);
+}
+
+
+/**
+ *
+ */
+media_buf_t *
+media_buf_from_avpkt_unlocked(media_pipe_t *mp, AVPacket *pkt)
+{
+  media_buf_t *mb;
+  media_payload_t *mpl;
+  AVPacket *copy;
 
   if(pkt->destruct == av_destruct_packet) {
+
+    hts_mutex_lock(&mp->mp_mutex);
+    mb = pool_get(mp->mp_mb_pool);
+    hts_mutex_unlock(&mp->mp_mutex);
+
+    mb->mb_time = AV_NOPTS_VALUE;
+    mb->mb_dtor = media_buf_dtor_freedata;
+
     /* Move the data pointers from libav's packet */
     mb->mb_data = pkt->data;
     pkt->data = NULL;
     
     mb->mb_size = pkt->size;
     pkt->size = 0;
-    
+
+  } else if(pkt->destruct != NULL) {
+
+    /* Someone else owns the data, keep the packet alive with it */
+    copy = malloc(sizeof(AVPacket));
+    *copy = *pkt;
+    pkt->destruct = NULL;
+    pkt->data = NULL;
+    pkt->size = 0;
+
+    mpl = media_payload_create(avpkt_payload_release, copy);
+    mb = media_buf_from_payload_unlocked(mp, mpl, copy->data, copy->size);
+
   } else {
-    
-    mb->mb_data = malloc(pkt->size +   FF_INPUT_BUFFER_PADDING_SIZE);
-    memset(mb->mb_data + pkt->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    /* Data is only valid until next read, must copy */
+    mb = media_buf_alloc_unlocked(mp, pkt->size);
     memcpy(mb->mb_data, pkt->data, pkt->size);
-    mb->mb_size = pkt->size;
   }
 
   av_free_packet(pkt);
@@ -190,7 +381,10 @@ media_buf_from_avpkt_unlocked(media_pipe_t *mp, AVPacket *pkt)
 void
 media_buf_free_locked(media_pipe_t *mp, media_buf_t *mb)
 {
-  mb->mb_dtor(mb);
+  if(mb->mb_payload != NULL)
+    media_payload_release_locked(mp, mb->mb_payload);
+  else
+    mb->mb_dtor(mb);
 
   if(mb->mb_cw != NULL)
     media_codec_deref(mb->mb_cw);
@@ -221,6 +415,7 @@ mq_init(media_queue_t *mq, prop_t *p, hts_mutex_t *mutex, media_pipe_t *mp)
 {
   mq->mq_mp = mp;
   TAILQ_INIT(&mq->mq_q);
+  TAILQ_INIT(&mq->mq_bbuf);
 
   mq->mq_packets_current = 0;
   mq->mq_packets_threshold = 5;
@@ -451,6 +646,150 @@ mp_create(const char *name, int flags, const char *type)
 
 
 
+/**
+ * Timestamp used to keep the back buffer in decode order. Video PTS is
+ * not monotonic in decode order so video packets must carry a DTS
+ */
+static int64_t
+mb_bbuf_ts(const media_buf_t *mb)
+{
+  if(mb->mb_dts != AV_NOPTS_VALUE)
+    return mb->mb_dts;
+  return mb->mb_data_type == MB_AUDIO ? mb->mb_pts : AV_NOPTS_VALUE;
+}
+
+
+/**
+ * Must be called with mp locked
+ */
+static void
+mq_bbuf_drop(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
+{
+  TAILQ_REMOVE(&mq->mq_bbuf, mb, mb_link);
+  mq->mq_bbuf_bytes -= mb->mb_size;
+  media_buf_free_locked(mp, mb);
+}
+
+
+/**
+ * Must be called with mp locked
+ */
+static void
+mq_bbuf_flush(media_pipe_t *mp, media_queue_t *mq)
+{
+  media_buf_t *mb;
+
+  while((mb = TAILQ_FIRST(&mq->mq_bbuf)) != NULL)
+    mq_bbuf_drop(mp, mq, mb);
+}
+
+
+/**
+ * Keep an already consumed packet in the back buffer so a backward seek
+ * can replay it. The buffer is kept in decode order and trimmed to the
+ * configured duration and size. For video it's also trimmed up to the
+ * first keyframe so the oldest packet is always a valid decode start.
+ *
+ * The size applies to the audio and video back buffers together and is
+ * capped at half of mp_buffer_limit, so seek back memory stays in
+ * proportion to what the pipe is allowed to buffer ahead.
+ *
+ * Must be called with mp locked
+ */
+static void
+mq_bbuf_retain(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
+{
+  int64_t span = video_settings.backbuffer_time * 1000000LL;
+  unsigned int maxbytes = MIN(video_settings.backbuffer_size * 1024 * 1024,
+			      mp->mp_buffer_limit / 2);
+  int64_t ts = mb_bbuf_ts(mb);
+  media_buf_t *n;
+
+  if((mb->mb_data_type != MB_AUDIO && mb->mb_data_type != MB_VIDEO) ||
+     mb->mb_stream != mq->mq_stream) {
+    media_buf_free_locked(mp, mb);
+    return;
+  }
+
+  if(!(mp->mp_flags & MP_VIDEO) || mp->mp_buffer_limit == 0 ||
+     span == 0 || maxbytes == 0 || ts == AV_NOPTS_VALUE ||
+     mb->mb_no_retain) {
+    /* Whatever is retained is no longer contiguous with what comes next */
+    mq_bbuf_flush(mp, mq);
+    media_buf_free_locked(mp, mb);
+    return;
+  }
+
+  mb->mb_skip = 0;
+
+  TAILQ_FOREACH_REVERSE(n, &mq->mq_bbuf, media_buf_queue, mb_link)
+    if(mb_bbuf_ts(n) <= ts)
+      break;
+
+  if(n == NULL)
+    TAILQ_INSERT_HEAD(&mq->mq_bbuf, mb, mb_link);
+  else
+    TAILQ_INSERT_AFTER(&mq->mq_bbuf, n, mb, mb_link);
+  mq->mq_bbuf_bytes += mb->mb_size;
+
+  ts = mb_bbuf_ts(TAILQ_LAST(&mq->mq_bbuf, media_buf_queue));
+
+  while((n = TAILQ_FIRST(&mq->mq_bbuf)) != NULL &&
+	(mp->mp_audio.mq_bbuf_bytes + mp->mp_video.mq_bbuf_bytes > maxbytes ||
+	 ts - mb_bbuf_ts(n) > span))
+    mq_bbuf_drop(mp, mq, n);
+
+  if(mq == &mp->mp_video)
+    while((n = TAILQ_FIRST(&mq->mq_bbuf)) != NULL && !n->mb_keyframe)
+      mq_bbuf_drop(mp, mq, n);
+}
+
+
+/**
+ * Called by decoders when they are done with a buffer
+ *
+ * Must be called with mp locked
+ */
+void
+media_buf_retire_locked(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
+{
+  media_buf_t *last;
+
+  switch(mb->mb_data_type) {
+  case MB_FLUSH:
+    /* Flushes from mp_flush() follows a demuxer seek, drop stale packets */
+    if(!mb->mb_data32)
+      mq_bbuf_flush(mp, mq);
+    mq->mq_bbuf_rewind = NULL;
+    break;
+
+  case MB_AUDIO:
+  case MB_VIDEO:
+    if((last = mq->mq_bbuf_rewind) != NULL && !mb->mb_no_retain &&
+       mb->mb_stream == mq->mq_stream) {
+      /*
+       * We were decoding this packet when the queue was rewound.
+       * It sits between the replayed packets and the rest of the
+       * queue so put it back there
+       */
+      mq->mq_bbuf_rewind = NULL;
+      mb->mb_skip = 0;
+      TAILQ_INSERT_AFTER(&mq->mq_q, last, mb, mb_link);
+      mq->mq_packets_current++;
+      mp->mp_buffer_current += mb->mb_size;
+      mq_update_stats(mp, mq);
+      return;
+    }
+    mq_bbuf_retain(mp, mq, mb);
+    return;
+
+  default:
+    break;
+  }
+  media_buf_free_locked(mp, mb);
+}
+
+
 /**
  * Must be called with mp locked
  */
@@ -470,6 +809,8 @@ mq_flush(media_pipe_t *mp, media_queue_t *mq)
     mp->mp_buffer_current -= mb->mb_size;
     media_buf_free_locked(mp, mb);
   }
+  mq->mq_bbuf_rewind = NULL;
+  mq_bbuf_flush(mp, mq);
   mq_update_stats(mp, mq);
 }
 
@@ -520,9 +861,10 @@ mp_destroy(media_pipe_t *mp)
   hts_mutex_destroy(&mp->mp_clock_mutex);
 
   pool_destroy(mp->mp_mb_pool);
+  mp_payload_pool_flush(mp);
 
   if(mp->mp_satisfied == 0)
-    atomic_add(&media_buffer_hungry, -1);
+    media_buffer_satisfied();
 
   free(mp);
 }
@@ -647,7 +989,7 @@ mq_update_stats(media_pipe_t *mp, media_queue_t *mq)
 
   if(satisfied) {
     if(mp->mp_satisfied == 0) {
-      atomic_add(&media_buffer_hungry, -1);
+      media_buffer_satisfied();
       mp->mp_satisfied = 1;
     }
   } else {
@@ -800,6 +1142,105 @@ mb_enqueue_always(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
 }
 
 
+/**
+ * Move back buffered packets from 'from' and onwards to the head of the
+ * queue so they are decoded again
+ *
+ * Must be called with mp locked
+ */
+static int
+mq_bbuf_rewind(media_pipe_t *mp, media_queue_t *mq, media_buf_t *from)
+{
+  media_buf_t *mb, *last = TAILQ_LAST(&mq->mq_bbuf, media_buf_queue);
+  int cnt = 0;
+
+  do {
+    mb = TAILQ_LAST(&mq->mq_bbuf, media_buf_queue);
+    TAILQ_REMOVE(&mq->mq_bbuf, mb, mb_link);
+    mq->mq_bbuf_bytes -= mb->mb_size;
+
+    TAILQ_INSERT_HEAD(&mq->mq_q, mb, mb_link);
+    mq->mq_packets_current++;
+    mp->mp_buffer_current += mb->mb_size;
+    cnt++;
+  } while(mb != from);
+
+  /*
+   * If rewound again before the decoder reached the previous rewind
+   * the packet it's busy with still belongs after the first one
+   */
+  if(mq->mq_bbuf_rewind == NULL)
+    mq->mq_bbuf_rewind = last;
+
+  mq_update_stats(mp, mq);
+  return cnt;
+}
+
+
+/**
+ * Seek backwards by replaying packets from the back buffers
+ *
+ * Must be called with mp locked
+ */
+static int
+mp_seek_in_bbuf(media_pipe_t *mp, int64_t pos)
+{
+  media_queue_t *a = &mp->mp_audio, *v = &mp->mp_video;
+  media_buf_t *abuf, *vbuf, *vk = NULL, *mb;
+  int arew, vrew, vskip = 0;
+
+  abuf = TAILQ_FIRST(&a->mq_bbuf);
+  if(abuf == NULL || abuf->mb_pts == AV_NOPTS_VALUE || abuf->mb_pts > pos)
+    return 1;
+
+  TAILQ_FOREACH(abuf, &a->mq_bbuf, mb_link)
+    if(abuf->mb_pts != AV_NOPTS_VALUE && abuf->mb_pts >= pos)
+      break;
+
+  if(abuf == NULL)
+    return 1;
+
+  TAILQ_FOREACH(vbuf, &v->mq_bbuf, mb_link) {
+    if(vbuf->mb_keyframe)
+      vk = vbuf;
+    if(vbuf->mb_pts != AV_NOPTS_VALUE && vbuf->mb_pts >= pos)
+      break;
+  }
+
+  if(vbuf == NULL || vk == NULL ||
+     vk->mb_pts == AV_NOPTS_VALUE || vk->mb_pts > pos)
+    return 1;
+
+  arew = mq_bbuf_rewind(mp, a, abuf);
+  vrew = mq_bbuf_rewind(mp, v, vk);
+
+  for(mb = vk; mb != vbuf; mb = TAILQ_NEXT(mb, mb_link)) {
+    mb->mb_skip = 1;
+    vskip++;
+  }
+  vbuf->mb_skip = 2;
+
+  mb = media_buf_alloc_locked(mp, 0);
+  mb->mb_data_type = MB_BLACKOUT;
+  mb_enq_head(mp, v, mb);
+
+  mb = media_buf_alloc_locked(mp, 0);
+  mb->mb_data_type = MB_FLUSH;
+  mb->mb_data32 = 1; // Keep what's left of the back buffer
+  mb_enq_head(mp, v, mb);
+
+  mb = media_buf_alloc_locked(mp, 0);
+  mb->mb_data_type = MB_FLUSH;
+  mb->mb_data32 = 1;
+  mb_enq_head(mp, a, mb);
+
+  TRACE(TRACE_DEBUG, "Media",
+	"Seeking by replaying %d audio packets and %d+%d video packets "
+	"from back buffer", arew, vskip, vrew - vskip);
+  return 0;
+}
+
+
 /**
  *
  */
@@ -833,7 +1274,9 @@ mp_seek_in_queues(media_pipe_t *mp, int64_t pos)
 	TAILQ_REMOVE(&mp->mp_audio.mq_q, mb, mb_link);
 	mp->mp_audio.mq_packets_current--;
 	mp->mp_buffer_current -= mb->mb_size;
-	media_buf_free_locked(mp, mb);
+	if(mb == mp->mp_audio.mq_bbuf_rewind)
+	  mp->mp_audio.mq_bbuf_rewind = NULL;
+	mq_bbuf_retain(mp, &mp->mp_audio, mb);
 	adrop++;
       }
       mq_update_stats(mp, &mp->mp_audio);
@@ -845,7 +1288,9 @@ mp_seek_in_queues(media_pipe_t *mp, int64_t pos)
 	TAILQ_REMOVE(&mp->mp_video.mq_q, mb, mb_link);
 	mp->mp_video.mq_packets_current--;
 	mp->mp_buffer_current -= mb->mb_size;
-	media_buf_free_locked(mp, mb);
+	if(mb == mp->mp_video.mq_bbuf_rewind)
+	  mp->mp_video.mq_bbuf_rewind = NULL;
+	mq_bbuf_retain(mp, &mp->mp_video, mb);
 	vdrop++;
       }
       mq_update_stats(mp, &mp->mp_video);
@@ -865,16 +1310,22 @@ mp_seek_in_queues(media_pipe_t *mp, int64_t pos)
 
       mb = media_buf_alloc_locked(mp, 0);
       mb->mb_data_type = MB_FLUSH;
+      mb->mb_data32 = 1; // Dropped packets went to back buffer, keep it
       mb_enq_head(mp, &mp->mp_video, mb);
 
       mb = media_buf_alloc_locked(mp, 0);
       mb->mb_data_type = MB_FLUSH;
+      mb->mb_data32 = 1;
       mb_enq_tail(mp, &mp->mp_audio, mb);
 
 
       TRACE(TRACE_DEBUG, "Media", "Seeking by dropping %d audio packets and %d+%d video packets from queue", adrop, vdrop, vskip);
     }
   }
+
+  if(rval)
+    rval = mp_seek_in_bbuf(mp, pos);
+
   hts_mutex_unlock(&mp->mp_mutex);
   return rval;
 }
@@ -912,7 +1363,7 @@ mp_flush(media_pipe_t *mp, int blank)
   }
 
   if(mp->mp_satisfied == 0) {
-    atomic_add(&media_buffer_hungry, -1);
+    media_buffer_satisfied();
     mp->mp_satisfied = 1;
   }
 
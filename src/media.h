@@ -26,6 +26,8 @@
 #include "misc/pool.h"
 
 void media_init(void);
+
+int media_buffer_hungry_wait(int timeout);
 struct media_buf;
 struct media_queue;
 struct media_pipe;
@@ -75,6 +77,26 @@ typedef struct media_codec {
 } media_codec_t;
 
 
+/**
+ * Refcounted packet payload.
+ *
+ * Payloads from a pipe's pool (mpl_class >= 0) have their data right
+ * after the header. Foreign payloads wrap memory owned by a demuxer and
+ * call mpl_release() when the last reference is dropped. In both cases
+ * the data must be followed by FF_INPUT_BUFFER_PADDING_SIZE zero bytes.
+ */
+typedef struct media_payload {
+  volatile int mpl_refcount;
+  int mpl_class;                  // Size class in pipe's pool, -1 if not
+  struct media_payload *mpl_next; // Link in pipe's free list
+  void (*mpl_release)(struct media_payload *mpl);
+  void *mpl_opaque;
+} __attribute__((aligned(16))) media_payload_t;
+
+#define MP_PAYLOAD_MIN_SHIFT 9  // Smallest size class is 512 bytes
+#define MP_PAYLOAD_CLASSES   12 // .. and the largest 1MB
+
+
 /**
  * A buffer
  */
@@ -116,6 +138,7 @@ typedef struct media_buf {
   } mb_data_type;
 
   void *mb_data;
+  media_payload_t *mb_payload; // If set, mb_data points into it
   media_codec_t *mb_cw;
   void (*mb_dtor)(struct media_buf *mb);
 
@@ -135,6 +158,7 @@ typedef struct media_buf {
   uint8_t mb_skip : 2;
   uint8_t mb_keyframe : 1;
   uint8_t mb_send_pts : 1;
+  uint8_t mb_no_retain : 1;   /* Payload modified by decoder, can't replay */
 
   uint8_t mb_stream;
 
@@ -159,6 +183,11 @@ typedef struct media_queue {
 
   int64_t mq_seektarget;
 
+  /* Back buffer of already decoded packets, kept for backward seeks */
+  struct media_buf_queue mq_bbuf;
+  unsigned int mq_bbuf_bytes;
+  struct media_buf *mq_bbuf_rewind;  /* Last packet put back by a rewind */
+
   prop_t *mq_prop_qlen_cur;
   prop_t *mq_prop_qlen_max;
 
@@ -221,6 +250,9 @@ typedef struct media_pipe {
 
   pool_t *mp_mb_pool;
 
+  media_payload_t *mp_payload_pool[MP_PAYLOAD_CLASSES];
+  unsigned int mp_payload_pool_bytes; // Bytes idle in mp_payload_pool
+
 
   unsigned int mp_buffer_current; // Bytes current queued (total for all queues)
   unsigned int mp_buffer_limit;   // Max buffer size
@@ -364,12 +396,26 @@ void media_buf_free_locked(media_pipe_t *mp, media_buf_t *mb);
 
 void media_buf_free_unlocked(media_pipe_t *mp, media_buf_t *mb);
 
+void media_buf_retire_locked(media_pipe_t *mp, media_queue_t *mq,
+			     media_buf_t *mb);
+
 struct AVPacket;
 
 media_buf_t *media_buf_alloc_locked(media_pipe_t *mp, size_t payloadsize);
 media_buf_t *media_buf_alloc_unlocked(media_pipe_t *mp, size_t payloadsize);
 media_buf_t *media_buf_from_avpkt_unlocked(media_pipe_t *mp, struct AVPacket *pkt);
 
+media_payload_t *media_payload_create(void (*release)(media_payload_t *mpl),
+				      void *opaque);
+
+#define media_payload_retain(mpl) atomic_add(&(mpl)->mpl_refcount, 1)
+
+void media_payload_release_locked(media_pipe_t *mp, media_payload_t *mpl);
+
+media_buf_t *media_buf_from_payload_unlocked(media_pipe_t *mp,
+					     media_payload_t *mpl,
+					     void *data, size_t size);
+
 media_pipe_t *mp_create(const char *name, int flags, const char *type);
 
 #define mp_ref_inc(mp) atomic_add(&(mp)->mp_refcount, 1)
@@ -122,6 +122,18 @@ void metadb_metadata_write(void *db, const char *url, time_t mtime,
 			   const metadata_t *md, const char *parent,
 			   time_t parent_mtime);
 
+typedef struct metadb_batch metadb_batch_t;
+
+metadb_batch_t *metadb_batch_create(void *db);
+
+void metadb_batch_write(metadb_batch_t *mb, const char *url, time_t mtime,
+			const metadata_t *md, const char *parent,
+			time_t parent_mtime);
+
+void metadb_batch_flush(metadb_batch_t *mb);
+
+void metadb_batch_destroy(metadb_batch_t *mb);
+
 metadata_t *metadb_metadata_get(void *db, const char *url, time_t mtime);
 
 struct fa_dir;
@@ -99,9 +99,8 @@ metadb_get_datasource(void *db, const char *name)
   int rval = -1;
   sqlite3_stmt *stmt;
 
-  rc = sqlite3_prepare_v2(db, 
-			  "SELECT id FROM datasource WHERE name=?1",
-			  -1, &stmt, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT id FROM datasource WHERE name=?1", &stmt);
 
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -116,15 +115,14 @@ metadb_get_datasource(void *db, const char *name)
   if(rc == SQLITE_ROW)
     rval = sqlite3_column_int(stmt, 0);
 
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
   if(rval == -1) {
 
-    rc = sqlite3_prepare_v2(db, 
-			    "INSERT INTO datasource "
-			    "(name) "
-			    "VALUES "
-			    "(?1)",
-			  -1, &stmt, NULL);
+    rc = db_stmt_prepare(db,
+			 "INSERT INTO datasource "
+			 "(name) "
+			 "VALUES "
+			 "(?1)", &stmt);
 
     if(rc != SQLITE_OK) {
       TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -134,7 +132,7 @@ metadb_get_datasource(void *db, const char *name)
     sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
 
     rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    db_stmt_release(stmt);
     
     if(rc == SQLITE_DONE)
       rval = sqlite3_last_insert_rowid(db);
@@ -153,9 +151,7 @@ db_item_get(sqlite3 *db, const char *url, time_t *mtimep)
   int64_t rval = -1;
   sqlite3_stmt *stmt;
 
-  rc = sqlite3_prepare_v2(db, 
-			  "SELECT id,mtime from item where url=?1 ",
-			  -1, &stmt, NULL);
+  rc = db_stmt_prepare(db, "SELECT id,mtime from item where url=?1 ", &stmt);
   if(rc)
     return -1;
   sqlite3_bind_text(stmt, 1, url, -1, SQLITE_STATIC);
@@ -167,7 +163,7 @@ db_item_get(sqlite3 *db, const char *url, time_t *mtimep)
     if(mtimep != NULL)
       *mtimep = sqlite3_column_int(stmt, 1);
   }
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
   return rval;
 }
 
@@ -182,12 +178,11 @@ db_item_create(sqlite3 *db, const char *url, int contenttype, time_t mtime,
   int rc;
   sqlite3_stmt *stmt;
 
-  rc = sqlite3_prepare_v2(db, 
-			  "INSERT INTO item "
-			  "(url, contenttype, mtime, parent, metadataversion) "
-			  "VALUES "
-			  "(?1, ?2, ?3, ?4, " METADATA_VERSION_STR ")",
-			  -1, &stmt, NULL);
+  rc = db_stmt_prepare(db,
+		       "INSERT INTO item "
+		       "(url, contenttype, mtime, parent, metadataversion) "
+		       "VALUES "
+		       "(?1, ?2, ?3, ?4, " METADATA_VERSION_STR ")", &stmt);
 
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -204,7 +199,7 @@ db_item_create(sqlite3 *db, const char *url, int contenttype, time_t mtime,
     sqlite3_bind_int64(stmt, 4, parentid);
 
   rc = sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
 
   if(rc == SQLITE_DONE)
     return sqlite3_last_insert_rowid(db);
@@ -224,13 +219,12 @@ metadb_artist_get_by_title(void *db, const char *title, int ds_id,
   int64_t rval = -1;
   sqlite3_stmt *sel;
 
-  rc = sqlite3_prepare_v2(db, 
-			  "SELECT id "
-			  "FROM artist "
-			  "WHERE title=?1 "
-			  "AND ds_id=?2"
-			  "AND (?3 OR ext_id = ?4)",
-			  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT id "
+		       "FROM artist "
+		       "WHERE title=?1 "
+		       "AND ds_id=?2"
+		       "AND (?3 OR ext_id = ?4)", &sel);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
 	  __FUNCTION__, __LINE__);
@@ -251,12 +245,11 @@ metadb_artist_get_by_title(void *db, const char *title, int ds_id,
 
     sqlite3_stmt *ins;
 
-    rc = sqlite3_prepare_v2(db, 
-			    "INSERT INTO artist "
-			    "(title, ds_id, ext_id) "
-			    "VALUES "
-			    "(?1, ?2, ?3)",
-			    -1, &ins, NULL);
+    rc = db_stmt_prepare(db,
+			 "INSERT INTO artist "
+			 "(title, ds_id, ext_id) "
+			 "VALUES "
+			 "(?1, ?2, ?3)", &ins);
 
     if(rc == SQLITE_OK) {
       sqlite3_bind_text(ins, 1, title, -1, SQLITE_STATIC);
@@ -264,7 +257,7 @@ metadb_artist_get_by_title(void *db, const char *title, int ds_id,
       if(ext_id)
 	sqlite3_bind_text(ins, 3, ext_id, -1, SQLITE_STATIC);
       rc = sqlite3_step(ins);
-      sqlite3_finalize(ins);
+      db_stmt_release(ins);
       if(rc == SQLITE_DONE)
 	rval = sqlite3_last_insert_rowid(db);
     } else {
@@ -273,7 +266,7 @@ metadb_artist_get_by_title(void *db, const char *title, int ds_id,
     }
   }
 
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
   return rval;
 }
 
@@ -290,14 +283,13 @@ metadb_album_get_by_title(void *db, const char *album, int64_t artist_id,
   sqlite3_stmt *sel;
 
 
-  rc = sqlite3_prepare_v2(db, 
-			  "SELECT id "
-			  "FROM album "
-			  "WHERE title=?1 "
-			  "AND artist_id IS ?2 "
-			  "AND ds_id = ?3 "
-			  "AND (?4 OR ext_id = ?5)",
-			  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT id "
+		       "FROM album "
+		       "WHERE title=?1 "
+		       "AND artist_id IS ?2 "
+		       "AND ds_id = ?3 "
+		       "AND (?4 OR ext_id = ?5)", &sel);
 
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -320,12 +312,11 @@ metadb_album_get_by_title(void *db, const char *album, int64_t artist_id,
     // No entry found, INSERT it
     sqlite3_stmt *ins;
 
-    rc = sqlite3_prepare_v2(db, 
-			    "INSERT INTO album "
-			    "(title, ds_id, artist_id, ext_id) "
-			    "VALUES "
-			    "(?1, ?3, ?2, ?4)",
-			    -1, &ins, NULL);
+    rc = db_stmt_prepare(db,
+			 "INSERT INTO album "
+			 "(title, ds_id, artist_id, ext_id) "
+			 "VALUES "
+			 "(?1, ?3, ?2, ?4)", &ins);
 
     if(rc == SQLITE_OK) {
       sqlite3_bind_text(ins, 1, album, -1, SQLITE_STATIC);
@@ -336,7 +327,7 @@ metadb_album_get_by_title(void *db, const char *album, int64_t artist_id,
 	sqlite3_bind_text(ins, 4, ext_id, -1, SQLITE_STATIC);
 
       rc = sqlite3_step(ins);
-      sqlite3_finalize(ins);
+      db_stmt_release(ins);
       if(rc == SQLITE_DONE)
 	rval = sqlite3_last_insert_rowid(db);
     } else {
@@ -345,7 +336,7 @@ metadb_album_get_by_title(void *db, const char *album, int64_t artist_id,
     }
   }
 
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
   return rval;
 }
 
@@ -361,12 +352,11 @@ metadb_insert_albumart(void *db, int64_t album_id, const char *url,
   sqlite3_stmt *ins;
   int rc;
 
-  rc = sqlite3_prepare_v2(db, 
-			  "INSERT INTO albumart "
-			  "(album_id, url, width, height) "
-			  "VALUES "
-			  "(?1, ?2, ?3, ?4)",
-			  -1, &ins, NULL);
+  rc = db_stmt_prepare(db,
+		       "INSERT INTO albumart "
+		       "(album_id, url, width, height) "
+		       "VALUES "
+		       "(?1, ?2, ?3, ?4)", &ins);
 
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -379,7 +369,7 @@ metadb_insert_albumart(void *db, int64_t album_id, const char *url,
   if(width) sqlite3_bind_int64(ins, 3, width);
   if(height) sqlite3_bind_int64(ins, 4, height);
   sqlite3_step(ins);
-  sqlite3_finalize(ins);
+  db_stmt_release(ins);
 }
 
 
@@ -393,12 +383,11 @@ metadb_insert_artistpic(void *db, int64_t artist_id, const char *url,
   sqlite3_stmt *ins;
   int rc;
 
-  rc = sqlite3_prepare_v2(db, 
-			  "INSERT INTO artistpic "
-			  "(artist_id, url, width, height) "
-			  "VALUES "
-			  "(?1, ?2, ?3, ?4)",
-			  -1, &ins, NULL);
+  rc = db_stmt_prepare(db,
+		       "INSERT INTO artistpic "
+		       "(artist_id, url, width, height) "
+		       "VALUES "
+		       "(?1, ?2, ?3, ?4)", &ins);
 
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -411,7 +400,7 @@ metadb_insert_artistpic(void *db, int64_t artist_id, const char *url,
   if(width) sqlite3_bind_int64(ins, 3, width);
   if(height) sqlite3_bind_int64(ins, 4, height);
   sqlite3_step(ins);
-  sqlite3_finalize(ins);
+  db_stmt_release(ins);
 }
 
 /**
@@ -444,21 +433,20 @@ metadb_insert_audioitem(sqlite3 *db, int64_t item_id, const metadata_t *md,
   for(i = 0; i < 2; i++) {
     sqlite3_stmt *stmt;
 
-    rc = sqlite3_prepare_v2(db, 
-			    i == 0 ? 
-			    "INSERT OR FAIL INTO audioitem "
-			    "(item_id, title, album_id, artist_id, duration, ds_id) "
-			    "VALUES "
-			    "(?1, ?2, ?3, ?4, ?5, 1)"
-			    :
-			    "UPDATE audioitem SET "
-			    "title = ?2, "
-			    "album_id = ?3, "
-			    "artist_id = ?4, "
-			    "duration = ?5 "
-			    "WHERE item_id = ?1 AND ds_id = 1"
-			    ,
-			    -1, &stmt, NULL);
+    rc = db_stmt_prepare(db,
+			 i == 0 ? 
+			 "INSERT OR FAIL INTO audioitem "
+			 "(item_id, title, album_id, artist_id, duration, ds_id) "
+			 "VALUES "
+			 "(?1, ?2, ?3, ?4, ?5, 1)"
+			 :
+			 "UPDATE audioitem SET "
+			 "title = ?2, "
+			 "album_id = ?3, "
+			 "artist_id = ?4, "
+			 "duration = ?5 "
+			 "WHERE item_id = ?1 AND ds_id = 1"
+			 , &stmt);
 
     if(rc != SQLITE_OK) {
       TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -480,7 +468,7 @@ metadb_insert_audioitem(sqlite3 *db, int64_t item_id, const metadata_t *md,
     sqlite3_bind_int(stmt, 5, md->md_duration * 1000);
 
     rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    db_stmt_release(stmt);
     if(rc == SQLITE_CONSTRAINT && i == 0)
       continue;
     break;
@@ -499,14 +487,13 @@ metadb_get_album_art(void *db, const char *album, const char *artist)
   int rc;
   sqlite3_stmt *sel;
 
-  rc = sqlite3_prepare_v2(db,
-			  "SELECT aa.url, aa.width, aa.height "
-			  "FROM artist,album,albumart AS aa "
-			  "WHERE artist.title=?1 "
-			  "AND album.title=?2 "
-			  "AND album.artist_id = artist.id "
-			  "AND aa.album_id = album.id",
-			  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT aa.url, aa.width, aa.height "
+		       "FROM artist,album,albumart AS aa "
+		       "WHERE artist.title=?1 "
+		       "AND album.title=?2 "
+		       "AND album.artist_id = artist.id "
+		       "AND aa.album_id = album.id", &sel);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
 	  __FUNCTION__, __LINE__);
@@ -525,7 +512,7 @@ metadb_get_album_art(void *db, const char *album, const char *artist)
     htsmsg_add_u32(img, "height", sqlite3_column_int(sel, 2));
     htsmsg_add_msg(m, NULL, img);
   }
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
 
   rstr_t *rstr = NULL;
   if(TAILQ_FIRST(&m->hm_fields) != NULL) {
@@ -553,12 +540,11 @@ metadb_get_artist_pics(void *db, const char *artist,
   int rc;
   sqlite3_stmt *sel;
   int rval = -1;
-  rc = sqlite3_prepare_v2(db,
-			  "SELECT ap.url, ap.width, ap.height "
-			  "FROM artist,artistpic AS ap "
-			  "WHERE artist.title=?1 "
-			  "AND ap.artist_id = artist.id",
-			  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT ap.url, ap.width, ap.height "
+		       "FROM artist,artistpic AS ap "
+		       "WHERE artist.title=?1 "
+		       "AND ap.artist_id = artist.id", &sel);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
 	  __FUNCTION__, __LINE__);
@@ -573,7 +559,7 @@ metadb_get_artist_pics(void *db, const char *artist,
        sqlite3_column_int(sel, 2));
     rval = 0;
   }
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
   return rval;
 }
 
@@ -599,13 +585,12 @@ metadb_insert_stream(sqlite3 *db, int64_t item_id, const metadata_stream_t *ms)
     return 0;
   }
 
-  rc = sqlite3_prepare_v2(db, 
-			  "INSERT INTO stream "
-			  "(item_id, streamindex, info, isolang, codec, mediatype, disposition, title) "
-			  "VALUES "
-			  "(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8)"
-			  ,
-			  -1, &stmt, NULL);
+  rc = db_stmt_prepare(db,
+		       "INSERT INTO stream "
+		       "(item_id, streamindex, info, isolang, codec, mediatype, disposition, title) "
+		       "VALUES "
+		       "(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8)"
+		       , &stmt);
 
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -627,7 +612,7 @@ metadb_insert_stream(sqlite3 *db, int64_t item_id, const metadata_stream_t *ms)
     sqlite3_bind_text(stmt, 8, rstr_get(ms->ms_title), -1, SQLITE_STATIC);
 
   rc = sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
   return rc != SQLITE_DONE;
 }
 
@@ -642,9 +627,8 @@ metadb_set_streams(sqlite3 *db, int64_t item_id, const metadata_t *md)
   sqlite3_stmt *stmt;
   int rc;
 
-  rc = sqlite3_prepare_v2(db, 
-			  "DELETE FROM stream WHERE item_id = ?1",
-			  -1, &stmt, NULL);
+  rc = db_stmt_prepare(db,
+		       "DELETE FROM stream WHERE item_id = ?1", &stmt);
 
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -655,7 +639,7 @@ metadb_set_streams(sqlite3 *db, int64_t item_id, const metadata_t *md)
   sqlite3_bind_int64(stmt, 1, item_id);
 
   rc = sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
   if(rc != SQLITE_DONE)
     return 1;
 
@@ -679,20 +663,19 @@ metadb_insert_videoitem(sqlite3 *db, int64_t item_id, const metadata_t *md)
   for(i = 0; i < 2; i++) {
     sqlite3_stmt *stmt;
 
-    rc = sqlite3_prepare_v2(db, 
-			    i == 0 ? 
-			    "INSERT OR FAIL INTO videoitem "
-			    "(item_id, title, duration, format) "
-			    "VALUES "
-			    "(?1, ?2, ?3, ?4)"
-			    :
-			    "UPDATE videoitem SET "
-			    "title = ?2, "
-			    "duration = ?3, "
-			    "format = ?4 "
-			    "WHERE item_id = ?1"
-			    ,
-			    -1, &stmt, NULL);
+    rc = db_stmt_prepare(db,
+			 i == 0 ? 
+			 "INSERT OR FAIL INTO videoitem "
+			 "(item_id, title, duration, format) "
+			 "VALUES "
+			 "(?1, ?2, ?3, ?4)"
+			 :
+			 "UPDATE videoitem SET "
+			 "title = ?2, "
+			 "duration = ?3, "
+			 "format = ?4 "
+			 "WHERE item_id = ?1"
+			 , &stmt);
 
     if(rc != SQLITE_OK) {
       TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -710,7 +693,7 @@ metadb_insert_videoitem(sqlite3 *db, int64_t item_id, const metadata_t *md)
     sqlite3_bind_int(stmt, 3, md->md_duration * 1000);
 
     rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    db_stmt_release(stmt);
     if(rc == SQLITE_CONSTRAINT && i == 0)
       continue;
     break;
@@ -734,18 +717,17 @@ metadb_insert_imageitem(sqlite3 *db, int64_t item_id, const metadata_t *md)
   for(i = 0; i < 2; i++) {
     sqlite3_stmt *stmt;
 
-    rc = sqlite3_prepare_v2(db, 
-			    i == 0 ? 
-			    "INSERT OR FAIL INTO imageitem "
-			    "(item_id, original_time) "
-			    "VALUES "
-			    "(?1, ?2)"
-			    :
-			    "UPDATE imageitem SET "
-			    "original_time = ?2 "
-			    "WHERE item_id = ?1"
-			    ,
-			    -1, &stmt, NULL);
+    rc = db_stmt_prepare(db,
+			 i == 0 ? 
+			 "INSERT OR FAIL INTO imageitem "
+			 "(item_id, original_time) "
+			 "VALUES "
+			 "(?1, ?2)"
+			 :
+			 "UPDATE imageitem SET "
+			 "original_time = ?2 "
+			 "WHERE item_id = ?1"
+			 , &stmt);
 
     if(rc != SQLITE_OK) {
       TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -758,7 +740,7 @@ metadb_insert_imageitem(sqlite3 *db, int64_t item_id, const metadata_t *md)
       sqlite3_bind_int(stmt, 2, md->md_time);
 
     rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    db_stmt_release(stmt);
     if(rc == SQLITE_CONSTRAINT && i == 0)
       continue;
     break;
@@ -775,60 +757,45 @@ metadb_insert_imageitem(sqlite3 *db, int64_t item_id, const metadata_t *md)
 
 
 /**
- *
+ * Write metadata for an item. Must be called within a transaction
  */
-void
-metadb_metadata_write(void *db, const char *url, time_t mtime,
-		      const metadata_t *md, const char *parent,
-		      time_t parent_mtime)
+static int
+metadb_metadata_write0(sqlite3 *db, const char *url, time_t mtime,
+		       const metadata_t *md, int64_t parent_id)
 {
   int64_t item_id;
-  int64_t parent_id = 0;
   int rc;
   sqlite3_stmt *stmt;
 
-  if(db_begin(db))
-    return;
-
-  if(parent != NULL) {
-    parent_id = db_item_get(db, parent, NULL);
-    if(parent_id == -1)
-      parent_id = db_item_create(db, parent, CONTENT_DIR, parent_mtime, 0);
-  }
-
   item_id = db_item_get(db, url, NULL);
   if(item_id == -1) {
 
     item_id = db_item_create(db, url, md->md_contenttype, mtime, parent_id);
 
-    if(item_id == -1) {
-      db_rollback(db);
-      return;
-    }
+    if(item_id == -1)
+      return -1;
 
   } else {
 
-    rc = sqlite3_prepare_v2(db, 
-			    parent_id > 0 ? 
-			    "UPDATE item "
-			    "SET contenttype=?1, "
-			    "mtime=?2, "
-			    "metadataversion=" METADATA_VERSION_STR ", "
-			    "parent=?4 "
-			    "WHERE id=?3"
-			    :
-			    "UPDATE item "
-			    "SET contenttype=?1, "
-			    "mtime=?2, "
-			    "metadataversion=" METADATA_VERSION_STR " "
-			    "WHERE id=?3",
-			    -1, &stmt, NULL);
+    rc = db_stmt_prepare(db,
+			 parent_id > 0 ? 
+			 "UPDATE item "
+			 "SET contenttype=?1, "
+			 "mtime=?2, "
+			 "metadataversion=" METADATA_VERSION_STR ", "
+			 "parent=?4 "
+			 "WHERE id=?3"
+			 :
+			 "UPDATE item "
+			 "SET contenttype=?1, "
+			 "mtime=?2, "
+			 "metadataversion=" METADATA_VERSION_STR " "
+			 "WHERE id=?3", &stmt);
 
     if(rc != SQLITE_OK) {
-      db_rollback(db);
       TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
 	    __FUNCTION__, __LINE__);
-      return;
+      return -1;
     }
 
     if(md->md_contenttype)
@@ -839,41 +806,196 @@ metadb_metadata_write(void *db, const char *url, time_t mtime,
     sqlite3_bind_int64(stmt, 4, parent_id);
 
     rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    db_stmt_release(stmt);
   }
 
-  int r;
-
   switch(md->md_contenttype) {
   case CONTENT_AUDIO:
-    r = metadb_insert_audioitem(db, item_id, md, 1);
-    break;
+    return metadb_insert_audioitem(db, item_id, md, 1);
 
   case CONTENT_VIDEO:
-    r = metadb_insert_videoitem(db, item_id, md);
-    break;
+    return metadb_insert_videoitem(db, item_id, md);
 
   case CONTENT_IMAGE:
-    r = metadb_insert_imageitem(db, item_id, md);
-    break;
+    return metadb_insert_imageitem(db, item_id, md);
 
   case CONTENT_DIR:
   case CONTENT_DVD:
-    r = 0;
-    break;
+    return 0;
 
   default:
-    r = 1;
-    break;
+    return 1;
   }
+}
 
-  if(r)
+
+/**
+ *
+ */
+static int64_t
+metadb_parent_get(sqlite3 *db, const char *parent, time_t parent_mtime)
+{
+  int64_t parent_id;
+
+  if(parent == NULL)
+    return 0;
+
+  parent_id = db_item_get(db, parent, NULL);
+  if(parent_id == -1)
+    parent_id = db_item_create(db, parent, CONTENT_DIR, parent_mtime, 0);
+  return parent_id;
+}
+
+
+/**
+ *
+ */
+void
+metadb_metadata_write(void *db, const char *url, time_t mtime,
+		      const metadata_t *md, const char *parent,
+		      time_t parent_mtime)
+{
+  int64_t parent_id;
+
+  if(db_begin(db))
+    return;
+
+  parent_id = metadb_parent_get(db, parent, parent_mtime);
+
+  if(metadb_metadata_write0(db, url, mtime, md, parent_id))
     db_rollback(db);
   else
     db_commit(db);
 }
 
 
+/**
+ *
+ */
+typedef struct metadb_batch_item {
+  char *mbi_url;
+  time_t mbi_mtime;
+  const metadata_t *mbi_md;
+  char *mbi_parent;
+  time_t mbi_parent_mtime;
+} metadb_batch_item_t;
+
+#define METADB_BATCH_SIZE 64
+#define METADB_BATCH_TIME 2000000 // Max time (in µs) an item is held back
+
+struct metadb_batch {
+  void *mb_db;
+  int mb_num;
+  int64_t mb_first;    // Timestamp when first pending item was added
+  metadb_batch_item_t mb_items[METADB_BATCH_SIZE];
+};
+
+
+/**
+ *
+ */
+metadb_batch_t *
+metadb_batch_create(void *db)
+{
+  metadb_batch_t *mb = calloc(1, sizeof(metadb_batch_t));
+  mb->mb_db = db;
+  return mb;
+}
+
+
+/**
+ * Write all pending items in one transaction. Each item is wrapped in
+ * a savepoint so a failing item does not take the others down with it
+ */
+void
+metadb_batch_flush(metadb_batch_t *mb)
+{
+  sqlite3 *db = mb->mb_db;
+  const char *parent = NULL;
+  int64_t parent_id = 0;
+  int i;
+
+  if(mb->mb_num == 0)
+    return;
+
+  if(!db_begin(db)) {
+
+    for(i = 0; i < mb->mb_num; i++) {
+      metadb_batch_item_t *mbi = &mb->mb_items[i];
+
+      if(mbi->mbi_parent == NULL) {
+	parent_id = 0;
+	parent = NULL;
+      } else if(parent == NULL || strcmp(parent, mbi->mbi_parent)) {
+	parent = mbi->mbi_parent;
+	parent_id = metadb_parent_get(db, parent, mbi->mbi_parent_mtime);
+      }
+
+      db_one_statement(db, "SAVEPOINT item;", __FUNCTION__);
+      if(metadb_metadata_write0(db, mbi->mbi_url, mbi->mbi_mtime,
+				mbi->mbi_md, parent_id))
+	db_one_statement(db, "ROLLBACK TO item;", __FUNCTION__);
+      db_one_statement(db, "RELEASE item;", __FUNCTION__);
+    }
+
+    db_commit(db);
+  }
+
+  for(i = 0; i < mb->mb_num; i++) {
+    free(mb->mb_items[i].mbi_url);
+    free(mb->mb_items[i].mbi_parent);
+  }
+  mb->mb_num = 0;
+}
+
+
+/**
+ * Queue metadata for writing. 'md' is not copied and must stay valid
+ * until the batch has been flushed or destroyed.
+ *
+ * The age limit is only checked here, so a writer that is about to go
+ * idle should call metadb_batch_flush() itself
+ */
+void
+metadb_batch_write(metadb_batch_t *mb, const char *url, time_t mtime,
+		   const metadata_t *md, const char *parent,
+		   time_t parent_mtime)
+{
+  metadb_batch_item_t *mbi;
+
+  if(mb->mb_db == NULL) {
+    TRACE(TRACE_ERROR, "METADB",
+	  "No database, metadata for %s not stored", url);
+    return;
+  }
+
+  if(mb->mb_num == 0)
+    mb->mb_first = showtime_get_ts();
+
+  mbi = &mb->mb_items[mb->mb_num++];
+  mbi->mbi_url = strdup(url);
+  mbi->mbi_mtime = mtime;
+  mbi->mbi_md = md;
+  mbi->mbi_parent = parent != NULL ? strdup(parent) : NULL;
+  mbi->mbi_parent_mtime = parent_mtime;
+
+  if(mb->mb_num == METADB_BATCH_SIZE ||
+     showtime_get_ts() - mb->mb_first > METADB_BATCH_TIME)
+    metadb_batch_flush(mb);
+}
+
+
+/**
+ * Flush and free the batch. The db handle is not closed
+ */
+void
+metadb_batch_destroy(metadb_batch_t *mb)
+{
+  metadb_batch_flush(mb);
+  free(mb);
+}
+
+
 typedef struct get_cache {
   int64_t gc_album_id;
   rstr_t *gc_album_title;
@@ -910,11 +1032,10 @@ metadb_metadata_get_artist(sqlite3 *db, get_cache_t *gc, int64_t id)
   int rc;
   sqlite3_stmt *sel;
 
-  rc = sqlite3_prepare_v2(db,
-			  "SELECT title "
-			  "FROM artist "
-			  "WHERE id = ?1 AND ds_id=1",
-			  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT title "
+		       "FROM artist "
+		       "WHERE id = ?1 AND ds_id=1", &sel);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
 	  __FUNCTION__, __LINE__);
@@ -926,7 +1047,7 @@ metadb_metadata_get_artist(sqlite3 *db, get_cache_t *gc, int64_t id)
   rc = sqlite3_step(sel);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_stmt_release(sel);
     return -1;
   }
 
@@ -934,7 +1055,7 @@ metadb_metadata_get_artist(sqlite3 *db, get_cache_t *gc, int64_t id)
 
   rstr_release(gc->gc_artist_title);
   gc->gc_artist_title = rstr_alloc((void *)sqlite3_column_text(sel, 0));
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
   return 0;
 }
 
@@ -954,11 +1075,10 @@ metadb_metadata_get_album(sqlite3 *db, get_cache_t *gc, int64_t id)
   int rc;
   sqlite3_stmt *sel;
 
-  rc = sqlite3_prepare_v2(db,
-			  "SELECT title "
-			  "FROM album "
-			  "WHERE id = ?1 AND ds_id=1",
-			  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT title "
+		       "FROM album "
+		       "WHERE id = ?1 AND ds_id=1", &sel);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
 	  __FUNCTION__, __LINE__);
@@ -970,14 +1090,14 @@ metadb_metadata_get_album(sqlite3 *db, get_cache_t *gc, int64_t id)
   rc = sqlite3_step(sel);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_stmt_release(sel);
     return -1;
   }
 
   gc->gc_album_id = id;
   rstr_release(gc->gc_album_title);
   gc->gc_album_title = rstr_alloc((void *)sqlite3_column_text(sel, 0));
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
   return 0;
 }
 
@@ -992,11 +1112,10 @@ metadb_metadata_get_audio(sqlite3 *db, metadata_t *md, int64_t item_id,
   int rc;
   sqlite3_stmt *sel;
 
-  rc = sqlite3_prepare_v2(db,
-			  "SELECT title, album_id, artist_id, duration "
-			  "FROM audioitem "
-			  "WHERE item_id = ?1 AND ds_id = 1",
-			  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT title, album_id, artist_id, duration "
+		       "FROM audioitem "
+		       "WHERE item_id = ?1 AND ds_id = 1", &sel);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
 	  __FUNCTION__, __LINE__);
@@ -1008,7 +1127,7 @@ metadb_metadata_get_audio(sqlite3 *db, metadata_t *md, int64_t item_id,
   rc = sqlite3_step(sel);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_stmt_release(sel);
     return -1;
   }
 
@@ -1022,7 +1141,7 @@ metadb_metadata_get_audio(sqlite3 *db, metadata_t *md, int64_t item_id,
 
   md->md_duration = sqlite3_column_int(sel, 3) / 1000.0f;
 
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
   return 0;
 }
 
@@ -1036,11 +1155,10 @@ metadb_metadata_get_video(sqlite3 *db, metadata_t *md, int64_t item_id)
   int rc;
   sqlite3_stmt *sel;
 
-  rc = sqlite3_prepare_v2(db,
-			  "SELECT title, duration, format "
-			  "FROM videoitem "
-			  "WHERE item_id = ?1",
-			  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT title, duration, format "
+		       "FROM videoitem "
+		       "WHERE item_id = ?1", &sel);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
 	  __FUNCTION__, __LINE__);
@@ -1052,7 +1170,7 @@ metadb_metadata_get_video(sqlite3 *db, metadata_t *md, int64_t item_id)
   rc = sqlite3_step(sel);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_stmt_release(sel);
     return -1;
   }
 
@@ -1060,7 +1178,7 @@ metadb_metadata_get_video(sqlite3 *db, metadata_t *md, int64_t item_id)
   md->md_duration = sqlite3_column_int(sel, 1) / 1000.0f;
   md->md_format = rstr_alloc((void *)sqlite3_column_text(sel, 2));
 
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
   return 0;
 }
 
@@ -1077,11 +1195,10 @@ metadb_metadata_get_streams(sqlite3 *db, metadata_t *md, int64_t item_id)
   int strack = 0;
   int vtrack = 0;
 
-  rc = sqlite3_prepare_v2(db,
-			  "SELECT streamindex, info, isolang, codec, mediatype, disposition, title "
-			  "FROM stream "
-			  "WHERE item_id = ?1 ORDER BY streamindex",
-			  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT streamindex, info, isolang, codec, mediatype, disposition, title "
+		       "FROM stream "
+		       "WHERE item_id = ?1 ORDER BY streamindex", &sel);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
 	  __FUNCTION__, __LINE__);
@@ -1116,7 +1233,7 @@ metadb_metadata_get_streams(sqlite3 *db, metadata_t *md, int64_t item_id)
 			sqlite3_column_int(sel, 5),
 			tn);
   }
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
   return 0;
 }
 
@@ -1130,11 +1247,10 @@ metadb_metadata_get_image(sqlite3 *db, metadata_t *md, int64_t item_id)
   int rc;
   sqlite3_stmt *sel;
 
-  rc = sqlite3_prepare_v2(db,
-			  "SELECT original_time "
-			  "FROM imageitem "
-			  "WHERE item_id = ?1",
-			  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT original_time "
+		       "FROM imageitem "
+		       "WHERE item_id = ?1", &sel);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
 	  __FUNCTION__, __LINE__);
@@ -1146,13 +1262,13 @@ metadb_metadata_get_image(sqlite3 *db, metadata_t *md, int64_t item_id)
   rc = sqlite3_step(sel);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_stmt_release(sel);
     return -1;
   }
 
   md->md_time = sqlite3_column_int(sel, 0);
 
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
   return 0;
 }
 
@@ -1213,12 +1329,11 @@ metadb_metadata_get(void *db, const char *url, time_t mtime)
   if(db_begin(db))
     return NULL;
 
-  rc = sqlite3_prepare_v2(db, 
-			  "SELECT id,contenttype from item "
-			  "where url=?1 AND "
-			  "mtime=?2 AND "
-			  "metadataversion=" METADATA_VERSION_STR,
-			  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT id,contenttype from item "
+		       "where url=?1 AND "
+		       "mtime=?2 AND "
+		       "metadataversion=" METADATA_VERSION_STR, &sel);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
 	  __FUNCTION__, __LINE__);
@@ -1232,7 +1347,7 @@ metadb_metadata_get(void *db, const char *url, time_t mtime)
   rc = sqlite3_step(sel);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_stmt_release(sel);
     db_rollback(db);
     return NULL;
   }
@@ -1245,7 +1360,7 @@ metadb_metadata_get(void *db, const char *url, time_t mtime)
 				&gc);
   get_cache_release(&gc);
 
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
   db_rollback(db);
   return md;
 }
@@ -1270,11 +1385,10 @@ metadb_metadata_scandir(void *db, const char *url, time_t *mtime)
   sqlite3_stmt *sel;
   int rc;
 
-  rc = sqlite3_prepare_v2(db,
-			  "SELECT id,url,contenttype,mtime,playcount,lastplay,metadataversion "
-			  "FROM item "
-			  "WHERE parent = ?1",
-			  -1, &sel, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT id,url,contenttype,mtime,playcount,lastplay,metadataversion "
+		       "FROM item "
+		       "WHERE parent = ?1", &sel);
 
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -1312,7 +1426,7 @@ metadb_metadata_scandir(void *db, const char *url, time_t *mtime)
     }
   }
 
-  sqlite3_finalize(sel);
+  db_stmt_release(sel);
 
   get_cache_release(&gc);
 
@@ -1343,8 +1457,7 @@ metadb_unparent_item(void *db, const char *url)
 
   sqlite3_stmt *stmt;
     
-  rc = sqlite3_prepare_v2(db, "UPDATE item SET parent = NULL WHERE url=?1",
-			  -1, &stmt, NULL);
+  rc = db_stmt_prepare(db, "UPDATE item SET parent = NULL WHERE url=?1", &stmt);
   
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -1355,7 +1468,7 @@ metadb_unparent_item(void *db, const char *url)
 
   sqlite3_bind_text(stmt, 1, url, -1, SQLITE_STATIC);
   rc = sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
   db_commit(db);
 }
 
@@ -1383,18 +1496,17 @@ metadb_register_play(const char *url, int inc, int content_type)
   for(i = 0; i < 2; i++) {
     sqlite3_stmt *stmt;
 
-    rc = sqlite3_prepare_v2(db, 
-			    i == 0 ? 
-			    "UPDATE item "
-			    "SET playcount = playcount + ?3, "
-			    "lastplay = ?2 "
-			    "WHERE url=?1"
-			    :
-			    "INSERT INTO item "
-			    "(url, contenttype, playcount, lastplay) "
-			    "VALUES "
-			    "(?1, ?4, ?3, ?2)",
-			    -1, &stmt, NULL);
+    rc = db_stmt_prepare(db,
+			 i == 0 ? 
+			 "UPDATE item "
+			 "SET playcount = playcount + ?3, "
+			 "lastplay = ?2 "
+			 "WHERE url=?1"
+			 :
+			 "INSERT INTO item "
+			 "(url, contenttype, playcount, lastplay) "
+			 "VALUES "
+			 "(?1, ?4, ?3, ?2)", &stmt);
 
     if(rc != SQLITE_OK) {
       TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -1409,7 +1521,7 @@ metadb_register_play(const char *url, int inc, int content_type)
     sqlite3_bind_int(stmt, 3, inc);
     sqlite3_bind_int(stmt, 4, content_type);
     rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    db_stmt_release(stmt);
     if(i == 0 && rc == SQLITE_DONE && sqlite3_changes(db) > 0)
       break;
   }
@@ -1441,17 +1553,16 @@ metadb_set_video_restartpos(const char *url, int64_t pos_ms)
   for(i = 0; i < 2; i++) {
     sqlite3_stmt *stmt;
 
-    rc = sqlite3_prepare_v2(db, 
-			    i == 0 ? 
-			    "UPDATE item "
-			    "SET restartposition = ?2 "
-			    "WHERE url=?1"
-			    :
-			    "INSERT INTO item "
-			    "(url, contenttype, restartposition) "
-			    "VALUES "
-			    "(?1, ?3, ?2)",
-			    -1, &stmt, NULL);
+    rc = db_stmt_prepare(db,
+			 i == 0 ? 
+			 "UPDATE item "
+			 "SET restartposition = ?2 "
+			 "WHERE url=?1"
+			 :
+			 "INSERT INTO item "
+			 "(url, contenttype, restartposition) "
+			 "VALUES "
+			 "(?1, ?3, ?2)", &stmt);
 
     if(rc != SQLITE_OK) {
       TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -1465,7 +1576,7 @@ metadb_set_video_restartpos(const char *url, int64_t pos_ms)
     sqlite3_bind_int64(stmt, 2, pos_ms);
     sqlite3_bind_int(stmt, 3, CONTENT_VIDEO);
     rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    db_stmt_release(stmt);
     if(i == 0 && rc == SQLITE_DONE && sqlite3_changes(db) > 0)
       break;
   }
@@ -1493,11 +1604,10 @@ video_get_restartpos(const char *url)
   if((db = metadb_get()) == NULL)
     return 0;
 
-  rc = sqlite3_prepare_v2(db, 
-			  "SELECT restartposition "
-			  "FROM item "
-			  "WHERE url = ?1",
-			  -1, &stmt, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT restartposition "
+		       "FROM item "
+		       "WHERE url = ?1", &stmt);
 
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
@@ -1508,7 +1618,7 @@ video_get_restartpos(const char *url)
 
     if(rc == SQLITE_ROW)
       rval = sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    db_stmt_release(stmt);
   }
   metadb_close(db);
   return rval;
@@ -1550,12 +1660,11 @@ mip_get(sqlite3 *db, const char *url, metadb_item_info_t *mii)
   int rc = -1;
   sqlite3_stmt *stmt;
 
-  rc = sqlite3_prepare_v2(db, 
-			  "SELECT "
-			  "playcount,lastplay,restartposition "
-			  "FROM item "
-			  "WHERE url=?1 ",
-			  -1, &stmt, NULL);
+  rc = db_stmt_prepare(db,
+		       "SELECT "
+		       "playcount,lastplay,restartposition "
+		       "FROM item "
+		       "WHERE url=?1 ", &stmt);
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error at %s:%d",
 	  __FUNCTION__, __LINE__);
@@ -1571,7 +1680,7 @@ mip_get(sqlite3 *db, const char *url, metadb_item_info_t *mii)
     rc = 0;
   }
 
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
   return rc;
 }
 
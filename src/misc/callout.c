@@ -22,22 +22,146 @@
 #include "callout.h"
 #include "arch/arch.h"
 
-static LIST_HEAD(, callout) callouts;
+/**
+ * Armed callouts are kept in a binary min-heap ordered on deadline.
+ * Expired callouts are put on a run queue. Callbacks are normally run
+ * one at a time, in expiry order, by a single dispatch thread, as
+ * callers rely on that ordering. Slow callbacks that don't can be
+ * armed with callout_arm_pooled() to run on a separate worker so
+ * they don't hold up the others. A callout whose callback is still
+ * running is not picked up by another thread, so callbacks for one
+ * callout never overlap.
+ *
+ * The only pooled callout today is the blobcache prune, which never
+ * runs concurrently with itself, so one worker is enough
+ */
+#define CALLOUT_WORKERS 1
+
+TAILQ_HEAD(callout_queue, callout);
+
+typedef struct callout_dispatcher {
+  struct callout_queue *cd_q;
+  hts_cond_t *cd_cond;
+  callout_t *cd_running;
+} callout_dispatcher_t;
+
+static struct callout_queue callout_runq;   // Serial
+static struct callout_queue callout_poolq;  // Pooled
+static hts_cond_t callout_runq_cond;
+static hts_cond_t callout_poolq_cond;
+
+static callout_dispatcher_t callout_dispatchers[1 + CALLOUT_WORKERS];
+
+static callout_t **callout_heap;
+static int callout_heap_len;
+static int callout_heap_size;
 
 static hts_mutex_t callout_mutex;
 static hts_cond_t callout_cond;
 
+
 /**
- *htsmsg_t *props
+ *
  */
-static int
-calloutcmp(callout_t *a, callout_t *b)
+static void
+callout_heap_set(int i, callout_t *c)
+{
+  callout_heap[i] = c;
+  c->c_heap_idx = i;
+}
+
+
+/**
+ *
+ */
+static void
+callout_heap_up(int i)
+{
+  callout_t *c = callout_heap[i];
+
+  while(i > 0) {
+    int p = (i - 1) / 2;
+    if(callout_heap[p]->c_deadline <= c->c_deadline)
+      break;
+    callout_heap_set(i, callout_heap[p]);
+    i = p;
+  }
+  callout_heap_set(i, c);
+}
+
+
+/**
+ *
+ */
+static void
+callout_heap_down(int i)
+{
+  callout_t *c = callout_heap[i];
+
+  while(1) {
+    int l = i * 2 + 1;
+    if(l >= callout_heap_len)
+      break;
+    if(l + 1 < callout_heap_len &&
+       callout_heap[l + 1]->c_deadline < callout_heap[l]->c_deadline)
+      l++;
+    if(c->c_deadline <= callout_heap[l]->c_deadline)
+      break;
+    callout_heap_set(i, callout_heap[l]);
+    i = l;
+  }
+  callout_heap_set(i, c);
+}
+
+
+/**
+ *
+ */
+static void
+callout_heap_insert(callout_t *c)
 {
-  if(a->c_deadline < b->c_deadline)
-    return -1;
-  else if(a->c_deadline > b->c_deadline)
-    return 1;
- return 0;
+  if(callout_heap_len == callout_heap_size) {
+    callout_heap_size = MAX(64, callout_heap_size * 2);
+    callout_heap = realloc(callout_heap,
+			   sizeof(callout_t *) * callout_heap_size);
+  }
+  callout_heap_set(callout_heap_len++, c);
+  callout_heap_up(c->c_heap_idx);
+}
+
+
+/**
+ *
+ */
+static void
+callout_heap_remove(callout_t *c)
+{
+  int i = c->c_heap_idx;
+  callout_t *last = callout_heap[--callout_heap_len];
+
+  if(last == c)
+    return;
+
+  callout_heap_set(i, last);
+  if(i > 0 && callout_heap[(i - 1) / 2]->c_deadline > last->c_deadline)
+    callout_heap_up(i);
+  else
+    callout_heap_down(i);
+}
+
+
+/**
+ * Unlink an armed callout from the heap or from the run queue
+ */
+static void
+callout_unlink(callout_t *c)
+{
+  if(c->c_queued) {
+    TAILQ_REMOVE(c->c_pooled ? &callout_poolq : &callout_runq, c, c_link);
+    c->c_queued = 0;
+  } else {
+    callout_heap_remove(c);
+  }
 }
 
 
@@ -46,21 +170,25 @@ calloutcmp(callout_t *a, callout_t *b)
  */
 static void
 callout_arm_abs(callout_t *d, callout_callback_t *callback, void *opaque,
-		uint64_t deadline)
+		uint64_t deadline, int pooled)
 {
   hts_mutex_lock(&callout_mutex);
 
-  if(d == NULL)
+  if(d == NULL) {
     d = malloc(sizeof(callout_t));
-  else if(d->c_callback != NULL)
-    LIST_REMOVE(d, c_link);
-    
+    d->c_queued = 0;
+  } else if(d->c_callback != NULL) {
+    callout_unlink(d);
+  }
+
   d->c_callback = callback;
   d->c_opaque = opaque;
   d->c_deadline = deadline;
+  d->c_pooled = pooled;
 
-  LIST_INSERT_SORTED(&callouts, d, c_link, calloutcmp);
-  hts_cond_signal(&callout_cond);
+  callout_heap_insert(d);
+  if(d->c_heap_idx == 0)
+    hts_cond_signal(&callout_cond);
   hts_mutex_unlock(&callout_mutex);
 }
 
@@ -72,7 +200,20 @@ callout_arm(callout_t *d, callout_callback_t *callback,
 	     void *opaque, int delta)
 {
   uint64_t deadline = showtime_get_ts() + delta * 1000000LL;
-  callout_arm_abs(d, callback, opaque, deadline);
+  callout_arm_abs(d, callback, opaque, deadline, 0);
+}
+
+
+/**
+ * As callout_arm() but the callback may run concurrently with
+ * other callouts
+ */
+void
+callout_arm_pooled(callout_t *d, callout_callback_t *callback,
+		   void *opaque, int delta)
+{
+  uint64_t deadline = showtime_get_ts() + delta * 1000000LL;
+  callout_arm_abs(d, callback, opaque, deadline, 1);
 }
 
 /**
@@ -83,7 +224,7 @@ callout_arm_hires(callout_t *d, callout_callback_t *callback,
 		  void *opaque, uint64_t delta)
 {
   uint64_t deadline = showtime_get_ts() + delta;
-  callout_arm_abs(d, callback, opaque, deadline);
+  callout_arm_abs(d, callback, opaque, deadline, 0);
 }
 
 /**
@@ -94,13 +235,72 @@ callout_disarm(callout_t *d)
 {
   hts_mutex_lock(&callout_mutex);
   if(d->c_callback) {
-    LIST_REMOVE(d, c_link);
+    callout_unlink(d);
     d->c_callback = NULL;
   }
   hts_mutex_unlock(&callout_mutex);
 }
 
 
+/**
+ *
+ */
+static int
+callout_is_running(const callout_t *c)
+{
+  int i;
+  for(i = 0; i < 1 + CALLOUT_WORKERS; i++)
+    if(callout_dispatchers[i].cd_running == c)
+      return 1;
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void *
+callout_worker(void *aux)
+{
+  callout_dispatcher_t *cd = aux;
+  callout_t *c;
+  callout_callback_t *cc;
+
+  hts_mutex_lock(&callout_mutex);
+
+  while(1) {
+    TAILQ_FOREACH(c, cd->cd_q, c_link)
+      if(!callout_is_running(c))
+	break;
+
+    if(c == NULL) {
+      hts_cond_wait(cd->cd_cond, &callout_mutex);
+      continue;
+    }
+
+    TAILQ_REMOVE(cd->cd_q, c, c_link);
+    c->c_queued = 0;
+    cc = c->c_callback;
+    c->c_callback = NULL;
+    cd->cd_running = c;
+    hts_mutex_unlock(&callout_mutex);
+
+    // 'c' may be freed by the callback, don't touch it afterwards
+    cc(c, c->c_opaque);
+
+    hts_mutex_lock(&callout_mutex);
+    cd->cd_running = NULL;
+
+    // Something may have been held back waiting for us
+    if(TAILQ_FIRST(&callout_runq) != NULL)
+      hts_cond_broadcast(&callout_runq_cond);
+    if(TAILQ_FIRST(&callout_poolq) != NULL)
+      hts_cond_broadcast(&callout_poolq_cond);
+  }
+  return NULL;
+}
+
+
 /**
  *
  */
@@ -109,7 +309,6 @@ callout_loop(void *aux)
 {
   uint64_t now;
   callout_t *c;
-  callout_callback_t *cc;
 
   hts_mutex_lock(&callout_mutex);
 
@@ -117,17 +316,20 @@ callout_loop(void *aux)
 
     now = showtime_get_ts();
   
-    while((c = LIST_FIRST(&callouts)) != NULL && c->c_deadline <= now) {
-      cc = c->c_callback;
-      LIST_REMOVE(c, c_link);
-      c->c_callback = NULL;
-      hts_mutex_unlock(&callout_mutex);
-      cc(c, c->c_opaque);
-      hts_mutex_lock(&callout_mutex);
+    while(callout_heap_len > 0 && (c = callout_heap[0])->c_deadline <= now) {
+      callout_heap_remove(c);
+      c->c_queued = 1;
+      if(c->c_pooled) {
+	TAILQ_INSERT_TAIL(&callout_poolq, c, c_link);
+	hts_cond_signal(&callout_poolq_cond);
+      } else {
+	TAILQ_INSERT_TAIL(&callout_runq, c, c_link);
+	hts_cond_signal(&callout_runq_cond);
+      }
     }
 
-    if((c = LIST_FIRST(&callouts)) != NULL) {
-
+    if(callout_heap_len > 0) {
+      c = callout_heap[0];
       int timeout = (c->c_deadline - now + 999) / 1000;
       hts_cond_wait_timeout(&callout_cond, &callout_mutex, timeout);
     } else {
@@ -175,10 +377,28 @@ void
 callout_init(void)
 {
   prop_t *clock;
+  int i;
 
   hts_mutex_init(&callout_mutex);
   hts_cond_init(&callout_cond, &callout_mutex);
 
+  TAILQ_INIT(&callout_runq);
+  TAILQ_INIT(&callout_poolq);
+  hts_cond_init(&callout_runq_cond, &callout_mutex);
+  hts_cond_init(&callout_poolq_cond, &callout_mutex);
+
+  callout_dispatchers[0].cd_q = &callout_runq;
+  callout_dispatchers[0].cd_cond = &callout_runq_cond;
+  hts_thread_create_detached("callout dispatch", callout_worker,
+			     &callout_dispatchers[0], THREAD_PRIO_LOW);
+
+  for(i = 1; i < 1 + CALLOUT_WORKERS; i++) {
+    callout_dispatchers[i].cd_q = &callout_poolq;
+    callout_dispatchers[i].cd_cond = &callout_poolq_cond;
+    hts_thread_create_detached("callout worker", callout_worker,
+			       &callout_dispatchers[i], THREAD_PRIO_LOW);
+  }
+
   hts_thread_create_detached("callout", callout_loop, NULL, THREAD_PRIO_LOW);
 
   clock = prop_create(prop_get_global(), "clock");
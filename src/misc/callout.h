@@ -26,10 +26,13 @@ struct callout;
 typedef void (callout_callback_t)(struct callout *c, void *opaque);
 
 typedef struct callout {
-  LIST_ENTRY(callout) c_link;
+  TAILQ_ENTRY(callout) c_link;  // On dispatch queue when expired
   callout_callback_t *c_callback;
   void *c_opaque;
   uint64_t c_deadline;
+  int c_heap_idx;               // Index in timer heap when armed
+  int c_queued;                 // Expired and waiting for dispatch
+  int c_pooled;                 // Dispatched on the worker pool
 } callout_t;
 
 void callout_arm(callout_t *c, callout_callback_t *callback,
@@ -38,6 +41,9 @@ void callout_arm(callout_t *c, callout_callback_t *callback,
 void callout_arm_hires(callout_t *d, callout_callback_t *callback,
 		       void *opaque, uint64_t delta);
 
+void callout_arm_pooled(callout_t *c, callout_callback_t *callback,
+			void *opaque, int delta);
+
 void callout_disarm(callout_t *c);
 
 void callout_init(void);
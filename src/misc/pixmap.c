@@ -27,6 +27,7 @@
 #include "showtime.h"
 #include "arch/atomic.h"
 #include "pixmap.h"
+#include "blobcache.h"
 
 /**
  *
@@ -83,7 +84,7 @@ pixmap_dup(pixmap_t *pm)
 pixmap_t *
 pixmap_alloc_coded(const void *data, size_t size, pixmap_type_t type)
 {
-  int pad = 32;
+  int pad = PIXMAP_CODED_PAD;
   pixmap_t *pm = calloc(1, sizeof(pixmap_t));
   pm->pm_refcount = 1;
   pm->pm_size = size;
@@ -106,6 +107,27 @@ pixmap_alloc_coded(const void *data, size_t size, pixmap_type_t type)
 }
 
 
+/**
+ * Wrap a blob without copying it. Coded data is only read by the
+ * decoders so this is safe as long as the blob has enough padding
+ */
+pixmap_t *
+pixmap_alloc_coded_blob(blob_t *b, pixmap_type_t type)
+{
+  pixmap_t *pm = calloc(1, sizeof(pixmap_t));
+  pm->pm_refcount = 1;
+  pm->pm_size = b->b_size;
+
+  pm->pm_width = -1;
+  pm->pm_height = -1;
+
+  pm->pm_data = (void *)b->b_data;
+  pm->pm_blob = blob_dup(b);
+  pm->pm_type = type;
+  return pm;
+}
+
+
 /**
  *
  */
@@ -149,6 +171,8 @@ pixmap_release(pixmap_t *pm)
   if(!pixmap_is_coded(pm)) {
     free(pm->pm_pixels);
     free(pm->pm_charpos);
+  } else if(pm->pm_blob != NULL) {
+    blob_release(pm->pm_blob);
   } else {
     free(pm->pm_data);
   }
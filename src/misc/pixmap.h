@@ -90,6 +90,7 @@ typedef struct pixmap {
     struct {
       void *data;
       size_t size;
+      struct blob *blob; // If set, data points into (read only) blob
     } codec;
   };
 
@@ -97,15 +98,21 @@ typedef struct pixmap {
 
 #define pm_data codec.data
 #define pm_size codec.size
+#define pm_blob codec.blob
 
 #define pm_pixels     raw.pixels
 #define pm_linesize   raw.linesize
 #define pm_charpos    raw.charpos
 #define pm_charposlen raw.charposlen
 
+#define PIXMAP_CODED_PAD 32 // Zeroed padding required after coded data
+
 pixmap_t *pixmap_alloc_coded(const void *data, size_t size,
 			     pixmap_type_t type);
 
+struct blob;
+pixmap_t *pixmap_alloc_coded_blob(struct blob *b, pixmap_type_t type);
+
 pixmap_t *pixmap_dup(pixmap_t *pm);
 
 void pixmap_release(pixmap_t *pm);
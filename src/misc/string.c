@@ -813,6 +813,28 @@ dictcmp(const char *a, const char *b)
 }
 
 
+/**
+ * Return a malloc()ed case folded copy of 'src'
+ */
+char *
+utf8_casefold(const char *src)
+{
+  const char *s = src;
+  size_t len = 0;
+  char *r, *d;
+  int c;
+
+  while((c = utf8_get(&s)) != 0)
+    len += utf8_put(NULL, unicode_casefold(c));
+
+  d = r = malloc(len + 1);
+  s = src;
+  while((c = utf8_get(&s)) != 0)
+    d += utf8_put(d, unicode_casefold(c));
+  *d = 0;
+  return r;
+}
+
 /**
  *
  */
@@ -37,6 +37,8 @@ int utf8_put(char *out, int c);
 
 const char *mystrstr(const char *haystack, const char *needle);
 
+char *utf8_casefold(const char *src);
+
 void strvec_addp(char ***str, const char *v);
 
 void strvec_addpn(char ***str, const char *v, size_t len);
@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #include <netinet/in.h>
 
@@ -36,9 +37,24 @@
 #include "http.h"
 #include "http_server.h"
 
+#if ENABLE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#if ENABLE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 int http_server_port;
 static LIST_HEAD(, http_path) http_paths;
 LIST_HEAD(http_connection_list, http_connection); 
+TAILQ_HEAD(http_connection_queue, http_connection);
+
+/**
+ * Request handlers are run on this many worker threads. The event
+ * loop thread only does socket I/O
+ */
+#define HTTP_SERVER_WORKERS 4
 
 /**
  *
@@ -46,9 +62,18 @@ LIST_HEAD(http_connection_list, http_connection);
 struct http_connection {
   
   LIST_ENTRY(http_connection) hc_link;
+  TAILQ_ENTRY(http_connection) hc_work_link;
   int hc_fd;
   int hc_events;
 
+  char hc_busy;  // Handed over to a worker, event loop must not touch
+  char hc_close; // Set by worker if connection should be closed
+  char hc_deferred; // Input arrived while sending a file
+
+  int hc_file_fd; // File being sent after hc_output, -1 if none
+  int64_t hc_file_offset;
+  int64_t hc_file_remain;
+
   int hc_state;
 #define HCS_COMMAND 0
 #define HCS_HEADERS 1
@@ -124,11 +149,26 @@ typedef struct http_server {
   int hs_numcon;
   int hs_fd;
 
+#if ENABLE_EPOLL
+  int hs_epfd;
+#else
   int hs_fds_size;
   struct pollfd *hs_fds;
+  http_connection_t **hs_fdcons;
+#endif
 
   struct http_connection_list hs_connections;
 
+  /**
+   * Connections go from the event loop to the workers via hs_work
+   * and come back on hs_done. Workers wake the loop via hs_pipe
+   */
+  hts_mutex_t hs_mutex;
+  hts_cond_t hs_cond;
+  struct http_connection_queue hs_work;
+  struct http_connection_queue hs_done;
+  int hs_pipe[2];
+
 } http_server_t;
 
 
@@ -369,6 +409,36 @@ http_send_reply(http_connection_t *hc, int rc, const char *content,
 }
 
 
+/**
+ * Transmit a HTTP reply with the contents of a file. The file is sent
+ * straight from the page cache (sendfile) where possible. Takes
+ * ownership of 'fd'
+ */
+int
+http_send_file(http_connection_t *hc, int rc, const char *content, int fd)
+{
+  struct stat st;
+
+  if(fstat(fd, &st)) {
+    close(fd);
+    return http_error(hc, 500, "Unable to stat file");
+  }
+
+  http_send_header(hc, rc ?: 200, content, st.st_size, NULL, NULL, 0, 0);
+
+  if(hc->hc_no_output || st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+
+  assert(hc->hc_file_fd == -1);
+  hc->hc_file_fd = fd;
+  hc->hc_file_offset = 0;
+  hc->hc_file_remain = st.st_size;
+  return 0;
+}
+
+
 /**
  * Send HTTP error back
  */
@@ -854,6 +924,12 @@ http_handle_input(http_connection_t *hc)
 	if(TAILQ_FIRST(&hc->hc_output.hq_q) == NULL && !hc->hc_keep_alive)
 	  return 1;
 
+	if(hc->hc_file_fd != -1) {
+	  // Rest of input is handled once the file is sent
+	  hc->hc_deferred = 1;
+	  return 0;
+	}
+
       } else {
 
 	if((c = strchr(buf, ':')) == NULL)
@@ -873,6 +949,43 @@ http_handle_input(http_connection_t *hc)
 }
 
 
+/**
+ *
+ */
+static int
+http_write_file(http_connection_t *hc)
+{
+  while(hc->hc_file_remain > 0) {
+    size_t l = MIN(hc->hc_file_remain, 1024 * 1024);
+    ssize_t r;
+
+#if ENABLE_SENDFILE
+    off_t off = hc->hc_file_offset;
+    r = sendfile(hc->hc_fd, hc->hc_file_fd, &off, l);
+#else
+    char buf[16384];
+    l = MIN(l, sizeof(buf));
+    r = pread(hc->hc_file_fd, buf, l, hc->hc_file_offset);
+    if(r > 0)
+      r = write(hc->hc_fd, buf, r);
+#endif
+
+    if(r == -1 && (errno == EWOULDBLOCK || errno == EAGAIN))
+      return 0;
+
+    if(r <= 0)
+      return -1;
+
+    hc->hc_file_offset += r;
+    hc->hc_file_remain -= r;
+  }
+
+  close(hc->hc_file_fd);
+  hc->hc_file_fd = -1;
+  return 0;
+}
+
+
 /**
  *
  */
@@ -908,36 +1021,136 @@ http_write(http_connection_t *hc)
     free(hd->hd_data);
     free(hd);
   }
+
+  if(hc->hc_file_fd != -1) {
+    if(http_write_file(hc))
+      return -1;
+    if(hc->hc_file_fd != -1) {
+      hc->hc_events |= POLLOUT;
+      return 0;
+    }
+  }
+
   hc->hc_events &= ~POLLOUT;
   return !hc->hc_keep_alive;
 }
 
 
+/**
+ * Update what the event loop waits for on a connection
+ */
+static void
+http_update_events(http_server_t *hs, http_connection_t *hc, int op)
+{
+#if ENABLE_EPOLL
+  struct epoll_event e = {0};
+  e.data.ptr = hc;
+  if(hc->hc_events & POLLIN)
+    e.events |= EPOLLIN;
+  if(hc->hc_events & POLLOUT)
+    e.events |= EPOLLOUT;
+  epoll_ctl(hs->hs_epfd, op, hc->hc_fd, &e);
+#endif
+}
+
+#if !ENABLE_EPOLL
+#define EPOLL_CTL_ADD 0
+#define EPOLL_CTL_DEL 0
+#define EPOLL_CTL_MOD 0
+#endif
+
+
+/**
+ * Pass a connection with pending input to the worker pool. We don't
+ * do that while a file is still being sent since the next response
+ * must not get ahead of it
+ */
+static void
+http_dispatch(http_server_t *hs, http_connection_t *hc)
+{
+  if(hc->hc_file_fd != -1) {
+    hc->hc_deferred = 1;
+    return;
+  }
+
+  hc->hc_deferred = 0;
+  hc->hc_busy = 1;
+
+  hts_mutex_lock(&hs->hs_mutex);
+  TAILQ_INSERT_TAIL(&hs->hs_work, hc, hc_work_link);
+  hts_cond_signal(&hs->hs_cond);
+  hts_mutex_unlock(&hs->hs_mutex);
+}
+
+
+/**
+ *
+ */
+static void *
+http_worker(void *aux)
+{
+  http_server_t *hs = aux;
+  http_connection_t *hc;
+  char c = 0;
+
+  hts_mutex_lock(&hs->hs_mutex);
+  while(1) {
+    if((hc = TAILQ_FIRST(&hs->hs_work)) == NULL) {
+      hts_cond_wait(&hs->hs_cond, &hs->hs_mutex);
+      continue;
+    }
+    TAILQ_REMOVE(&hs->hs_work, hc, hc_work_link);
+    hts_mutex_unlock(&hs->hs_mutex);
+
+    hc->hc_close = http_handle_input(hc);
+
+    hts_mutex_lock(&hs->hs_mutex);
+    TAILQ_INSERT_TAIL(&hs->hs_done, hc, hc_work_link);
+    if(write(hs->hs_pipe[1], &c, 1) != 1) {
+      // Pipe full, loop is already about to wake up
+    }
+  }
+  return NULL;
+}
+
+
 /**
  *
  */
 static int
-http_io(http_connection_t *hc, int revents)
+http_io(http_server_t *hs, http_connection_t *hc, int revents)
 {
   int r;
   if(revents & (POLLHUP | POLLERR))
     return 1;
 
   if(revents & POLLIN) {
-    char *mem = malloc(1000);
+    char *mem = malloc(4096);
     
-    r = read(hc->hc_fd, mem, 1000);
+    r = read(hc->hc_fd, mem, 4096);
     if(r > 0) {
       htsbuf_append_prealloc(&hc->hc_input, mem, r);
-      if(http_handle_input(hc))
-	return 1;
+      http_dispatch(hs, hc);
+      if(hc->hc_busy) {
+	http_update_events(hs, hc, EPOLL_CTL_DEL);
+	return 0;
+      }
     } else {
       free(mem);
       return 1;
     }
   }
-  r = http_write(hc);
-  return r;
+  int events = hc->hc_events;
+  if((r = http_write(hc)) != 0)
+    return r;
+
+  if(hc->hc_deferred && hc->hc_file_fd == -1) {
+    http_dispatch(hs, hc);
+    http_update_events(hs, hc, EPOLL_CTL_DEL);
+  } else if(events != hc->hc_events) {
+    http_update_events(hs, hc, EPOLL_CTL_MOD);
+  }
+  return 0;
 }
 
 
@@ -948,6 +1161,8 @@ static void
 http_close(http_server_t *hs, http_connection_t *hc)
 {
   hsprintf("%p: ----------------- CLOSED CONNECTION\n", hc);
+  if(!hc->hc_busy)
+    http_update_events(hs, hc, EPOLL_CTL_DEL);
   htsbuf_queue_flush(&hc->hc_input);
   htsbuf_queue_flush(&hc->hc_output);
   http_headers_free(&hc->hc_req_args);
@@ -956,6 +1171,8 @@ http_close(http_server_t *hs, http_connection_t *hc)
   LIST_REMOVE(hc, hc_link);
   hs->hs_numcon--;
   close(hc->hc_fd);
+  if(hc->hc_file_fd != -1)
+    close(hc->hc_file_fd);
   free(hc->hc_url);
   free(hc->hc_url_orig);
   free(hc->hc_post_data);
@@ -963,6 +1180,40 @@ http_close(http_server_t *hs, http_connection_t *hc)
 }
 
 
+/**
+ * Take back connections the workers are done with
+ */
+static void
+http_reap_workers(http_server_t *hs)
+{
+  http_connection_t *hc;
+  char buf[64];
+
+  while(read(hs->hs_pipe[0], buf, sizeof(buf)) > 0) {}
+
+  while(1) {
+    hts_mutex_lock(&hs->hs_mutex);
+    if((hc = TAILQ_FIRST(&hs->hs_done)) != NULL)
+      TAILQ_REMOVE(&hs->hs_done, hc, hc_work_link);
+    hts_mutex_unlock(&hs->hs_mutex);
+    if(hc == NULL)
+      break;
+
+    hc->hc_busy = 0;
+
+    if(hc->hc_close || http_write(hc)) {
+      http_close(hs, hc);
+      continue;
+    }
+
+    if(hc->hc_deferred && hc->hc_file_fd == -1)
+      http_dispatch(hs, hc);
+    else
+      http_update_events(hs, hc, EPOLL_CTL_ADD);
+  }
+}
+
+
 /**
  *
  */
@@ -1002,6 +1253,7 @@ http_accept(http_server_t *hs)
 
   hc = calloc(1, sizeof(http_connection_t));
   hc->hc_fd = fd;
+  hc->hc_file_fd = -1;
   hc->hc_events = POLLIN | POLLHUP | POLLERR;
   LIST_INSERT_HEAD(&hs->hs_connections, hc, hc_link);
   hs->hs_numcon++;
@@ -1045,58 +1297,119 @@ http_accept(http_server_t *hs)
   } else {
     hc->hc_myaddr[0] = 0;
   }
+  http_update_events(hs, hc, EPOLL_CTL_ADD);
   hsprintf("%p: ----------------- NEW CONNECTION\n", hc);
 }
 
 
+#if ENABLE_EPOLL
+
 /**
- *
+ * epoll(7) event loop. The listen socket and the wakeup pipe are
+ * tagged with the server itself and the pipe fd resp. in data.ptr
  */
 static void *
 http_server(void *aux)
 {
   http_server_t *hs = aux;
-  int n, r;
-  http_connection_t *hc, *nxt;
+  struct epoll_event ev[64];
+  http_connection_t *hc;
+  int i, n, revents;
 
   while(1) {
-    n = hs->hs_numcon + 1;
+    n = epoll_wait(hs->hs_epfd, ev, 64, -1);
+
+    if(n == -1)
+      continue;
+
+    for(i = 0; i < n; i++) {
+      if(ev[i].data.ptr == hs) {
+	http_accept(hs);
+	continue;
+      }
+      if(ev[i].data.ptr == &hs->hs_pipe) {
+	http_reap_workers(hs);
+	continue;
+      }
+
+      hc = ev[i].data.ptr;
+      revents = 0;
+      if(ev[i].events & EPOLLIN)
+	revents |= POLLIN;
+      if(ev[i].events & EPOLLOUT)
+	revents |= POLLOUT;
+      if(ev[i].events & EPOLLHUP)
+	revents |= POLLHUP;
+      if(ev[i].events & EPOLLERR)
+	revents |= POLLERR;
+
+      if(http_io(hs, hc, revents))
+	http_close(hs, hc);
+    }
+  }
+  return NULL;
+}
+
+#else
+
+/**
+ * poll(2) event loop. Connections currently owned by a worker are
+ * left out of the set
+ */
+static void *
+http_server(void *aux)
+{
+  http_server_t *hs = aux;
+  int i, n, r;
+  http_connection_t *hc;
+
+  while(1) {
+    n = hs->hs_numcon + 2;
 
     if(hs->hs_fds_size < n) {
       hs->hs_fds_size = n + 3;
       hs->hs_fds = realloc(hs->hs_fds, sizeof(struct pollfd) * hs->hs_fds_size);
+      hs->hs_fdcons = realloc(hs->hs_fdcons,
+			      sizeof(http_connection_t *) * hs->hs_fds_size);
     }
 
     n = 0;
     LIST_FOREACH(hc, &hs->hs_connections, hc_link) {
+      if(hc->hc_busy)
+	continue;
       hs->hs_fds[n].fd = hc->hc_fd;
       hs->hs_fds[n].events = hc->hc_events;
+      hs->hs_fdcons[n] = hc;
       n++;
     }
 
     hs->hs_fds[n].fd = hs->hs_fd;
     hs->hs_fds[n].events = POLLIN;
     n++;
+    hs->hs_fds[n].fd = hs->hs_pipe[0];
+    hs->hs_fds[n].events = POLLIN;
+    n++;
     r = poll(hs->hs_fds, n, -1);
 
     if(r == -1)
       continue;
 
-    n = 0;
-    for(hc = LIST_FIRST(&hs->hs_connections); hc != NULL; hc = nxt) {
-      nxt = LIST_NEXT(hc, hc_link);
+    n -= 2;
+    for(i = 0; i < n; i++)
+      if(http_io(hs, hs->hs_fdcons[i], hs->hs_fds[i].revents))
+	http_close(hs, hs->hs_fdcons[i]);
 
-      if(http_io(hc, hs->hs_fds[n].revents)) {
-	http_close(hs, hc);
-      }
-      n++;
-    }
     if(hs->hs_fds[n].revents & POLLIN)
       http_accept(hs);
+
+    if(hs->hs_fds[n + 1].revents & POLLIN)
+      http_reap_workers(hs);
   }
   return NULL;
 }
 
+#endif
+
 
 /**
  *
@@ -1142,10 +1455,41 @@ http_server_init(void)
 
   TRACE(TRACE_INFO, "HTTPSRV", "Listening on port %d", http_server_port);
 
-  listen(fd, 1);
+  listen(fd, 16);
     
   hs = calloc(1, sizeof(http_server_t));
   hs->hs_fd = fd;  
+
+  if(pipe(hs->hs_pipe)) {
+    TRACE(TRACE_ERROR, "HTTPSRV", "Unable to create pipe");
+    close(fd);
+    free(hs);
+    return;
+  }
+  fcntl(hs->hs_pipe[0], F_SETFL, fcntl(hs->hs_pipe[0], F_GETFL) | O_NONBLOCK);
+  fcntl(hs->hs_pipe[1], F_SETFL, fcntl(hs->hs_pipe[1], F_GETFL) | O_NONBLOCK);
+
+#if ENABLE_EPOLL
+  struct epoll_event e = {0};
+  hs->hs_epfd = epoll_create(64);
+
+  e.events = EPOLLIN;
+  e.data.ptr = hs;
+  epoll_ctl(hs->hs_epfd, EPOLL_CTL_ADD, fd, &e);
+
+  e.data.ptr = &hs->hs_pipe;
+  epoll_ctl(hs->hs_epfd, EPOLL_CTL_ADD, hs->hs_pipe[0], &e);
+#endif
+
+  hts_mutex_init(&hs->hs_mutex);
+  hts_cond_init(&hs->hs_cond, &hs->hs_mutex);
+  TAILQ_INIT(&hs->hs_work);
+  TAILQ_INIT(&hs->hs_done);
+
+  for(i = 0; i < HTTP_SERVER_WORKERS; i++)
+    hts_thread_create_detached("httpworker", http_worker, hs,
+			       THREAD_PRIO_NORMAL);
+
   hts_thread_create_detached("httpsrv", http_server, hs,
 			     THREAD_PRIO_NORMAL);
 }
@@ -39,6 +39,8 @@ int http_send_reply(http_connection_t *hc, int rc, const char *content,
 		    const char *encoding, const char *location, int maxage,
 		    htsbuf_queue_t *output);
 
+int http_send_file(http_connection_t *hc, int rc, const char *content, int fd);
+
 int http_send_raw(http_connection_t *hc, int rc, const char *rctxt,
 		  struct http_header_list *headers, htsbuf_queue_t *output);
 
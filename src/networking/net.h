@@ -79,6 +79,8 @@ void tcp_close(tcpcon_t *nc);
 
 void tcp_huge_buffer(tcpcon_t *tc);
 
+void tcp_set_read_buffer(tcpcon_t *tc, int size);
+
 void tcp_shutdown(tcpcon_t *tc);
 
 
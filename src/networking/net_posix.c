@@ -497,6 +497,17 @@ tcp_huge_buffer(tcpcon_t *tc)
     TRACE(TRACE_ERROR, "TCP", "Unable to increase RCVBUF");
 }
 
+
+/**
+ *
+ */
+void
+tcp_set_read_buffer(tcpcon_t *tc, int size)
+{
+  if(setsockopt(tc->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == -1)
+    TRACE(TRACE_ERROR, "TCP", "Unable to set RCVBUF to %d", size);
+}
+
 /**
  *
  */
@@ -352,6 +352,18 @@ tcp_huge_buffer(tcpcon_t *tc)
 }
 
 
+/**
+ *
+ */
+void
+tcp_set_read_buffer(tcpcon_t *tc, int size)
+{
+  int r = netSetSockOpt(tc->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  if(r < 0)
+    TRACE(TRACE_ERROR, "TCP", "Unable to set RCVBUF to %d", size);
+}
+
+
 
 /**
  *
@@ -119,6 +119,7 @@ void prop_init(void);
 #define PROP_SUB_DONTLOCK             0x100
 #define PROP_SUB_IGNORE_VOID          0x200
 #define PROP_SUB_AUTO_DESTROY         0x400
+#define PROP_SUB_COALESCE             0x800 // Only deliver latest value
 
 enum {
   PROP_TAG_END = 0,
@@ -397,6 +398,8 @@ void prop_print_tree(prop_t *p, int followlinks);
 
 void prop_test(void);
 
+void prop_bench(int scale);
+
 #ifdef PROP_DEBUG
 extern int prop_trace;
 #endif
@@ -0,0 +1,575 @@
+/*
+ *  Property tree benchmark
+ *  Copyright (C) 2012 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "showtime.h"
+#include "prop.h"
+#include "prop_nodefilter.h"
+#include "prop_grouper.h"
+
+#define BENCH_WRITERS   4
+#define BENCH_SUBS      8
+#define BENCH_DEPTH     16
+#define BENCH_VECSIZE   10000
+
+/**
+ * Latency samples for one benchmark (or one writer thread)
+ */
+typedef struct bench {
+  const char *b_name;
+  int64_t *b_samples;  // Nanoseconds per operation
+  int b_num;
+  int b_size;
+  int64_t b_start;
+  int64_t b_stop;
+} bench_t;
+
+
+/**
+ *
+ */
+static int64_t
+bench_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/**
+ *
+ */
+static void
+bench_init(bench_t *b, const char *name, int size)
+{
+  b->b_name = name;
+  b->b_samples = malloc(size * sizeof(int64_t));
+  b->b_num = 0;
+  b->b_size = size;
+  b->b_start = bench_ns();
+}
+
+
+/**
+ *
+ */
+static void
+bench_sample(bench_t *b, int64_t t0)
+{
+  int64_t now = bench_ns();
+  if(b->b_num < b->b_size)
+    b->b_samples[b->b_num++] = now - t0;
+  b->b_stop = now;
+}
+
+
+/**
+ *
+ */
+static int
+int64_cmp(const void *A, const void *B)
+{
+  const int64_t *a = A, *b = B;
+  return *a < *b ? -1 : *a > *b;
+}
+
+
+/**
+ *
+ */
+static int64_t
+bench_pct(const bench_t *b, int permille)
+{
+  int i = (int64_t)(b->b_num - 1) * permille / 1000;
+  return b->b_num ? b->b_samples[i] : 0;
+}
+
+
+/**
+ * Print ops/sec and latency percentiles. Merges 'nb' benches
+ * (one per thread) into the first one. For multithreaded runs ops/sec
+ * is based on wall clock time
+ */
+static void
+bench_report(bench_t *b, int nb)
+{
+  int i, total = b->b_num;
+  int64_t start = b->b_start, stop = b->b_stop;
+
+  for(i = 1; i < nb; i++) {
+    total += b[i].b_num;
+    start = MIN(start, b[i].b_start);
+    stop  = MAX(stop,  b[i].b_stop);
+  }
+
+  if(nb > 1) {
+    b->b_samples = realloc(b->b_samples, total * sizeof(int64_t));
+    for(i = 1; i < nb; i++) {
+      memcpy(b->b_samples + b->b_num, b[i].b_samples,
+	     b[i].b_num * sizeof(int64_t));
+      b->b_num += b[i].b_num;
+      free(b[i].b_samples);
+    }
+  }
+
+  qsort(b->b_samples, b->b_num, sizeof(int64_t), int64_cmp);
+
+  if(nb == 1) {
+    /* Single threaded, only count time spent in the measured operation */
+    stop = start;
+    for(i = 0; i < b->b_num; i++)
+      stop += b->b_samples[i];
+  }
+
+  printf("%-28s %9d ops %12.1f ops/s  "
+	 "p50 %7"PRId64"ns  p99 %8"PRId64"ns  p99.9 %9"PRId64"ns  "
+	 "max %10"PRId64"ns\n",
+	 b->b_name, b->b_num,
+	 stop > start ? b->b_num * 1e9 / (stop - start) : 0.0,
+	 bench_pct(b, 500), bench_pct(b, 990), bench_pct(b, 999),
+	 b->b_num ? b->b_samples[b->b_num - 1] : 0);
+
+  free(b->b_samples);
+}
+
+
+/**
+ *
+ */
+static void
+bench_nop_cb(void *opaque, prop_event_t event, ...)
+{
+}
+
+
+/**
+ * Create named childs in one directory
+ */
+static void
+bench_create(int n)
+{
+  bench_t b;
+  prop_t *root = prop_create_root(NULL);
+  char name[32];
+  int i;
+
+  bench_init(&b, "prop_create", n);
+  for(i = 0; i < n; i++) {
+    snprintf(name, sizeof(name), "n%d", i);
+    int64_t t0 = bench_ns();
+    prop_create(root, name);
+    bench_sample(&b, t0);
+  }
+  bench_report(&b, 1);
+
+  bench_init(&b, "prop_create (existing)", n);
+  for(i = 0; i < n; i++) {
+    snprintf(name, sizeof(name), "n%d", rand() % n);
+    int64_t t0 = bench_ns();
+    prop_create(root, name);
+    bench_sample(&b, t0);
+  }
+  bench_report(&b, 1);
+
+  prop_destroy(root);
+}
+
+
+/**
+ * prop_set_* on a prop with a number of courier subscribers
+ */
+static void
+bench_set(int n, prop_courier_t *pc)
+{
+  bench_t b;
+  prop_t *p = prop_create_root(NULL);
+  prop_sub_t *subs[BENCH_SUBS];
+  int i;
+
+  for(i = 0; i < BENCH_SUBS; i++)
+    subs[i] = prop_subscribe(0,
+			     PROP_TAG_CALLBACK, bench_nop_cb, NULL,
+			     PROP_TAG_COURIER, pc,
+			     PROP_TAG_ROOT, p,
+			     NULL);
+
+  bench_init(&b, "prop_set_int", n);
+  for(i = 0; i < n; i++) {
+    int64_t t0 = bench_ns();
+    prop_set_int(p, i);
+    bench_sample(&b, t0);
+    if((i & 1023) == 0)
+      prop_courier_poll(pc);
+  }
+  prop_courier_poll(pc);
+  bench_report(&b, 1);
+
+  bench_init(&b, "prop_set_float", n);
+  for(i = 0; i < n; i++) {
+    int64_t t0 = bench_ns();
+    prop_set_float(p, i * 0.5);
+    bench_sample(&b, t0);
+    if((i & 1023) == 0)
+      prop_courier_poll(pc);
+  }
+  prop_courier_poll(pc);
+  bench_report(&b, 1);
+
+  bench_init(&b, "prop_set_stringf", n);
+  for(i = 0; i < n; i++) {
+    int64_t t0 = bench_ns();
+    prop_set_stringf(p, "%d", i);
+    bench_sample(&b, t0);
+    if((i & 1023) == 0)
+      prop_courier_poll(pc);
+  }
+  prop_courier_poll(pc);
+  bench_report(&b, 1);
+
+  for(i = 0; i < BENCH_SUBS; i++)
+    prop_unsubscribe(subs[i]);
+  prop_destroy(p);
+  prop_courier_poll(pc);
+}
+
+
+/**
+ * Link and unlink a subscribed subtree
+ */
+static void
+bench_link(int n, prop_courier_t *pc)
+{
+  bench_t b;
+  prop_t *src1 = prop_create_root(NULL);
+  prop_t *src2 = prop_create_root(NULL);
+  prop_t *dst  = prop_create_root(NULL);
+  prop_sub_t *s;
+  int i;
+
+  for(i = 0; i < 16; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "c%d", i);
+    prop_set_int(prop_create(src1, name), i);
+    prop_set_int(prop_create(src2, name), -i);
+  }
+
+  s = prop_subscribe(0,
+		     PROP_TAG_NAME("self", "c3"),
+		     PROP_TAG_CALLBACK, bench_nop_cb, NULL,
+		     PROP_TAG_COURIER, pc,
+		     PROP_TAG_NAMED_ROOT, dst, "self",
+		     NULL);
+
+  bench_init(&b, "prop_link", n);
+  for(i = 0; i < n; i++) {
+    int64_t t0 = bench_ns();
+    prop_link(i & 1 ? src1 : src2, dst);
+    bench_sample(&b, t0);
+    if((i & 255) == 0)
+      prop_courier_poll(pc);
+  }
+  prop_courier_poll(pc);
+  bench_report(&b, 1);
+
+  prop_unsubscribe(s);
+  prop_destroy(dst);
+  prop_destroy(src1);
+  prop_destroy(src2);
+  prop_courier_poll(pc);
+}
+
+
+/**
+ * Subscribe / unsubscribe on a deep path
+ */
+static void
+bench_subscribe(int n, prop_courier_t *pc)
+{
+  bench_t b;
+  prop_t *root = prop_create_root(NULL);
+  const char *path[BENCH_DEPTH + 2];
+  char names[BENCH_DEPTH][8];
+  prop_sub_t *s;
+  int i;
+
+  path[0] = "self";
+  for(i = 0; i < BENCH_DEPTH; i++) {
+    snprintf(names[i], sizeof(names[i]), "d%d", i);
+    path[i + 1] = names[i];
+  }
+  path[BENCH_DEPTH + 1] = NULL;
+
+  bench_init(&b, "prop_subscribe (deep)", n);
+  for(i = 0; i < n; i++) {
+    int64_t t0 = bench_ns();
+    s = prop_subscribe(0,
+		       PROP_TAG_NAME_VECTOR, path,
+		       PROP_TAG_CALLBACK, bench_nop_cb, NULL,
+		       PROP_TAG_COURIER, pc,
+		       PROP_TAG_NAMED_ROOT, root, "self",
+		       NULL);
+    prop_unsubscribe(s);
+    bench_sample(&b, t0);
+    if((i & 1023) == 0)
+      prop_courier_poll(pc);
+  }
+  prop_courier_poll(pc);
+  bench_report(&b, 1);
+
+  prop_destroy(root);
+  prop_courier_poll(pc);
+}
+
+
+/**
+ *
+ */
+static prop_vec_t *
+bench_make_nodes(int n)
+{
+  prop_vec_t *pv = prop_vec_create(n);
+  char name[16];
+  int i;
+
+  for(i = 0; i < n; i++) {
+    snprintf(name, sizeof(name), "%d", i);
+    prop_t *p = prop_create_root(name);
+    prop_set_stringf(prop_create(p, "title"), "%08x", rand());
+    prop_set_stringf(prop_create(p, "group"), "%c", 'A' + rand() % 26);
+    pv = prop_vec_append(pv, p);
+  }
+  return pv;
+}
+
+
+/**
+ * prop_set_parent_vector with large vectors into a subscribed directory
+ */
+static void
+bench_vector(int rounds, prop_courier_t *pc)
+{
+  bench_t b;
+  prop_t *dir = prop_create_root(NULL);
+  prop_sub_t *s;
+  int i;
+
+  s = prop_subscribe(0,
+		     PROP_TAG_CALLBACK, bench_nop_cb, NULL,
+		     PROP_TAG_COURIER, pc,
+		     PROP_TAG_ROOT, dir,
+		     NULL);
+
+  bench_init(&b, "prop_set_parent_vector", rounds);
+  for(i = 0; i < rounds; i++) {
+    prop_vec_t *pv = bench_make_nodes(BENCH_VECSIZE);
+    int64_t t0 = bench_ns();
+    prop_set_parent_vector(pv, dir, NULL, NULL);
+    bench_sample(&b, t0);
+    prop_vec_release(pv);
+    prop_courier_poll(pc);
+    prop_destroy_childs(dir);
+    prop_courier_poll(pc);
+  }
+  bench_report(&b, 1);
+
+  prop_unsubscribe(s);
+  prop_destroy(dir);
+  prop_courier_poll(pc);
+}
+
+
+/**
+ *
+ */
+typedef struct bench_writer {
+  bench_t bw_bench;
+  prop_t *bw_nodes;
+  int bw_ops;
+  int bw_seed;
+} bench_writer_t;
+
+
+/**
+ * Update sort keys of random nodes in a nodefilter'ed directory
+ */
+static void *
+bench_writer_thread(void *aux)
+{
+  bench_writer_t *bw = aux;
+  unsigned int seed = bw->bw_seed;
+  int i;
+
+  for(i = 0; i < bw->bw_ops; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "%d", rand_r(&seed) % BENCH_VECSIZE);
+    int64_t t0 = bench_ns();
+    prop_t *p = prop_find(bw->bw_nodes, name, "title", NULL);
+    if(p != NULL) {
+      prop_set_stringf(p, "%08x", rand_r(&seed));
+      prop_ref_dec(p);
+    }
+    bench_sample(&bw->bw_bench, t0);
+  }
+  return NULL;
+}
+
+
+/**
+ * Multiple writers updating sort keys concurrently
+ */
+static void
+bench_resort(int ops, prop_courier_t *pc)
+{
+  bench_writer_t bw[BENCH_WRITERS];
+  hts_thread_t tids[BENCH_WRITERS];
+  bench_t b[BENCH_WRITERS];
+  prop_t *src = prop_create_root(NULL);
+  prop_t *sorted = prop_create_root(NULL);
+  prop_t *grouped = prop_create_root(NULL);
+  struct prop_nf *nf;
+  prop_grouper_t *pg;
+  int i;
+
+  bench_t populate;
+
+  nf = prop_nf_create(sorted, src, NULL, "node.title", 0);
+  pg = prop_grouper_create(grouped, src, "node.group", 0);
+
+  bench_init(&populate, "nodefilter+grouper populate", 1);
+  prop_vec_t *pv = bench_make_nodes(BENCH_VECSIZE);
+  int64_t t0 = bench_ns();
+  prop_set_parent_vector(pv, src, NULL, NULL);
+  bench_sample(&populate, t0);
+  prop_vec_release(pv);
+  bench_report(&populate, 1);
+
+  for(i = 0; i < BENCH_WRITERS; i++) {
+    bw[i].bw_nodes = src;
+    bw[i].bw_ops = ops;
+    bw[i].bw_seed = i + 1;
+    bench_init(&bw[i].bw_bench, "nodefilter resort (MT)", ops);
+    hts_thread_create_joinable("propbench", &tids[i], bench_writer_thread,
+			       &bw[i], THREAD_PRIO_LOW);
+  }
+
+  for(i = 0; i < BENCH_WRITERS; i++) {
+    hts_thread_join(&tids[i]);
+    b[i] = bw[i].bw_bench;
+  }
+  bench_report(b, BENCH_WRITERS);
+
+  prop_grouper_destroy(pg);
+  prop_nf_release(nf);
+  prop_destroy(grouped);
+  prop_destroy(sorted);
+  prop_destroy(src);
+  prop_courier_poll(pc);
+}
+
+
+/**
+ *
+ */
+static void *
+bench_setter_thread(void *aux)
+{
+  bench_writer_t *bw = aux;
+  prop_t *p = prop_create(bw->bw_nodes, "value");
+  int i;
+
+  for(i = 0; i < bw->bw_ops; i++) {
+    int64_t t0 = bench_ns();
+    prop_set_int(p, i);
+    bench_sample(&bw->bw_bench, t0);
+  }
+  return NULL;
+}
+
+
+/**
+ * Multiple writers setting values in unrelated subtrees
+ */
+static void
+bench_parallel_set(int ops, prop_courier_t *pc)
+{
+  bench_writer_t bw[BENCH_WRITERS];
+  hts_thread_t tids[BENCH_WRITERS];
+  bench_t b[BENCH_WRITERS];
+  prop_sub_t *subs[BENCH_WRITERS];
+  int i;
+
+  for(i = 0; i < BENCH_WRITERS; i++) {
+    bw[i].bw_nodes = prop_create_root(NULL);
+    bw[i].bw_ops = ops;
+    subs[i] = prop_subscribe(0,
+			     PROP_TAG_NAME("self", "value"),
+			     PROP_TAG_CALLBACK, bench_nop_cb, NULL,
+			     PROP_TAG_COURIER, pc,
+			     PROP_TAG_NAMED_ROOT, bw[i].bw_nodes, "self",
+			     NULL);
+    bench_init(&bw[i].bw_bench, "prop_set_int (MT)", ops);
+  }
+
+  for(i = 0; i < BENCH_WRITERS; i++)
+    hts_thread_create_joinable("propbench", &tids[i], bench_setter_thread,
+			       &bw[i], THREAD_PRIO_LOW);
+
+  for(i = 0; i < BENCH_WRITERS; i++) {
+    hts_thread_join(&tids[i]);
+    b[i] = bw[i].bw_bench;
+  }
+  prop_courier_poll(pc);
+  bench_report(b, BENCH_WRITERS);
+
+  for(i = 0; i < BENCH_WRITERS; i++) {
+    prop_unsubscribe(subs[i]);
+    prop_destroy(bw[i].bw_nodes);
+  }
+  prop_courier_poll(pc);
+}
+
+
+/**
+ * Run all prop benchmarks. 'scale' multiplies the number of operations
+ */
+void
+prop_bench(int scale)
+{
+  prop_courier_t *pc = prop_courier_create_passive();
+
+  if(scale < 1)
+    scale = 1;
+
+  printf("Property tree benchmark, scale %d, %d writer threads\n",
+	 scale, BENCH_WRITERS);
+
+  bench_create(20000 * scale);
+  bench_set(200000 * scale, pc);
+  bench_link(20000 * scale, pc);
+  bench_subscribe(50000 * scale, pc);
+  bench_vector(20 * scale, pc);
+  bench_resort(5000 * scale, pc);
+  bench_parallel_set(100000 * scale, pc);
+
+  prop_courier_destroy(pc);
+}
@@ -29,6 +29,7 @@
 #include "showtime.h"
 #include "prop_i.h"
 #include "misc/string.h"
+#include "misc/pool.h"
 #include "event.h"
 
 #ifdef PROP_DEBUG
@@ -40,6 +41,7 @@ hts_mutex_t prop_tag_mutex;
 static prop_t *prop_global;
 
 static prop_courier_t *global_courier;
+static pool_t *notify_pool;
 
 static void prop_unlink0(prop_t *p, prop_sub_t *skipme, const char *origin,
 			 struct prop_notify_queue *pnq);
@@ -339,10 +341,10 @@ prop_remove_from_originator(prop_t *p)
 
 
 /**
- *
+ * Release everything a notification references except the subscription
  */
 static void
-prop_notify_free(prop_notify_t *n)
+prop_notify_free_payload(prop_notify_t *n)
 {
   switch(n->hpn_event) {
   case PROP_SET_DIR:
@@ -407,8 +409,18 @@ prop_notify_free(prop_notify_t *n)
     prop_vec_release(n->hpn_propv);
     break;
   }
+}
+
+
+/**
+ *
+ */
+static void
+prop_notify_free(prop_notify_t *n)
+{
+  prop_notify_free_payload(n);
   prop_sub_ref_dec(n->hpn_sub);
-  free(n); 
+  pool_put(notify_pool, n);
 }
 
 
@@ -724,7 +736,7 @@ prop_notify_dispatch(struct prop_notify_queue *q)
       s->hps_lockmgr(s->hps_lock, 0);
  
     prop_sub_ref_dec(s);
-    free(n);
+    pool_put(notify_pool, n);
   }
 }
 
@@ -740,16 +752,18 @@ prop_courier(void *aux)
   struct prop_notify_queue q_exp, q_nor;
   prop_notify_t *n;
 
+  void (*epilogue)(void) = pc->pc_epilogue;
+
   if(pc->pc_prologue)
     pc->pc_prologue();
   
-  hts_mutex_lock(&prop_mutex);
+  hts_mutex_lock(&pc->pc_mutex);
 
   while(pc->pc_run) {
 
     if(TAILQ_FIRST(&pc->pc_queue_exp) == NULL &&
        TAILQ_FIRST(&pc->pc_queue_nor) == NULL) {
-      hts_cond_wait(&pc->pc_cond, &prop_mutex);
+      hts_cond_wait(&pc->pc_cond, &pc->pc_mutex);
       continue;
     }
 
@@ -758,34 +772,101 @@ prop_courier(void *aux)
 
     TAILQ_MOVE(&q_nor, &pc->pc_queue_nor, hpn_link);
     TAILQ_INIT(&pc->pc_queue_nor);
+    pc->pc_generation++;
 
-    hts_mutex_unlock(&prop_mutex);
+    hts_mutex_unlock(&pc->pc_mutex);
     prop_notify_dispatch(&q_exp);
     prop_notify_dispatch(&q_nor);
-    hts_mutex_lock(&prop_mutex);
+    hts_mutex_lock(&pc->pc_mutex);
   }
 
-  while((n = TAILQ_FIRST(&pc->pc_queue_exp)) != NULL) {
-    TAILQ_REMOVE(&pc->pc_queue_exp, n, hpn_link);
+  TAILQ_MOVE(&q_exp, &pc->pc_queue_exp, hpn_link);
+  TAILQ_INIT(&pc->pc_queue_exp);
+
+  TAILQ_MOVE(&q_nor, &pc->pc_queue_nor, hpn_link);
+  TAILQ_INIT(&pc->pc_queue_nor);
+  pc->pc_generation++;
+
+  hts_mutex_unlock(&pc->pc_mutex);
+
+  while((n = TAILQ_FIRST(&q_exp)) != NULL) {
+    TAILQ_REMOVE(&q_exp, n, hpn_link);
     prop_notify_free(n);
   }
 
-  while((n = TAILQ_FIRST(&pc->pc_queue_nor)) != NULL) {
-    TAILQ_REMOVE(&pc->pc_queue_nor, n, hpn_link);
+  while((n = TAILQ_FIRST(&q_nor)) != NULL) {
+    TAILQ_REMOVE(&q_nor, n, hpn_link);
     prop_notify_free(n);
   }
 
-  if(pc->pc_detached)
+  if(pc->pc_detached) {
+    hts_cond_destroy(&pc->pc_cond);
+    hts_mutex_destroy(&pc->pc_mutex);
     free(pc);
+  }
 
-  hts_mutex_unlock(&prop_mutex);
-
-  if(pc->pc_epilogue)
-    pc->pc_epilogue();
+  if(epilogue)
+    epilogue();
 
   return NULL;
 }
 
+/**
+ *
+ */
+static int
+prop_notify_is_value(const prop_notify_t *n)
+{
+  switch(n->hpn_event) {
+  case PROP_SET_DIR:
+  case PROP_SET_VOID:
+  case PROP_SET_RSTRING:
+  case PROP_SET_CSTRING:
+  case PROP_SET_RLINK:
+  case PROP_SET_INT:
+  case PROP_SET_FLOAT:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+
+/**
+ * For PROP_SUB_COALESCE subscriptions, fold a value update into the
+ * previous one if it's still waiting in the courier queue and nothing
+ * else has been queued for the subscription after it.
+ *
+ * Must be called with pc_mutex held. Returns 1 if 'n' was consumed.
+ */
+static int
+courier_coalesce(prop_courier_t *pc, prop_sub_t *s, prop_notify_t *n)
+{
+  prop_notify_t *pending = s->hps_pending_value;
+
+  if(!prop_notify_is_value(n)) {
+    s->hps_pending_value = NULL;
+    return 0;
+  }
+
+  if(pending == NULL || s->hps_pending_gen != pc->pc_generation) {
+    s->hps_pending_value = n;
+    s->hps_pending_gen = pc->pc_generation;
+    return 0;
+  }
+
+  prop_notify_free_payload(pending);
+  pending->hpn_event = n->hpn_event;
+  pending->u         = n->u;
+  pending->hpn_prop2 = n->hpn_prop2;
+  pending->hpn_flags = n->hpn_flags;
+
+  prop_sub_ref_dec(s);
+  pool_put(notify_pool, n);
+  return 1;
+}
+
+
 /**
  *
  */
@@ -793,14 +874,23 @@ static void
 courier_enqueue(prop_sub_t *s, prop_notify_t *n)
 {
   prop_courier_t *pc = s->hps_courier;
-  
+
+  hts_mutex_lock(&pc->pc_mutex);
+
+  if(s->hps_flags & PROP_SUB_COALESCE && courier_coalesce(pc, s, n)) {
+    hts_mutex_unlock(&pc->pc_mutex);
+    return;
+  }
+
   if(s->hps_flags & PROP_SUB_EXPEDITE)
     TAILQ_INSERT_TAIL(&pc->pc_queue_exp, n, hpn_link);
   else
     TAILQ_INSERT_TAIL(&pc->pc_queue_nor, n, hpn_link);
   if(pc->pc_has_cond)
     hts_cond_signal(&pc->pc_cond);
-  else if(pc->pc_notify != NULL)
+  hts_mutex_unlock(&pc->pc_mutex);
+
+  if(!pc->pc_has_cond && pc->pc_notify != NULL)
     pc->pc_notify(pc->pc_opaque);
 }
 
@@ -811,7 +901,7 @@ courier_enqueue(prop_sub_t *s, prop_notify_t *n)
 static prop_notify_t *
 get_notify(prop_sub_t *s)
 {
-  prop_notify_t *n = malloc(sizeof(prop_notify_t));
+  prop_notify_t *n = pool_get(notify_pool);
   atomic_add(&s->hps_refcount, 1);
   n->hpn_sub = s;
   return n;
@@ -1157,6 +1247,24 @@ static void
 prop_build_notify_childv(prop_sub_t *s, prop_vec_t *pv, prop_event_t event,
 			 prop_t *p2)
 {
+  if(s->hps_flags & PROP_SUB_INTERNAL) {
+    prop_callback_t *cb = s->hps_callback;
+    prop_trampoline_t *pt = s->hps_trampoline;
+
+    if(event == PROP_ADD_CHILD_VECTOR_BEFORE) {
+      if(pt != NULL)
+	pt(s, event, pv, p2);
+      else
+	cb(s->hps_opaque, event, pv, p2);
+    } else {
+      if(pt != NULL)
+	pt(s, event, pv);
+      else
+	cb(s->hps_opaque, event, pv);
+    }
+    return;
+  }
+
   prop_notify_t *n = get_notify(s);
   n->hpn_propv = prop_vec_addref(pv);
   n->hpn_flags = 0;
@@ -1295,6 +1403,325 @@ prop_clean(prop_t *p)
 }
 
 
+/**
+ * Lookup index for large directories
+ *
+ * Once a linear walk over hp_childs passes PROP_DIR_INDEX_THRESHOLD
+ * entries the directory gets a name hash (open addressing, linear
+ * probing) and a positional vector. The hash is kept in sync by
+ * prop_dir_link() / prop_dir_unlink(). The vector is extended on tail
+ * appends and invalidated by anything else. It is then rebuilt on the
+ * next indexed lookup.
+ *
+ * If two siblings share the same name the hash is dropped and name
+ * lookups fall back to walking the list, as we must return the first
+ * match in list order.
+ */
+#define PROP_DIR_INDEX_THRESHOLD 64
+
+typedef struct prop_dir_index {
+  prop_t **pdi_hash;
+  unsigned int pdi_hash_size;    // Always a power of 2
+  unsigned int pdi_hash_entries;
+  int pdi_hash_disabled;
+
+  prop_t **pdi_vec;
+  unsigned int pdi_vec_size;
+  unsigned int pdi_vec_capacity;
+  int pdi_vec_valid;
+} prop_dir_index_t;
+
+
+/**
+ *
+ */
+static int
+prop_dir_hash_insert(prop_dir_index_t *pdi, prop_t *p)
+{
+  unsigned int mask = pdi->pdi_hash_size - 1;
+  unsigned int i = mystrhash(p->hp_name) & mask;
+  prop_t *c;
+
+  while((c = pdi->pdi_hash[i]) != NULL) {
+    if(!strcmp(c->hp_name, p->hp_name))
+      return -1;
+    i = (i + 1) & mask;
+  }
+  pdi->pdi_hash[i] = p;
+  pdi->pdi_hash_entries++;
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+prop_dir_hash_rebuild(prop_t *dir, unsigned int size)
+{
+  prop_dir_index_t *pdi = dir->hp_index;
+  prop_t *c;
+
+  free(pdi->pdi_hash);
+  pdi->pdi_hash_size = size;
+  pdi->pdi_hash_entries = 0;
+  pdi->pdi_hash = calloc(size, sizeof(prop_t *));
+
+  TAILQ_FOREACH(c, &dir->hp_childs, hp_parent_link) {
+    if(c->hp_name != NULL && prop_dir_hash_insert(pdi, c)) {
+      free(pdi->pdi_hash);
+      pdi->pdi_hash = NULL;
+      pdi->pdi_hash_disabled = 1;
+      return;
+    }
+  }
+}
+
+
+/**
+ *
+ */
+static void
+prop_dir_hash_add(prop_t *dir, prop_t *p)
+{
+  prop_dir_index_t *pdi = dir->hp_index;
+
+  if(pdi->pdi_hash_disabled || p->hp_name == NULL)
+    return;
+
+  if((pdi->pdi_hash_entries + 1) * 2 > pdi->pdi_hash_size) {
+    // Rebuild will pick up 'p' as it's already linked in hp_childs
+    prop_dir_hash_rebuild(dir, pdi->pdi_hash_size * 2);
+    return;
+  }
+
+  if(prop_dir_hash_insert(pdi, p)) {
+    free(pdi->pdi_hash);
+    pdi->pdi_hash = NULL;
+    pdi->pdi_hash_disabled = 1;
+  }
+}
+
+
+/**
+ * Remove with backward shift so we don't need tombstones
+ */
+static void
+prop_dir_hash_del(prop_dir_index_t *pdi, prop_t *p)
+{
+  unsigned int mask, i, j, k;
+  prop_t *c;
+
+  if(pdi->pdi_hash_disabled || p->hp_name == NULL)
+    return;
+
+  mask = pdi->pdi_hash_size - 1;
+  i = mystrhash(p->hp_name) & mask;
+
+  while((c = pdi->pdi_hash[i]) != p) {
+    assert(c != NULL);
+    i = (i + 1) & mask;
+  }
+
+  j = i;
+  while(1) {
+    pdi->pdi_hash[i] = NULL;
+    do {
+      j = (j + 1) & mask;
+      if((c = pdi->pdi_hash[j]) == NULL) {
+	pdi->pdi_hash_entries--;
+	return;
+      }
+      k = mystrhash(c->hp_name) & mask;
+    } while(i <= j ? (i < k && k <= j) : (i < k || k <= j));
+    pdi->pdi_hash[i] = c;
+    i = j;
+  }
+}
+
+
+/**
+ *
+ */
+static void
+prop_dir_vec_rebuild(prop_t *dir)
+{
+  prop_dir_index_t *pdi = dir->hp_index;
+  prop_t *c;
+  unsigned int n = 0;
+
+  TAILQ_FOREACH(c, &dir->hp_childs, hp_parent_link)
+    n++;
+
+  if(n > pdi->pdi_vec_capacity) {
+    pdi->pdi_vec_capacity = n * 2;
+    free(pdi->pdi_vec);
+    pdi->pdi_vec = malloc(pdi->pdi_vec_capacity * sizeof(prop_t *));
+  }
+
+  n = 0;
+  TAILQ_FOREACH(c, &dir->hp_childs, hp_parent_link)
+    pdi->pdi_vec[n++] = c;
+  pdi->pdi_vec_size = n;
+  pdi->pdi_vec_valid = 1;
+}
+
+
+/**
+ *
+ */
+static void
+prop_dir_index_create(prop_t *dir)
+{
+  prop_dir_index_t *pdi = calloc(1, sizeof(prop_dir_index_t));
+  unsigned int size = PROP_DIR_INDEX_THRESHOLD * 4;
+  prop_t *c;
+  unsigned int n = 0;
+
+  dir->hp_index = pdi;
+
+  TAILQ_FOREACH(c, &dir->hp_childs, hp_parent_link)
+    n++;
+
+  while(size < n * 2)
+    size *= 2;
+
+  prop_dir_hash_rebuild(dir, size);
+  prop_dir_vec_rebuild(dir);
+}
+
+
+/**
+ *
+ */
+static void
+prop_dir_index_destroy(prop_t *dir)
+{
+  prop_dir_index_t *pdi = dir->hp_index;
+
+  if(pdi == NULL)
+    return;
+
+  free(pdi->pdi_hash);
+  free(pdi->pdi_vec);
+  free(pdi);
+  dir->hp_index = NULL;
+}
+
+
+/**
+ * Link 'p' into 'dir' before 'before' (or at tail if NULL)
+ */
+static void
+prop_dir_link(prop_t *dir, prop_t *p, prop_t *before)
+{
+  prop_dir_index_t *pdi = dir->hp_index;
+
+  if(before != NULL)
+    TAILQ_INSERT_BEFORE(before, p, hp_parent_link);
+  else
+    TAILQ_INSERT_TAIL(&dir->hp_childs, p, hp_parent_link);
+
+  if(pdi == NULL)
+    return;
+
+  prop_dir_hash_add(dir, p);
+
+  if(!pdi->pdi_vec_valid)
+    return;
+
+  if(before != NULL || pdi->pdi_vec_size == pdi->pdi_vec_capacity) {
+    pdi->pdi_vec_valid = 0;
+    return;
+  }
+  pdi->pdi_vec[pdi->pdi_vec_size++] = p;
+}
+
+
+/**
+ *
+ */
+static void
+prop_dir_unlink(prop_t *dir, prop_t *p)
+{
+  prop_dir_index_t *pdi = dir->hp_index;
+
+  if(pdi != NULL) {
+    prop_dir_hash_del(pdi, p);
+
+    if(pdi->pdi_vec_valid) {
+      if(pdi->pdi_vec_size > 0 && pdi->pdi_vec[pdi->pdi_vec_size - 1] == p)
+	pdi->pdi_vec_size--;
+      else
+	pdi->pdi_vec_valid = 0;
+    }
+  }
+  TAILQ_REMOVE(&dir->hp_childs, p, hp_parent_link);
+}
+
+
+/**
+ *
+ */
+static prop_t *
+prop_dir_find_name(prop_t *dir, const char *name)
+{
+  prop_dir_index_t *pdi = dir->hp_index;
+  unsigned int mask, i, n = 0;
+  prop_t *c;
+
+  if(pdi != NULL && !pdi->pdi_hash_disabled) {
+    mask = pdi->pdi_hash_size - 1;
+    i = mystrhash(name) & mask;
+    while((c = pdi->pdi_hash[i]) != NULL) {
+      if(!strcmp(c->hp_name, name))
+	return c;
+      i = (i + 1) & mask;
+    }
+    return NULL;
+  }
+
+  TAILQ_FOREACH(c, &dir->hp_childs, hp_parent_link) {
+    if(c->hp_name != NULL && !strcmp(c->hp_name, name))
+      break;
+    n++;
+  }
+
+  if(pdi == NULL && n >= PROP_DIR_INDEX_THRESHOLD)
+    prop_dir_index_create(dir);
+  return c;
+}
+
+
+/**
+ *
+ */
+static prop_t *
+prop_dir_find_index(prop_t *dir, unsigned int i)
+{
+  prop_dir_index_t *pdi = dir->hp_index;
+  prop_t *c;
+
+  if(pdi == NULL) {
+    if(i < PROP_DIR_INDEX_THRESHOLD) {
+      TAILQ_FOREACH(c, &dir->hp_childs, hp_parent_link) {
+	if(i == 0)
+	  break;
+	i--;
+      }
+      return c;
+    }
+    prop_dir_index_create(dir);
+    pdi = dir->hp_index;
+  }
+
+  if(!pdi->pdi_vec_valid)
+    prop_dir_vec_rebuild(dir);
+
+  return i < pdi->pdi_vec_size ? pdi->pdi_vec[i] : NULL;
+}
+
+
 /**
  *
  */
@@ -1309,6 +1736,7 @@ prop_make_dir(prop_t *p, prop_sub_t *skipme, const char *origin)
   
   TAILQ_INIT(&p->hp_childs);
   p->hp_selected = NULL;
+  p->hp_index = NULL;
   p->hp_type = PROP_DIR;
   
   prop_notify_value(p, skipme, origin, 0);
@@ -1323,10 +1751,10 @@ prop_insert(prop_t *p, prop_t *parent, prop_t *before, prop_sub_t *skipme)
 {
   if(before != NULL) {
     assert(before->hp_parent == parent);
-    TAILQ_INSERT_BEFORE(before, p, hp_parent_link);
+    prop_dir_link(parent, p, before);
     prop_notify_child2(p, parent, before, PROP_ADD_CHILD_BEFORE, skipme, 0);
   } else {
-    TAILQ_INSERT_TAIL(&parent->hp_childs, p, hp_parent_link);
+    prop_dir_link(parent, p, NULL);
     prop_notify_child(p, parent, PROP_ADD_CHILD, skipme, 0);
   }
 }
@@ -1375,13 +1803,8 @@ prop_create0(prop_t *parent, const char *name, prop_sub_t *skipme, int noalloc)
 
   prop_make_dir(parent, skipme, "prop_create()");
 
-  if(name != NULL) {
-    TAILQ_FOREACH(hp, &parent->hp_childs, hp_parent_link) {
-      if(hp->hp_name != NULL && !strcmp(hp->hp_name, name)) {
-	return hp;
-      }
-    }
-  }
+  if(name != NULL && (hp = prop_dir_find_name(parent, name)) != NULL)
+    return hp;
 
   hp = prop_make(name, noalloc, parent);
 
@@ -1470,13 +1893,11 @@ prop_set_parent_ex(prop_t *p, prop_t *parent, prop_t *before,
  *
  */
 void
-prop_set_parent_vector(prop_vec_t *pv, prop_t *parent, prop_t *before,
-		       prop_sub_t *skipme)
+prop_set_parent_vector0(prop_vec_t *pv, prop_t *parent, prop_t *before,
+			prop_sub_t *skipme)
 {
   int i;
 
-  hts_mutex_lock(&prop_mutex);
-
   if(parent == NULL || parent->hp_type == PROP_ZOMBIE) {
 
   for(i = 0; i < pv->pv_length; i++)
@@ -1494,15 +1915,23 @@ prop_set_parent_vector(prop_vec_t *pv, prop_t *parent, prop_t *before,
       if(parent->hp_flags & (PROP_MULTI_SUB | PROP_MULTI_NOTIFY))
 	prop_flood_flag(p, PROP_MULTI_NOTIFY, 0);
     
-      if(before) {
-	TAILQ_INSERT_BEFORE(before, p, hp_parent_link);
-      } else {
-	TAILQ_INSERT_TAIL(&parent->hp_childs, p, hp_parent_link);
-      }
+      prop_dir_link(parent, p, before);
     }
     prop_notify_childv(pv, parent, before ? PROP_ADD_CHILD_VECTOR_BEFORE : 
 		       PROP_ADD_CHILD_VECTOR, skipme, before);
   }
+}
+
+
+/**
+ *
+ */
+void
+prop_set_parent_vector(prop_vec_t *pv, prop_t *parent, prop_t *before,
+		       prop_sub_t *skipme)
+{
+  hts_mutex_lock(&prop_mutex);
+  prop_set_parent_vector0(pv, parent, before, skipme);
   hts_mutex_unlock(&prop_mutex);
 }
 
@@ -1521,7 +1950,7 @@ prop_unparent0(prop_t *p, prop_sub_t *skipme)
 
   prop_notify_child(p, parent, PROP_DEL_CHILD, NULL, 0);
   
-  TAILQ_REMOVE(&parent->hp_childs, p, hp_parent_link);
+  prop_dir_unlink(parent, p);
   p->hp_parent = NULL;
   
   if(parent->hp_selected == p)
@@ -1565,7 +1994,7 @@ prop_destroy_child(prop_t *p, prop_t *c)
 {
   if(!prop_destroy0(c)) {
     prop_notify_child(c, p, PROP_DEL_CHILD, NULL, 0);
-    TAILQ_REMOVE(&p->hp_childs, c, hp_parent_link);
+    prop_dir_unlink(p, c);
     c->hp_parent = NULL;
   }
 }
@@ -1606,6 +2035,7 @@ prop_destroy0(prop_t *p)
     abort();
 
   case PROP_DIR:
+    prop_dir_index_destroy(p);
     for(c = TAILQ_FIRST(&p->hp_childs); c != NULL; c = next) {
       next = TAILQ_NEXT(c, hp_parent_link);
       prop_destroy_child(p, c);
@@ -1664,7 +2094,7 @@ prop_destroy0(prop_t *p)
     prop_notify_child(p, p->hp_parent, PROP_DEL_CHILD, NULL, 0);
     parent = p->hp_parent;
 
-    TAILQ_REMOVE(&parent->hp_childs, p, hp_parent_link);
+    prop_dir_unlink(parent, p);
     p->hp_parent = NULL;
 
     if(parent->hp_selected == p)
@@ -1719,13 +2149,9 @@ prop_destroy_by_name(prop_t *p, const char *name)
 {
   hts_mutex_lock(&prop_mutex);
   if(p->hp_type == PROP_DIR) {
-    prop_t *c;
-    TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link) {
-      if(c->hp_name != NULL && !strcmp(c->hp_name, name)) {
-	prop_destroy_child(p, c);
-	break;
-      }
-    }
+    prop_t *c = prop_dir_find_name(p, name);
+    if(c != NULL)
+      prop_destroy_child(p, c);
   }
   hts_mutex_unlock(&prop_mutex);
 }
@@ -1801,13 +2227,8 @@ prop_move0(prop_t *p, prop_t *before, prop_sub_t *skipme)
   if(TAILQ_NEXT(p, hp_parent_link) != before) {
 
     parent = p->hp_parent;
-    TAILQ_REMOVE(&parent->hp_childs, p, hp_parent_link);
-  
-    if(before != NULL) {
-      TAILQ_INSERT_BEFORE(before, p, hp_parent_link);
-    } else {
-      TAILQ_INSERT_TAIL(&parent->hp_childs, p, hp_parent_link);
-    }  
+    prop_dir_unlink(parent, p);
+    prop_dir_link(parent, p, before);
     prop_notify_child2(p, parent, before, PROP_MOVE_CHILD, skipme, 0);
   }
 }
@@ -1846,27 +2267,19 @@ prop_subfind(prop_t *p, const char **name, int follow_symlinks, int allow_indexi
 
       TAILQ_INIT(&p->hp_childs);
       p->hp_selected = NULL;
+      p->hp_index = NULL;
       p->hp_type = PROP_DIR;
 
       prop_notify_value(p, NULL, "prop_subfind()", 0);
     }
 
     if(allow_indexing && name[0][0] == '*') {
-      unsigned int i = atoi(name[0]+1);
-      TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link) {
-	if(i == 0)
-	  break;
-	i--;
-      }
+      c = prop_dir_find_index(p, atoi(name[0]+1));
       if(c == NULL)
 	return NULL;
 
     } else {
-
-      TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link) {
-	if(c->hp_name != NULL && !strcmp(c->hp_name, name[0]))
-	  break;
-      }
+      c = prop_dir_find_name(p, name[0]);
     }
     p = c ?: prop_create0(p, name[0], NULL, 0);    
     name++;
@@ -2179,6 +2592,8 @@ prop_subscribe(int flags, ...)
 
   s->hps_zombie = 0;
   s->hps_flags = flags;
+  s->hps_pending_value = NULL;
+  s->hps_pending_gen = 0;
   if(pc != NULL) {
     s->hps_courier = pc;
     s->hps_lock = pc->pc_entry_lock;
@@ -2316,6 +2731,8 @@ prop_init(void)
 {
   hts_mutex_init(&prop_mutex);
   hts_mutex_init(&prop_tag_mutex);
+  notify_pool = pool_create("prop_notify", sizeof(prop_notify_t),
+			    POOL_REENTRANT);
   prop_global = prop_make("global", 1, NULL);
 
   global_courier = prop_courier_create_thread(NULL, "global");
@@ -3238,9 +3655,7 @@ prop_find(prop_t *p, ...)
       break;
     }
 
-    TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
-      if(c->hp_name != NULL && !strcmp(c->hp_name, n))
-	break;
+    c = prop_dir_find_name(p, n);
     if(c == NULL)
       break;
     p = c;
@@ -3309,6 +3724,7 @@ static prop_courier_t *
 prop_courier_create(void)
 {
   prop_courier_t *pc = calloc(1, sizeof(prop_courier_t));
+  hts_mutex_init(&pc->pc_mutex);
   TAILQ_INIT(&pc->pc_queue_nor);
   TAILQ_INIT(&pc->pc_queue_exp);
   return pc;
@@ -3327,7 +3743,7 @@ prop_courier_create_thread(hts_mutex_t *entrymutex, const char *name)
   snprintf(buf, sizeof(buf), "PC:%s", name);
 
   pc->pc_has_cond = 1;
-  hts_cond_init(&pc->pc_cond, &prop_mutex);
+  hts_cond_init(&pc->pc_cond, &pc->pc_mutex);
 
   pc->pc_run = 1;
   hts_thread_create_joinable(buf, &pc->pc_thread, prop_courier, pc,
@@ -3371,7 +3787,7 @@ prop_courier_create_waitable(void)
   prop_courier_t *pc = prop_courier_create();
   
   pc->pc_has_cond = 1;
-  hts_cond_init(&pc->pc_cond, &prop_mutex);
+  hts_cond_init(&pc->pc_cond, &pc->pc_mutex);
 
   return pc;
 }
@@ -3396,7 +3812,7 @@ prop_courier_create_lockmgr(const char *name, prop_lockmgr_t *mgr, void *lock,
   snprintf(buf, sizeof(buf), "PC:%s", name);
 
   pc->pc_has_cond = 1;
-  hts_cond_init(&pc->pc_cond, &prop_mutex);
+  hts_cond_init(&pc->pc_cond, &pc->pc_mutex);
 
   pc->pc_run = 1;
   hts_thread_create_joinable(buf, &pc->pc_thread, prop_courier, pc,
@@ -3415,20 +3831,21 @@ prop_courier_wait(prop_courier_t *pc,
 		  int timeout)
 {
   int r = 0;
-  hts_mutex_lock(&prop_mutex);
+  hts_mutex_lock(&pc->pc_mutex);
   if(TAILQ_FIRST(&pc->pc_queue_exp) == NULL &&
      TAILQ_FIRST(&pc->pc_queue_nor) == NULL) {
     if(timeout)
-      r = hts_cond_wait_timeout(&pc->pc_cond, &prop_mutex, timeout);
+      r = hts_cond_wait_timeout(&pc->pc_cond, &pc->pc_mutex, timeout);
     else
-      hts_cond_wait(&pc->pc_cond, &prop_mutex);
+      hts_cond_wait(&pc->pc_cond, &pc->pc_mutex);
   }
 
   TAILQ_MOVE(exp, &pc->pc_queue_exp, hpn_link);
   TAILQ_INIT(&pc->pc_queue_exp);
   TAILQ_MOVE(nor, &pc->pc_queue_nor, hpn_link);
   TAILQ_INIT(&pc->pc_queue_nor);
-  hts_mutex_unlock(&prop_mutex);
+  pc->pc_generation++;
+  hts_mutex_unlock(&pc->pc_mutex);
   return r;
 }
 
@@ -3453,10 +3870,10 @@ void
 prop_courier_destroy(prop_courier_t *pc)
 {
   if(pc->pc_run) {
-    hts_mutex_lock(&prop_mutex);
+    hts_mutex_lock(&pc->pc_mutex);
     pc->pc_run = 0;
     hts_cond_signal(&pc->pc_cond);
-    hts_mutex_unlock(&prop_mutex);
+    hts_mutex_unlock(&pc->pc_mutex);
 
     hts_thread_join(&pc->pc_thread);
   }
@@ -3464,6 +3881,7 @@ prop_courier_destroy(prop_courier_t *pc)
   if(pc->pc_has_cond)
     hts_cond_destroy(&pc->pc_cond);
 
+  hts_mutex_destroy(&pc->pc_mutex);
   free(pc);
 }
 
@@ -3475,8 +3893,10 @@ void
 prop_courier_stop(prop_courier_t *pc)
 {
   hts_thread_detach(&pc->pc_thread);
+  hts_mutex_lock(&pc->pc_mutex);
   pc->pc_run = 0;
   pc->pc_detached = 1;
+  hts_mutex_unlock(&pc->pc_mutex);
 }
 
 
@@ -3487,12 +3907,13 @@ void
 prop_courier_poll(prop_courier_t *pc)
 {
   struct prop_notify_queue q_exp, q_nor;
-  hts_mutex_lock(&prop_mutex);
+  hts_mutex_lock(&pc->pc_mutex);
   TAILQ_MOVE(&q_exp, &pc->pc_queue_exp, hpn_link);
   TAILQ_INIT(&pc->pc_queue_exp);
   TAILQ_MOVE(&q_nor, &pc->pc_queue_nor, hpn_link);
   TAILQ_INIT(&pc->pc_queue_nor);
-  hts_mutex_unlock(&prop_mutex);
+  pc->pc_generation++;
+  hts_mutex_unlock(&pc->pc_mutex);
   prop_notify_dispatch(&q_exp);
   prop_notify_dispatch(&q_nor);
 }
@@ -33,6 +33,9 @@
 
 LIST_HEAD(pg_node_list, pg_node);
 LIST_HEAD(pg_group_list, pg_group);
+TAILQ_HEAD(pg_group_queue, pg_group);
+
+#define PG_GROUP_HASH_SIZE 256
 
 /**
  *
@@ -56,11 +59,21 @@ typedef struct pg_node {
  */
 typedef struct pg_group {
   char *pgg_name;
+  unsigned int pgg_hash;
   LIST_ENTRY(pg_group) pgg_link;
   prop_t *pgg_root;
   prop_t *pgg_nodes;
   struct pg_node_list pgg_entries;
 
+  /**
+   * While adding a vector of nodes, output nodes are collected here
+   * and published in one go. pgg_new is set if pgg_root itself is not
+   * yet parented
+   */
+  TAILQ_ENTRY(pg_group) pgg_pending_link;
+  prop_vec_t *pgg_pending;
+  char pgg_new;
+
 } pg_group_t;
 
 
@@ -71,7 +84,10 @@ struct prop_grouper {
 
   struct pg_node_list pg_nodes;
 
-  struct pg_group_list pg_groups;
+  struct pg_group_list pg_groups[PG_GROUP_HASH_SIZE];
+
+  struct pg_group_queue pg_pending;
+  char pg_bulk;
 
   char **pg_groupingpath;
   prop_sub_t *pg_srcsub;
@@ -88,14 +104,24 @@ static pg_group_t *
 group_find(prop_grouper_t *pg, const char *name)
 {
   pg_group_t *pgg;
+  unsigned int hash = mystrhash(name);
+  struct pg_group_list *bucket = &pg->pg_groups[hash % PG_GROUP_HASH_SIZE];
 
-  LIST_FOREACH(pgg, &pg->pg_groups, pgg_link)
-    if(!strcmp(pgg->pgg_name, name))
+  LIST_FOREACH(pgg, bucket, pgg_link)
+    if(pgg->pgg_hash == hash && !strcmp(pgg->pgg_name, name))
       return pgg;
   pgg = calloc(1, sizeof(pg_group_t));
-  LIST_INSERT_HEAD(&pg->pg_groups, pgg, pgg_link);
+  LIST_INSERT_HEAD(bucket, pgg, pgg_link);
   pgg->pgg_name = strdup(name);
-  pgg->pgg_root = prop_create0(pg->pg_dst, NULL, NULL, 0);
+  pgg->pgg_hash = hash;
+
+  if(pg->pg_bulk) {
+    // Build the group off-tree, pg_add_nodes() will publish it
+    pgg->pgg_root = prop_make(NULL, 0, NULL);
+    pgg->pgg_new = 1;
+  } else {
+    pgg->pgg_root = prop_create0(pg->pg_dst, NULL, NULL, 0);
+  }
   prop_set_string_exl(prop_create0(pgg->pgg_root, "name", NULL, 0), 
 		      NULL, name, PROP_STR_UTF8);
   pgg->pgg_nodes = prop_create0(pgg->pgg_root, "nodes", NULL, 0);
@@ -107,8 +133,12 @@ group_find(prop_grouper_t *pg, const char *name)
  *
  */
 static void
-group_destroy(pg_group_t *pgg)
+group_destroy(prop_grouper_t *pg, pg_group_t *pgg)
 {
+  if(pgg->pgg_pending != NULL) {
+    TAILQ_REMOVE(&pg->pg_pending, pgg, pgg_pending_link);
+    prop_vec_release(pgg->pgg_pending);
+  }
   prop_destroy0(pgg->pgg_root);
   LIST_REMOVE(pgg, pgg_link);
   free(pgg->pgg_name);
@@ -128,7 +158,7 @@ node_unset(pg_node_t *pgn)
   if(pgn->pgn_group != NULL) {
     LIST_REMOVE(pgn, pgn_group_link);
     if(LIST_FIRST(&pgn->pgn_group->pgg_entries) == NULL)
-      group_destroy(pgn->pgn_group);
+      group_destroy(pgn->pgn_grouper, pgn->pgn_group);
   }
 }
 
@@ -147,13 +177,25 @@ node_update_group(pg_node_t *pgn, const char *group)
     return;
   }
 
-  pgn->pgn_group = group_find(pgn->pgn_grouper, group);
-  LIST_INSERT_HEAD(&pgn->pgn_group->pgg_entries, pgn, pgn_group_link);
+  prop_grouper_t *pg = pgn->pgn_grouper;
+  pg_group_t *pgg = group_find(pg, group);
+
+  pgn->pgn_group = pgg;
+  LIST_INSERT_HEAD(&pgg->pgg_entries, pgn, pgn_group_link);
 
   pgn->pgn_out = prop_make(NULL, 0, NULL);
   prop_link0(pgn->pgn_in, pgn->pgn_out, NULL, 0);
 
-  prop_set_parent0(pgn->pgn_out, pgn->pgn_group->pgg_nodes, NULL, NULL);
+  if(pg->pg_bulk) {
+    if(pgg->pgg_pending == NULL) {
+      pgg->pgg_pending = prop_vec_create(16);
+      TAILQ_INSERT_TAIL(&pg->pg_pending, pgg, pgg_pending_link);
+    }
+    pgg->pgg_pending = prop_vec_append(pgg->pgg_pending, pgn->pgn_out);
+    return;
+  }
+
+  prop_set_parent0(pgn->pgn_out, pgg->pgg_nodes, NULL, NULL);
 }
 
 
@@ -225,8 +267,35 @@ static void
 pg_add_nodes(prop_grouper_t *pg, prop_vec_t *pv)
 {
   int i;
+  pg_group_t *pgg;
+  prop_vec_t *groups = NULL;
+
+  pg->pg_bulk = 1;
   for(i = 0; i < prop_vec_len(pv); i++)
     pg_add_node(pg, prop_vec_get(pv, i));
+  pg->pg_bulk = 0;
+
+  // Publish each group's new nodes with a single notification
+  while((pgg = TAILQ_FIRST(&pg->pg_pending)) != NULL) {
+    TAILQ_REMOVE(&pg->pg_pending, pgg, pgg_pending_link);
+
+    prop_set_parent_vector0(pgg->pgg_pending, pgg->pgg_nodes, NULL, NULL);
+    prop_vec_release(pgg->pgg_pending);
+    pgg->pgg_pending = NULL;
+
+    if(pgg->pgg_new) {
+      pgg->pgg_new = 0;
+      if(groups == NULL)
+	groups = prop_vec_create(16);
+      groups = prop_vec_append(groups, pgg->pgg_root);
+    }
+  }
+
+  // And all new groups in one go
+  if(groups != NULL) {
+    prop_set_parent_vector0(groups, pg->pg_dst, NULL, NULL);
+    prop_vec_release(groups);
+  }
 }
 
 
@@ -311,6 +380,11 @@ prop_grouper_create(prop_t *dst, prop_t *src, const char *groupkey,
 		    int flags)
 {
   prop_grouper_t *pg = calloc(1, sizeof(prop_grouper_t));
+  int i;
+
+  for(i = 0; i < PG_GROUP_HASH_SIZE; i++)
+    LIST_INIT(&pg->pg_groups[i]);
+  TAILQ_INIT(&pg->pg_pending);
 
   pg->pg_dst = flags & PROP_GROUPER_TAKE_DST_OWNERSHIP
     ? dst : prop_xref_addref(dst);
@@ -335,6 +409,8 @@ prop_grouper_create(prop_t *dst, prop_t *src, const char *groupkey,
 void
 prop_grouper_destroy(prop_grouper_t *pg)
 {
+  int i;
+
   hts_mutex_lock(&prop_mutex);
 
   pg_clear(pg);
@@ -342,7 +418,8 @@ prop_grouper_destroy(prop_grouper_t *pg)
   prop_destroy0(pg->pg_dst);
 
   assert(LIST_FIRST(&pg->pg_nodes) == NULL);
-  assert(LIST_FIRST(&pg->pg_groups) == NULL);
+  for(i = 0; i < PG_GROUP_HASH_SIZE; i++)
+    assert(LIST_FIRST(&pg->pg_groups[i]) == NULL);
   hts_mutex_unlock(&prop_mutex);
 
   strvec_free(pg->pg_groupingpath);
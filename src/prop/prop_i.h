@@ -22,6 +22,21 @@
 
 #include "prop.h"
 
+/**
+ * Lock ordering:
+ *
+ *   prop_mutex -> prop_courier.pc_mutex
+ *
+ * prop_mutex protects the tree itself (linkage, values, subscriptions).
+ * Each courier has its own pc_mutex that only protects its notification
+ * queues and run state. Thus courier threads and pollers (such as the
+ * UI) never need to grab prop_mutex just to pick up their notifications.
+ * Never acquire prop_mutex while holding a pc_mutex.
+ *
+ * prop_mutex is still one lock for the whole tree. Links, multi
+ * subscriptions and relinking reach across arbitrary subtrees, so
+ * per-subtree locks would first need a global ordering between them.
+ */
 extern hts_mutex_t prop_mutex;
 extern hts_mutex_t prop_tag_mutex;
 
@@ -38,6 +53,11 @@ LIST_HEAD(prop_sub_list, prop_sub);
  */
 struct prop_courier {
 
+  /**
+   * Protects pc_queue_*, pc_run and pc_detached. pc_cond is bound to it
+   */
+  hts_mutex_t pc_mutex;
+
   struct prop_notify_queue pc_queue_nor;
   struct prop_notify_queue pc_queue_exp;
 
@@ -51,6 +71,13 @@ struct prop_courier {
   int pc_run;
   int pc_detached;
 
+  /**
+   * Bumped every time the queues are handed off for dispatch.
+   * Used to tell if a PROP_SUB_COALESCE subscription's pending
+   * notification is still queued. Protected by pc_mutex
+   */
+  unsigned int pc_generation;
+
   void (*pc_notify)(void *opaque);
   void *pc_opaque;
 
@@ -207,6 +234,7 @@ struct prop {
     struct {
       struct prop_queue childs;
       struct prop *selected;
+      struct prop_dir_index *index;
     } c;
     struct pixmap *pixmap;
     struct {
@@ -222,6 +250,7 @@ struct prop {
 #define hp_int      u.i.val
 #define hp_childs   u.c.childs
 #define hp_selected u.c.selected
+#define hp_index    u.c.index
 #define hp_pixmap   u.pixmap
 #define hp_link_rtitle u.link.rtitle
 #define hp_link_rurl   u.link.rurl
@@ -292,7 +321,15 @@ struct prop_sub {
   /**
    * Flags as passed to prop_subscribe(). May never be changed
    */
-  uint8_t hps_flags;
+  uint16_t hps_flags;
+
+  /**
+   * Last queued value notification for PROP_SUB_COALESCE subscriptions.
+   * Only valid if hps_pending_gen equals the courier's pc_generation.
+   * Protected by courier's pc_mutex
+   */
+  struct prop_notify *hps_pending_value;
+  unsigned int hps_pending_gen;
 
   /**
    * Linkage to property. Protected by global mutex
@@ -320,6 +357,9 @@ void prop_link0(prop_t *src, prop_t *dst, prop_sub_t *skipme, int hard);
 int prop_set_parent0(prop_t *p, prop_t *parent, prop_t *before, 
 		     prop_sub_t *skipme);
 
+void prop_set_parent_vector0(prop_vec_t *pv, prop_t *parent, prop_t *before,
+			     prop_sub_t *skipme);
+
 void prop_unparent0(prop_t *p, prop_sub_t *skipme);
 
 int prop_destroy0(prop_t *p);
@@ -34,6 +34,7 @@
 
 
 TAILQ_HEAD(nfnode_queue, nfnode);
+LIST_HEAD(nfnode_list, nfnode);
 LIST_HEAD(nfn_pred_list, nfn_pred);
 LIST_HEAD(prop_nf_pred_list, prop_nf_pred);
 
@@ -47,12 +48,33 @@ typedef struct nfn_pred {
 } nfn_pred_t;
 
 
+#define NF_INDEX_FIELDS 8 // Max number of fields given to prop_nf_index_add()
+
+/**
+ * An indexed string, case folded, and a bloom mask of its trigrams
+ */
+typedef struct nf_text {
+  struct nfnode *nft_nfn;
+  prop_sub_t *nft_sub;
+  char *nft_str;
+  uint64_t nft_grams;
+} nf_text_t;
+
+
 /**
  *
  */
 typedef struct nfnode {
   TAILQ_ENTRY(nfnode) in_link;
-  TAILQ_ENTRY(nfnode) out_link;
+
+  /**
+   * Egress order is kept in a treap. Each node also counts the visible
+   * (out != NULL) nodes in its subtree so we can find the next visible
+   * node without walking over all hidden ones
+   */
+  struct nfnode *ot_left, *ot_right, *ot_parent;
+  unsigned int ot_prio;
+  int ot_visible;
   
   prop_t *in;
   prop_t *out;
@@ -62,8 +84,23 @@ typedef struct nfnode {
 
   struct nfn_pred_list preds;
 
+  /**
+   * Search index, only kept while a filter is set. One entry per
+   * index field of the filter, each kept up to date by its own
+   * subscription. If the filter has no index fields there is one
+   * entry per string below the node, rebuilt by 'multisub'.
+   *
+   * ft_match caches the result for the current filter (-1 if unknown)
+   * and the node is linked on the corresponding nf->ft_nodes list
+   */
+  nf_text_t *ft_texts;
+  int ft_num;
+  char ft_active;
+  signed char ft_match;
+  LIST_ENTRY(nfnode) ft_link;
+
   struct prop_nf *nf;
-  int pos;
+  int seq;
   char inserted;
   char sortkey_type;
 #define SORTKEY_NONE  0
@@ -117,11 +154,20 @@ typedef struct prop_nf {
   prop_sub_t *filtersub;
 
   struct nfnode_queue in;
-  struct nfnode_queue out;
+  nfnode_t *out_root;
 
   char *filter;
+  char *filter_folded;
+  uint64_t filter_grams;
+
+  char **ft_paths[NF_INDEX_FIELDS];
+  int ft_num_paths;
 
-  int pos_valid;
+  struct nfnode_list ft_nodes[3]; // Indexed by nfnode.ft_match + 1
+
+  int seq_tally;
+  unsigned int prio_seed;
+  char bulk; // Adding a vector, sorting is done when all nodes are in
 
   char **defsortpath;
 
@@ -172,64 +218,122 @@ eval_preds(nfnode_t *nfn)
 }
 
 /**
- *
+ * Bloom mask of all byte trigrams in a (case folded) string
  */
-static void
-nf_renumber(prop_nf_t *nf)
+static uint64_t
+nf_trigrams(const char *s)
 {
-  int pos;
-  nfnode_t *nfn;
+  uint64_t r = 0;
+  const uint8_t *u = (const uint8_t *)s;
 
-  if(nf->pos_valid)
-    return;
+  for(; u[0] && u[1] && u[2]; u++)
+    r |= 1ULL << ((((u[0] << 16) | (u[1] << 8) | u[2]) * 2654435761U) >> 26);
+  return r;
+}
 
-  nf->pos_valid = 1;
-  pos = 0;
-  TAILQ_FOREACH(nfn, &nf->in, in_link)
-    nf->pos_valid = pos++;
+
+/**
+ * Set an index entry, 'str' is not yet case folded
+ */
+static void
+nf_text_set(nf_text_t *nft, const char *str)
+{
+  free(nft->nft_str);
+  nft->nft_str = str != NULL ? utf8_casefold(str) : NULL;
+  nft->nft_grams = nft->nft_str != NULL ? nf_trigrams(nft->nft_str) : 0;
 }
 
 
 /**
  *
  */
-static int
-filterstr(const char *s, const char *q)
+static void
+nf_text_clear(nfnode_t *nfn)
 {
-  return !!mystrstr(s, q);
+  int i;
+
+  for(i = 0; i < nfn->ft_num; i++)
+    free(nfn->ft_texts[i].nft_str);
+  free(nfn->ft_texts);
+  nfn->ft_texts = NULL;
+  nfn->ft_num = 0;
 }
 
 
 /**
- *
+ * Index all strings below a node, each in its own entry
  */
-static int
-nf_filtercheck(prop_t *p, const char *q)
+static void
+nf_text_collect(nfnode_t *nfn, prop_t *p)
 {
   prop_t *c;
+  const char *str = NULL;
 
   while(p->hp_originator != NULL)
     p = p->hp_originator;
 
   switch(p->hp_type) {
   case PROP_RSTRING:
-    return filterstr(rstr_get(p->hp_rstring), q);
+    str = rstr_get(p->hp_rstring);
+    break;
 
   case PROP_CSTRING:
-    return filterstr(p->hp_cstring, q);
+    str = p->hp_cstring;
+    break;
 
   case PROP_LINK:
-    return filterstr(rstr_get(p->hp_link_rtitle), q);
+    str = rstr_get(p->hp_link_rtitle);
+    break;
 
   case PROP_DIR:
     TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
-      if(nf_filtercheck(c, q))
-	return 1;
+      nf_text_collect(nfn, c);
     break;
   default:
     break;
   }
-  return 0;
+
+  if(str != NULL) {
+    nfn->ft_texts = realloc(nfn->ft_texts,
+			    sizeof(nf_text_t) * (nfn->ft_num + 1));
+    memset(&nfn->ft_texts[nfn->ft_num], 0, sizeof(nf_text_t));
+    nf_text_set(&nfn->ft_texts[nfn->ft_num++], str);
+  }
+}
+
+
+/**
+ *
+ */
+static void
+nf_set_match(prop_nf_t *nf, nfnode_t *nfn, int match)
+{
+  LIST_REMOVE(nfn, ft_link);
+  LIST_INSERT_HEAD(&nf->ft_nodes[match + 1], nfn, ft_link);
+  nfn->ft_match = match;
+}
+
+
+/**
+ *
+ */
+static int
+nf_filtercheck(prop_nf_t *nf, nfnode_t *nfn)
+{
+  const nf_text_t *nft;
+  int i, m = 0;
+
+  if(nfn->ft_match != -1)
+    return nfn->ft_match;
+
+  for(i = 0; i < nfn->ft_num && !m; i++) {
+    nft = &nfn->ft_texts[i];
+    m = nft->nft_str != NULL && !(nf->filter_grams & ~nft->nft_grams) &&
+      strstr(nft->nft_str, nf->filter_folded) != NULL;
+  }
+
+  nf_set_match(nf, nfn, m);
+  return m;
 }
 
 
@@ -266,49 +370,316 @@ nf_egress_cmp(const nfnode_t *a, const nfnode_t *b)
       r = 0;
     break;
   }
-  return a->nf->sortorder * (r ? r : a->pos - b->pos);
+  if(!r)
+    r = a->seq - b->seq;
+  return a->nf->sortorder * r;
 }
 
 
 /**
- * Insert a node according to the sorting criteria
- * Optionally move the output node if it's created
+ *
+ */
+static int
+nf_egress_cmpv(const void *A, const void *B)
+{
+  return nf_egress_cmp(*(const nfnode_t **)A, *(const nfnode_t **)B);
+}
+
+
+/**
+ *
  */
 static void
-nf_insert_node(prop_nf_t *nf, nfnode_t *nfn)
+nf_ot_recount(nfnode_t *nfn)
+{
+  nfn->ot_visible = !!nfn->out +
+    (nfn->ot_left  ? nfn->ot_left->ot_visible  : 0) +
+    (nfn->ot_right ? nfn->ot_right->ot_visible : 0);
+}
+
+
+/**
+ * Adjust visible count from 'nfn' all the way up to the root
+ */
+static void
+nf_ot_adjust(nfnode_t *nfn, int delta)
+{
+  for(; nfn != NULL; nfn = nfn->ot_parent)
+    nfn->ot_visible += delta;
+}
+
+
+/**
+ * Rotate 'x' up one level, above its parent
+ */
+static void
+nf_ot_rotate_up(prop_nf_t *nf, nfnode_t *x)
+{
+  nfnode_t *p = x->ot_parent;
+  nfnode_t *g = p->ot_parent;
+
+  if(x == p->ot_left) {
+    p->ot_left = x->ot_right;
+    if(p->ot_left != NULL)
+      p->ot_left->ot_parent = p;
+    x->ot_right = p;
+  } else {
+    p->ot_right = x->ot_left;
+    if(p->ot_right != NULL)
+      p->ot_right->ot_parent = p;
+    x->ot_left = p;
+  }
+
+  p->ot_parent = x;
+  x->ot_parent = g;
+
+  if(g == NULL)
+    nf->out_root = x;
+  else if(g->ot_left == p)
+    g->ot_left = x;
+  else
+    g->ot_right = x;
+
+  nf_ot_recount(p);
+  nf_ot_recount(x);
+}
+
+
+/**
+ * Link 'nfn' as a leaf below 'parent' and restore heap order
+ */
+static void
+nf_ot_link(prop_nf_t *nf, nfnode_t *nfn, nfnode_t *parent, int left)
+{
+  nfn->ot_left = nfn->ot_right = NULL;
+  nfn->ot_parent = parent;
+  nfn->ot_visible = !!nfn->out;
+
+  if(parent == NULL)
+    nf->out_root = nfn;
+  else if(left)
+    parent->ot_left = nfn;
+  else
+    parent->ot_right = nfn;
+
+  nf_ot_adjust(parent, nfn->ot_visible);
+
+  while(nfn->ot_parent != NULL && nfn->ot_parent->ot_prio < nfn->ot_prio)
+    nf_ot_rotate_up(nf, nfn);
+}
+
+
+/**
+ *
+ */
+static unsigned int
+nf_ot_prio(prop_nf_t *nf)
+{
+  unsigned int x = nf->prio_seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return nf->prio_seed = x;
+}
+
+
+/**
+ * Insert a node before 'b' (or last if NULL) in egress order
+ */
+static void
+nf_ot_insert_before(prop_nf_t *nf, nfnode_t *nfn, nfnode_t *b)
+{
+  nfnode_t *p;
+
+  if(b != NULL && b->ot_left == NULL) {
+    nf_ot_link(nf, nfn, b, 1);
+    return;
+  }
+
+  p = b != NULL ? b->ot_left : nf->out_root;
+  if(p != NULL)
+    while(p->ot_right != NULL)
+      p = p->ot_right;
+  nf_ot_link(nf, nfn, p, 0);
+}
+
+
+/**
+ * Insert a node in egress order according to the sort key
+ */
+static void
+nf_ot_insert_sorted(prop_nf_t *nf, nfnode_t *nfn)
+{
+  nfnode_t *c = nf->out_root, *p = NULL;
+  int left = 0;
+
+  while(c != NULL) {
+    p = c;
+    left = nf_egress_cmp(nfn, c) < 0;
+    c = left ? c->ot_left : c->ot_right;
+  }
+  nf_ot_link(nf, nfn, p, left);
+}
+
+
+/**
+ *
+ */
+static void
+nf_ot_remove(prop_nf_t *nf, nfnode_t *nfn)
+{
+  nfnode_t *p, *c;
+
+  // Rotate it down to a leaf
+  while(nfn->ot_left != NULL || nfn->ot_right != NULL) {
+    if(nfn->ot_left == NULL)
+      c = nfn->ot_right;
+    else if(nfn->ot_right == NULL)
+      c = nfn->ot_left;
+    else
+      c = nfn->ot_left->ot_prio > nfn->ot_right->ot_prio ?
+	nfn->ot_left : nfn->ot_right;
+    nf_ot_rotate_up(nf, c);
+  }
+
+  p = nfn->ot_parent;
+  if(p == NULL)
+    nf->out_root = NULL;
+  else if(p->ot_left == nfn)
+    p->ot_left = NULL;
+  else
+    p->ot_right = NULL;
+
+  nf_ot_adjust(p, -nfn->ot_visible);
+}
+
+
+/**
+ * Build the egress tree from a vector of nodes already in egress order.
+ * Tree must be empty
+ */
+static void
+nf_ot_build(prop_nf_t *nf, nfnode_t **v, int num)
+{
+  nfnode_t **stack = malloc(sizeof(nfnode_t *) * num);
+  nfnode_t *last;
+  int i, depth = 0;
+
+  for(i = 0; i < num; i++) {
+    nfnode_t *nfn = v[i];
+    nfn->ot_left = nfn->ot_right = nfn->ot_parent = NULL;
+
+    last = NULL;
+    while(depth > 0 && stack[depth - 1]->ot_prio < nfn->ot_prio)
+      last = stack[--depth];
+
+    nfn->ot_left = last;
+    if(last != NULL)
+      last->ot_parent = nfn;
+
+    if(depth > 0) {
+      stack[depth - 1]->ot_right = nfn;
+      nfn->ot_parent = stack[depth - 1];
+    }
+    stack[depth++] = nfn;
+  }
+
+  nf->out_root = depth ? stack[0] : NULL;
+  free(stack);
+
+  // Children are always ahead of their parent in reverse order
+  for(i = num - 1; i >= 0; i--) {
+    nfnode_t *nfn = v[i];
+    nfn->inserted = 1;
+    nf_ot_recount(nfn);
+  }
+}
+
+
+/**
+ *
+ */
+static nfnode_t *
+nf_ot_first_visible(nfnode_t *nfn)
+{
+  while(1) {
+    if(nfn->ot_left != NULL && nfn->ot_left->ot_visible)
+      nfn = nfn->ot_left;
+    else if(nfn->out != NULL)
+      return nfn;
+    else
+      nfn = nfn->ot_right;
+  }
+}
+
+
+/**
+ * Return the first node after 'nfn' in egress order that has an
+ * output property
+ */
+static nfnode_t *
+nf_next_visible(nfnode_t *nfn)
+{
+  nfnode_t *p;
+
+  if(!nfn->inserted)
+    return NULL;
+
+  if(nfn->ot_right != NULL && nfn->ot_right->ot_visible)
+    return nf_ot_first_visible(nfn->ot_right);
+
+  for(; (p = nfn->ot_parent) != NULL; nfn = p) {
+    if(p->ot_left != nfn)
+      continue;
+    if(p->out != NULL)
+      return p;
+    if(p->ot_right != NULL && p->ot_right->ot_visible)
+      return nf_ot_first_visible(p->ot_right);
+  }
+  return NULL;
+}
+
+
+/**
+ * Put a node in the egress tree without touching the output
+ */
+static void
+nf_place_node(prop_nf_t *nf, nfnode_t *nfn)
 {
   nfnode_t *b;
 
   if(nfn->inserted)
-    TAILQ_REMOVE(&nf->out, nfn, out_link);
+    nf_ot_remove(nf, nfn);
 
   nfn->inserted = 1;
 
-  if(nfn->sortkey_type == SORTKEY_NONE) {
+  if(nf->defsortpath == NULL) {
+    // Not sorting, egress order follows ingress order
 
     b = TAILQ_NEXT(nfn, in_link);
-
-    if(b != NULL) {
-      TAILQ_INSERT_BEFORE(b, nfn, out_link);
-    } else {
-      TAILQ_INSERT_TAIL(&nf->out, nfn, out_link);
-    }
+    nf_ot_insert_before(nf, nfn, b != NULL && b->inserted ? b : NULL);
 
   } else {
+    nf_ot_insert_sorted(nf, nfn);
+  }
+}
 
-    nf_renumber(nf);
 
-    TAILQ_INSERT_SORTED(&nf->out, nfn, out_link, nf_egress_cmp);
-  }
+/**
+ * Insert a node according to the sorting criteria
+ * Optionally move the output node if it's created
+ */
+static void
+nf_insert_node(prop_nf_t *nf, nfnode_t *nfn)
+{
+  nfnode_t *b;
+
+  nf_place_node(nf, nfn);
 
   if(nfn->out == NULL)
     return;
 
-  b = nfn;
-  do {
-    b = TAILQ_NEXT(b, out_link);
-  } while(b != NULL && b->out == NULL);
-
+  b = nf_next_visible(nfn);
   prop_move0(nfn->out, b ? b->out : NULL, nf->dstsub);
 }
 
@@ -322,12 +693,15 @@ nf_update_egress(prop_nf_t *nf, nfnode_t *nfn)
   nfnode_t *b;
   int en = 1;
 
+  if(nf->bulk)
+    return; // nf_add_nodes() will get to it
+
   // If sorting is enabled but this node don't have a key, hide it
   if(nf->defsortpath != NULL && nfn->sortkey_type == SORTKEY_NONE)
     en = 0;
 
   // Check filtering
-  if(en && nf->filter != NULL && !nf_filtercheck(nfn->in, nf->filter))
+  if(en && nf->filter != NULL && !nf_filtercheck(nf, nfn))
     en = 0;
 
   if(eval_preds(nfn))
@@ -341,23 +715,26 @@ nf_update_egress(prop_nf_t *nf, nfnode_t *nfn)
     nfn->out = prop_make(NULL, 0, NULL);
     prop_link0(nfn->in, nfn->out, NULL, 0);
 
-    b = nfn;
-    do {
-      b = TAILQ_NEXT(b, out_link);
-    } while(b != NULL && b->out == NULL);
+    b = nf_next_visible(nfn);
 
     prop_set_parent0(nfn->out, nf->dst, b ? b->out : NULL, nf->dstsub);
 
+    if(nfn->inserted)
+      nf_ot_adjust(nfn, 1);
+
   } else {
 
     prop_destroy0(nfn->out);
     nfn->out = NULL;
+
+    if(nfn->inserted)
+      nf_ot_adjust(nfn, -1);
   }
 }
 
 
 /**
- *
+ * Something changed below a node that has no index fields
  */
 static void
 nf_multi_filter(void *opaque, prop_event_t event, ...)
@@ -365,32 +742,117 @@ nf_multi_filter(void *opaque, prop_event_t event, ...)
   nfnode_t *nfn = opaque;
   prop_nf_t *nf = nfn->nf;
 
-  nf_update_egress(nf, nfn);
+  nf_text_clear(nfn);
+  nf_text_collect(nfn, nfn->in);
+  nf_set_match(nf, nfn, -1);
+
+  if(nfn->inserted)
+    nf_update_egress(nf, nfn);
 }
 
 
 /**
- *
+ * An index field changed
  */
 static void
-nf_update_multisub(prop_nf_t *nf, nfnode_t *nfn)
+nf_set_field(void *opaque, prop_event_t event, ...)
 {
-  if(!nf->filter == !nfn->multisub)
-    return;
+  nf_text_t *nft = opaque;
+  nfnode_t *nfn = nft->nft_nfn;
+  prop_nf_t *nf = nfn->nf;
+  va_list ap;
 
-  if(nf->filter) {
+  va_start(ap, event);
 
-    nfn->multisub =
-      prop_subscribe(PROP_SUB_INTERNAL | PROP_SUB_MULTI | PROP_SUB_DONTLOCK,
-		     PROP_TAG_CALLBACK, nf_multi_filter, nfn,
-		     PROP_TAG_ROOT, nfn->in,
-		     NULL);
+  switch(event) {
+  case PROP_SET_RSTRING:
+  case PROP_SET_RLINK:
+    nf_text_set(nft, rstr_get(va_arg(ap, rstr_t *)));
+    break;
 
-  } else {
+  case PROP_SET_CSTRING:
+    nf_text_set(nft, va_arg(ap, const char *));
+    break;
+
+  default:
+    nf_text_set(nft, NULL);
+    break;
+  }
+  va_end(ap);
+
+  nf_set_match(nf, nfn, -1);
+
+  if(nfn->inserted)
+    nf_update_egress(nf, nfn);
+}
+
+
+/**
+ *
+ */
+static void
+nf_index_drop(nfnode_t *nfn)
+{
+  int i;
+
+  for(i = 0; i < nfn->ft_num; i++)
+    if(nfn->ft_texts[i].nft_sub != NULL)
+      prop_unsubscribe0(nfn->ft_texts[i].nft_sub);
 
+  if(nfn->multisub != NULL) {
     prop_unsubscribe0(nfn->multisub);
     nfn->multisub = NULL;
   }
+  nf_text_clear(nfn);
+  nfn->ft_active = 0;
+}
+
+
+/**
+ * Index a node while a filter is set, drop the index otherwise
+ */
+static void
+nf_update_index(prop_nf_t *nf, nfnode_t *nfn)
+{
+  int i, want = nf->filter != NULL;
+
+  if(want == nfn->ft_active)
+    return;
+
+  nfn->ft_active = want;
+
+  if(want) {
+
+    if(nf->ft_num_paths > 0) {
+      nfn->ft_num = nf->ft_num_paths;
+      nfn->ft_texts = calloc(nfn->ft_num, sizeof(nf_text_t));
+
+      for(i = 0; i < nfn->ft_num; i++) {
+	nf_text_t *nft = &nfn->ft_texts[i];
+	nft->nft_nfn = nfn;
+	nft->nft_sub =
+	  prop_subscribe(PROP_SUB_INTERNAL | PROP_SUB_DONTLOCK,
+			 PROP_TAG_CALLBACK, nf_set_field, nft,
+			 PROP_TAG_NAMED_ROOT, nfn->in, "node",
+			 PROP_TAG_NAME_VECTOR, nf->ft_paths[i],
+			 NULL);
+      }
+
+    } else {
+
+      nfn->multisub =
+	prop_subscribe(PROP_SUB_INTERNAL | PROP_SUB_MULTI | PROP_SUB_DONTLOCK,
+		       PROP_TAG_CALLBACK, nf_multi_filter, nfn,
+		       PROP_TAG_ROOT, nfn->in,
+		       NULL);
+      nf_text_clear(nfn);
+      nf_text_collect(nfn, nfn->in);
+    }
+
+  } else {
+    nf_index_drop(nfn);
+  }
+  nf_set_match(nf, nfn, -1);
 }
 
 
@@ -526,6 +988,10 @@ nf_set_sortkey(void *opaque, prop_event_t event, ...)
     nfn->sortkey_type = SORTKEY_NONE;
     break;
   }
+
+  if(nfn->nf->bulk)
+    return;
+
   nf_insert_node(nfn->nf, nfn);
   nf_update_egress(nfn->nf, nfn);
 }
@@ -550,7 +1016,8 @@ nf_update_order(prop_nf_t *nf, nfnode_t *nfn)
       rstr_release(nfn->sortkey_rstr);
     nfn->sortkey_type = SORTKEY_NONE;
 
-    nf_insert_node(nf, nfn);      
+    if(!nf->bulk)
+      nf_insert_node(nf, nfn);
 
   } else {
     nfn->sortsub =
@@ -576,26 +1043,23 @@ nf_add_node(prop_nf_t *nf, prop_t *node, nfnode_t *b)
 
   if(b != NULL) {
     TAILQ_INSERT_BEFORE(b, nfn, in_link);
-    nf->pos_valid = 0;
-
   } else {
-
-    if(nf->pos_valid) {
-      nfnode_t *l = TAILQ_LAST(&nf->in, nfnode_queue);
-      nfn->pos = l ? l->pos + 1 : 0;
-    }
-
     TAILQ_INSERT_TAIL(&nf->in, nfn, in_link);
   }
 
+  nfn->seq = nf->seq_tally++;
+  nfn->ot_prio = nf_ot_prio(nf);
+  nfn->ft_match = -1;
+  LIST_INSERT_HEAD(&nf->ft_nodes[0], nfn, ft_link);
   nfn->nf = nf;
   nfn->in = node;
 
-  nf_update_multisub(nf, nfn);
   nfn_insert_preds(nf, nfn);
 
   nf_update_order(nf, nfn);
 
+  nf_update_index(nf, nfn);
+
   nf_update_egress(nf, nfn);
 }
 
@@ -606,40 +1070,61 @@ nf_add_node(prop_nf_t *nf, prop_t *node, nfnode_t *b)
 static void
 nf_add_nodes(prop_nf_t *nf, prop_vec_t *pv, nfnode_t *b)
 {
-  int i;
+  int i, len = prop_vec_len(pv);
   nfnode_t *nfn;
+  nfnode_t **v = malloc(sizeof(nfnode_t *) * len);
 
-  if(b != NULL)
-    nf->pos_valid = 0;
+  /**
+   * Sort keys are collected for all nodes first and then the whole
+   * batch is sorted once and put into the egress tree
+   */
+  nf->bulk = 1;
 
-  for(i = 0; i < prop_vec_len(pv); i++) {
+  for(i = 0; i < len; i++) {
     prop_t *p = prop_vec_get(pv, i);
     nfn = calloc(1, sizeof(nfnode_t));
 
     prop_tag_set(p, nf, nfn);
 
-    if(nf->pos_valid) {
-      nfnode_t *l = TAILQ_LAST(&nf->in, nfnode_queue);
-      nfn->pos = l ? l->pos + 1 : 0;
-    }
-
     if(b != NULL) {
       TAILQ_INSERT_BEFORE(b, nfn, in_link);
     } else {
       TAILQ_INSERT_TAIL(&nf->in, nfn, in_link);
     }
 
+    nfn->seq = nf->seq_tally++;
+    nfn->ot_prio = nf_ot_prio(nf);
+    nfn->ft_match = -1;
+    LIST_INSERT_HEAD(&nf->ft_nodes[0], nfn, ft_link);
     nfn->nf = nf;
     nfn->in = p;
 
-    nf_update_multisub(nf, nfn);
     nfn_insert_preds(nf, nfn);
 
     nf_update_order(nf, nfn);
+
+    nf_update_index(nf, nfn);
+    v[i] = nfn;
   }
 
-  TAILQ_FOREACH(nfn, &nf->out, out_link)
-    nf_update_egress(nf, nfn);
+  nf->bulk = 0;
+
+  if(nf->defsortpath != NULL)
+    qsort(v, len, sizeof(nfnode_t *), nf_egress_cmpv);
+
+  if(nf->out_root == NULL) {
+    nf_ot_build(nf, v, len);
+  } else {
+    // Backwards so the ingress successor is already placed
+    for(i = len - 1; i >= 0; i--)
+      nf_place_node(nf, v[i]);
+  }
+
+  // Going backwards makes the next visible node the one we just did
+  for(i = len - 1; i >= 0; i--)
+    nf_update_egress(nf, v[i]);
+
+  free(v);
 }
 
 
@@ -651,15 +1136,15 @@ nf_del_node(prop_nf_t *nf, nfnode_t *nfn)
 {
   nfn_pred_t *nfnp;
 
-  nf->pos_valid = 0;
   TAILQ_REMOVE(&nf->in, nfn, in_link);
-  TAILQ_REMOVE(&nf->out, nfn, out_link);
+  if(nfn->inserted)
+    nf_ot_remove(nf, nfn);
 
   if(nfn->out != NULL)
     prop_destroy0(nfn->out);
 
-  if(nfn->multisub != NULL)
-    prop_unsubscribe0(nfn->multisub);
+  nf_index_drop(nfn);
+  LIST_REMOVE(nfn, ft_link);
 
   if(nfn->sortsub != NULL)
     prop_unsubscribe0(nfn->sortsub);
@@ -679,8 +1164,6 @@ nf_del_node(prop_nf_t *nf, nfnode_t *nfn)
 static void
 nf_move_node(prop_nf_t *nf, nfnode_t *nfn, nfnode_t *b)
 {
-  nf->pos_valid = 0;
-
   TAILQ_REMOVE(&nf->in, nfn, in_link);
 
   if(b != NULL) {
@@ -688,7 +1171,10 @@ nf_move_node(prop_nf_t *nf, nfnode_t *nfn, nfnode_t *b)
   } else {
     TAILQ_INSERT_TAIL(&nf->in, nfn, in_link);
   }
-  nf_insert_node(nf, nfn);
+
+  // When sorting, the ingress order does not affect egress order
+  if(nf->defsortpath == NULL)
+    nf_insert_node(nf, nfn);
 }
 
 
@@ -740,7 +1226,6 @@ nf_clear(prop_nf_t *nf)
     prop_tag_clear(nfn->in, nf);
     nf_del_node(nf, nfn);
   }
-  nf->pos_valid = 1;
 }
 
 
@@ -750,6 +1235,8 @@ nf_clear(prop_nf_t *nf)
 static void
 prop_nf_release0(struct prop_nf *pnf)
 {
+  int i;
+
   pnf->pnf_refcount--;
   if(pnf->pnf_refcount > 0)
     return;
@@ -764,7 +1251,7 @@ prop_nf_release0(struct prop_nf *pnf)
   prop_destroy0(pnf->dst);
 
   assert(TAILQ_FIRST(&pnf->in) == NULL);
-  assert(TAILQ_FIRST(&pnf->out) == NULL);
+  assert(pnf->out_root == NULL);
 
   if(pnf->filtersub != NULL)
     prop_unsubscribe0(pnf->filtersub);
@@ -772,12 +1259,16 @@ prop_nf_release0(struct prop_nf *pnf)
   if(pnf->defsortpath)
     strvec_free(pnf->defsortpath);
 
+  for(i = 0; i < pnf->ft_num_paths; i++)
+    strvec_free(pnf->ft_paths[i]);
+
   free(pnf->filter);
+  free(pnf->filter_folded);
 
   nf_destroy_preds(pnf);
 
   assert(TAILQ_FIRST(&pnf->in) == NULL);
-  assert(TAILQ_FIRST(&pnf->out)== NULL);
+  assert(pnf->out_root == NULL);
   free(pnf);
 }
 
@@ -920,20 +1411,66 @@ nf_set_filter(void *opaque, const char *str)
 {
   prop_nf_t *nf = opaque;
   nfnode_t *nfn;
+  char *folded;
+  int keep, had_filter = nf->filter != NULL;
 
   if(str != NULL && str[0] == 0)
     str = NULL;
 
   mystrset(&nf->filter, str);
 
+  folded = str ? utf8_casefold(str) : NULL;
+
+  /**
+   * If the new query contains the old one (user typed more) nodes
+   * that did not match can't match now either. If it's the other way
+   * around (user erased) nodes that matched still do
+   */
+  if(folded == NULL || nf->filter_folded == NULL)
+    keep = -1;
+  else if(strstr(folded, nf->filter_folded))
+    keep = 0;
+  else if(strstr(nf->filter_folded, folded))
+    keep = 1;
+  else
+    keep = -1;
+
+  free(nf->filter_folded);
+  nf->filter_folded = folded;
+  nf->filter_grams = folded ? nf_trigrams(folded) : 0;
+
   if(nf->filter == NULL && nf->pending_have_more) {
     prop_have_more_childs0(nf->dst);
     nf->pending_have_more = 0;
   }
 
 
-  TAILQ_FOREACH(nfn, &nf->in, in_link) {
-    nf_update_multisub(nf, nfn);
+  if(!had_filter != !nf->filter) {
+    // Filter was turned on or off, (un)index all nodes
+    TAILQ_FOREACH(nfn, &nf->in, in_link) {
+      nf_update_index(nf, nfn);
+      nf_update_egress(nf, nfn);
+    }
+    return;
+  }
+
+  if(nf->filter == NULL)
+    return;
+
+  /**
+   * Only nodes whose result may have changed need to be checked.
+   * Checking a node moves it off the ft_nodes[0] (unknown) list
+   */
+  if(keep != 0)
+    while((nfn = LIST_FIRST(&nf->ft_nodes[1])) != NULL)
+      nf_set_match(nf, nfn, -1);
+
+  if(keep != 1)
+    while((nfn = LIST_FIRST(&nf->ft_nodes[2])) != NULL)
+      nf_set_match(nf, nfn, -1);
+
+  while((nfn = LIST_FIRST(&nf->ft_nodes[0])) != NULL) {
+    nf_filtercheck(nf, nfn);
     nf_update_egress(nf, nfn);
   }
 }
@@ -950,7 +1487,10 @@ prop_nf_create(prop_t *dst, prop_t *src, prop_t *filter,
   prop_nf_t *nf = calloc(1, sizeof(prop_nf_t));
   nf->flags = flags;
   TAILQ_INIT(&nf->in);
-  TAILQ_INIT(&nf->out);
+  LIST_INIT(&nf->ft_nodes[0]);
+  LIST_INIT(&nf->ft_nodes[1]);
+  LIST_INIT(&nf->ft_nodes[2]);
+  nf->prio_seed = 2463534242U;
 
   nf->dst = flags & PROP_NF_TAKE_DST_OWNERSHIP ? dst : prop_xref_addref(dst);
   nf->src = src;
@@ -1086,3 +1626,33 @@ prop_nf_pred_int_add(struct prop_nf *nf,
   prop_nf_pred_add(nf, path, cf, enable, mode, pnp);
   hts_mutex_unlock(&prop_mutex);
 }
+
+
+/**
+ * Match text filters against the string at 'path' (relative to the
+ * node, ie. "node.metadata.title") instead of every string below the
+ * node. Can be called more than once to index several fields
+ */
+void
+prop_nf_index_add(struct prop_nf *nf, const char *path)
+{
+  nfnode_t *nfn;
+
+  hts_mutex_lock(&prop_mutex);
+
+  if(nf->ft_num_paths < NF_INDEX_FIELDS) {
+
+    // Existing nodes are reindexed with the new set of fields
+    TAILQ_FOREACH(nfn, &nf->in, in_link)
+      nf_index_drop(nfn);
+
+    nf->ft_paths[nf->ft_num_paths++] = strvec_split(path, '.');
+
+    TAILQ_FOREACH(nfn, &nf->in, in_link) {
+      nf_update_index(nf, nfn);
+      nf_update_egress(nf, nfn);
+    }
+  }
+
+  hts_mutex_unlock(&prop_mutex);
+}
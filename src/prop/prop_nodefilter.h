@@ -52,6 +52,8 @@ struct prop_nf *prop_nf_create(prop_t *dst, prop_t *src,
 			       prop_t *filter, const char *defsortpath,
 			       int flags);
 
+void prop_nf_index_add(struct prop_nf *nf, const char *path);
+
 void prop_nf_release(struct prop_nf *nf);
 
 #endif // PROP_NODEFILTER_H__
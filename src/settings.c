@@ -710,3 +710,14 @@ settings_generic_set_bool(void *opaque, int value)
   int *p = opaque;
   *p = value;
 }
+
+
+/**
+ *
+ */
+void
+settings_generic_set_int(void *opaque, int value)
+{
+  int *p = opaque;
+  *p = value;
+}
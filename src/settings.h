@@ -112,6 +112,8 @@ void settings_generic_save_settings(void *opaque, htsmsg_t *msg);
 
 void settings_generic_set_bool(void *opaque, int value);
 
+void settings_generic_set_int(void *opaque, int value);
+
 void settings_create_info(prop_t *parent, const char *image,
 			  prop_t *description);
 
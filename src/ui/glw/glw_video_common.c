@@ -575,7 +575,7 @@ GLW_REGISTER_CLASS(glw_video);
 int
 glw_video_configure(glw_video_t *gv,
 		    const glw_video_engine_t *engine,
-		    const int *wvec, const int *hvec,
+		    const int *wvec, const int *hvec, const int *svec,
 		    int surfaces, int flags)
 {
   glw_video_config_t gvc = {0};
@@ -596,6 +596,12 @@ glw_video_configure(glw_video_t *gv,
     gvc.gvc_height[2] = hvec[2];
   }
 
+  if(svec != NULL) {
+    gvc.gvc_stride[0] = svec[0];
+    gvc.gvc_stride[1] = svec[1];
+    gvc.gvc_stride[2] = svec[2];
+  }
+
   gvc.gvc_nsurfaces = surfaces;
   gvc.gvc_flags = flags;
 
@@ -670,7 +676,7 @@ glw_video_input(frame_buffer_type_t type, void *frame,
 
   if(frame == NULL) {
     // Blackout
-    glw_video_configure(gv, &glw_video_blank, NULL, NULL, 0, 0);
+    glw_video_configure(gv, &glw_video_blank, NULL, NULL, NULL, 0, 0);
     hts_mutex_unlock(&gv->gv_surface_mutex);
     return;
   }
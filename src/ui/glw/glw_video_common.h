@@ -42,6 +42,7 @@ typedef struct {
 
   int gvc_width[3];
   int gvc_height[3];
+  int gvc_stride[3];  // Bytes per row in upload buffers, if engine uses it
 
   int gvc_nsurfaces;
 
@@ -75,6 +76,14 @@ typedef struct glw_video_surface {
   GLuint gvs_pbo[3];
   void *gvs_pbo_ptr[3];
 
+  /**
+   * Both fields of an interlaced frame are uploaded from the PBOs of
+   * the first field's surface, 'gvs_pbo_row' selects the field
+   */
+  struct glw_video_surface *gvs_pbo_src;  // Surface holding our pixels
+  struct glw_video_surface *gvs_pbo_user; // Not yet uploaded from our PBOs
+  int gvs_pbo_row;
+
   int gvs_uploaded;
 
   GLuint gvs_textures[3];
@@ -252,7 +261,7 @@ void glw_video_put_surface(glw_video_t *gv, glw_video_surface_t *s,
 
 int glw_video_configure(glw_video_t *gv,
 			const glw_video_engine_t *engine,
-			const int *wvec, const int *hvec,
+			const int *wvec, const int *hvec, const int *svec,
 			int surfaces, int flags);
 
 
@@ -495,7 +495,7 @@ glw_video_input_yuvp(glw_video_t *gv,
   hvec[1] = height >> (vshift + ilace);
   hvec[2] = height >> (vshift + ilace);
 
-  if(glw_video_configure(gv, &glw_video_gx, wvec, hvec, 3,
+  if(glw_video_configure(gv, &glw_video_gx, wvec, hvec, NULL, 3,
 			 ilace ? GVC_CUTBORDER : 0))
     return;
   
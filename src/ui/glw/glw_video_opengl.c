@@ -43,23 +43,73 @@
 
 
 /**
- * gv_surface_mutex must be held
+ * Size of upload buffer for 'plane'
+ */
+static int
+pbo_size(const glw_video_config_t *gvc, int plane)
+{
+  int rows = gvc->gvc_height[plane];
+  if(gvc->gvc_flags & GVC_YHALF)
+    rows *= 2; // Holds both fields
+  return gvc->gvc_stride[plane] * rows;
+}
+
+
+/**
+ *
  */
 static void
-surface_reset(glw_video_t *gv, glw_video_surface_t *gvs)
+pbo_unmap(glw_video_surface_t *gvs)
 {
   int i;
 
+  if(gvs->gvs_pbo_ptr[0] == NULL)
+    return;
+
   for(i = 0; i < 3; i++) {
-    if(gvs->gvs_pbo[i] != 0) {
-      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gvs->gvs_pbo[i]);
-      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-      gvs->gvs_pbo_ptr[i] = NULL;
-      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gvs->gvs_pbo[i]);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    gvs->gvs_pbo_ptr[i] = NULL;
   }
-  if(gvs->gvs_pbo[0] != 0)
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+
+/**
+ *
+ */
+static void
+pbo_map(glw_video_surface_t *gvs, const glw_video_config_t *gvc)
+{
+  int i;
+
+  for(i = 0; i < 3; i++) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gvs->gvs_pbo[i]);
+
+    // Setting the buffer to NULL tells the GPU it can assign
+    // us another piece of memory as backing store.
+#ifdef PBO_RELEASE_BEFORE_MAP
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, pbo_size(gvc, i),
+		 NULL, GL_STREAM_DRAW);
+#endif
+
+    gvs->gvs_pbo_ptr[i] = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    gvs->gvs_data[i] = gvs->gvs_pbo_ptr[i];
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+
+/**
+ * gv_surface_mutex must be held
+ */
+static void
+surface_reset(glw_video_t *gv, glw_video_surface_t *gvs)
+{
+  if(gvs->gvs_pbo[0] != 0) {
+    pbo_unmap(gvs);
     glDeleteBuffers(3, gvs->gvs_pbo);
+  }
   gvs->gvs_pbo[0] = 0;
 
   if(gvs->gvs_textures[0] != 0)
@@ -93,19 +143,16 @@ surface_init(glw_video_t *gv, glw_video_surface_t *gvs,
   glGenBuffers(3, gvs->gvs_pbo);
   glGenTextures(3, gvs->gvs_textures);
   gvs->gvs_uploaded = 0;
-  for(i = 0; i < 3; i++) {
+  gvs->gvs_pbo_src = gvs;
+  gvs->gvs_pbo_user = NULL;
+  gvs->gvs_pbo_row = 0;
 
+  for(i = 0; i < 3; i++) {
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gvs->gvs_pbo[i]);
-	
-    glBufferData(GL_PIXEL_UNPACK_BUFFER,
-		    gvc->gvc_width[i] * gvc->gvc_height[i],
-		    NULL, GL_STREAM_DRAW);
-	
-    gvs->gvs_pbo_ptr[i] = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-	
-    gvs->gvs_data[i] = gvs->gvs_pbo_ptr[i];
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, pbo_size(gvc, i),
+		 NULL, GL_STREAM_DRAW);
   }
-  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  pbo_map(gvs, gvc);
   TAILQ_INSERT_TAIL(&gv->gv_avail_queue, gvs, gvs_link);
   hts_mutex_assert(&gv->gv_surface_mutex);
 }
@@ -153,43 +200,40 @@ gv_tex_get(glw_video_surface_t *gvs, int plane)
 
 
 /**
- *
+ * Textures are loaded straight from the PBOs the decoder output was
+ * copied to, GL_UNPACK_ROW_LENGTH skips the decoder's line padding
+ * and, for interlaced content, the other field
  */
 static void
 gv_surface_pixmap_upload(glw_video_surface_t *gvs,
 			 const glw_video_config_t *gvc, int textype)
 {
-  if(gvs->gvs_uploaded || gvs->gvs_pbo[0] == 0)
+  glw_video_surface_t *src = gvs->gvs_pbo_src;
+  const int fields = gvc->gvc_flags & GVC_YHALF ? 2 : 1;
+  int i;
+
+  if(gvs->gvs_uploaded || src->gvs_pbo[0] == 0)
     return;
 
   gvs->gvs_uploaded = 1;
 
-  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gvs->gvs_pbo[0]);
-  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-  glBindTexture(textype, gv_tex_get(gvs, GVF_TEX_L));
-  gv_set_tex_meta(textype);
-  glTexImage2D(textype, 0, 1, gvc->gvc_width[0], gvc->gvc_height[0],
-	       0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
-
-  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gvs->gvs_pbo[1]);
-  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-  glBindTexture(textype, gv_tex_get(gvs, GVF_TEX_Cr));
-  gv_set_tex_meta(textype);
-  glTexImage2D(textype, 0, 1, gvc->gvc_width[1], gvc->gvc_height[1],
-	       0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
-
-  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gvs->gvs_pbo[2]);
-  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-  glBindTexture(textype, gv_tex_get(gvs, GVF_TEX_Cb));
-  gv_set_tex_meta(textype);
-  glTexImage2D(textype, 0, 1, gvc->gvc_width[2], gvc->gvc_height[2],
-	       0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+  pbo_unmap(src);
 
+  for(i = 0; i < 3; i++) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, src->gvs_pbo[i]);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, gvc->gvc_stride[i] * fields);
+    glBindTexture(textype, gv_tex_get(gvs, i));
+    gv_set_tex_meta(textype);
+    glTexImage2D(textype, 0, 1, gvc->gvc_width[i], gvc->gvc_height[i],
+		 0, GL_LUMINANCE, GL_UNSIGNED_BYTE,
+		 (void *)(intptr_t)(gvs->gvs_pbo_row * gvc->gvc_stride[i]));
+  }
+
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-  gvs->gvs_pbo_ptr[0] = NULL;
-  gvs->gvs_pbo_ptr[1] = NULL;
-  gvs->gvs_pbo_ptr[2] = NULL;
+  if(src != gvs)
+    src->gvs_pbo_user = NULL;
 }
 
 
@@ -201,29 +245,23 @@ gv_surface_pixmap_release(glw_video_t *gv, glw_video_surface_t *gvs,
 			  const glw_video_config_t *gvc,
 			  struct glw_video_surface_queue *fromqueue)
 {
-  int i;
-
   TAILQ_REMOVE(fromqueue, gvs, gvs_link);
 
-  if(gvs->gvs_uploaded) {
-    gvs->gvs_uploaded = 0;
+  // The second field still needs our PBOs, load it before they're reused
+  if(gvs->gvs_pbo_user != NULL)
+    gv_surface_pixmap_upload(gvs->gvs_pbo_user, gvc,
+			     gv->w.glw_root->gr_be.gbr_primary_texture_mode);
 
-    for(i = 0; i < 3; i++) {
-      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gvs->gvs_pbo[i]);
+  // Dropped before it was uploaded, the source must not wait for us
+  if(gvs->gvs_pbo_src != gvs)
+    gvs->gvs_pbo_src->gvs_pbo_user = NULL;
 
-      // Setting the buffer to NULL tells the GPU it can assign
-      // us another piece of memory as backing store.
-#ifdef PBO_RELEASE_BEFORE_MAP
-      glBufferData(GL_PIXEL_UNPACK_BUFFER,
-		   gvc->gvc_width[i] * gvc->gvc_height[i],
-		   NULL, GL_STREAM_DRAW);
-#endif
+  gvs->gvs_uploaded = 0;
+  gvs->gvs_pbo_src = gvs;
+  gvs->gvs_pbo_row = 0;
 
-      gvs->gvs_pbo_ptr[i] = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-      gvs->gvs_data[i] = gvs->gvs_pbo_ptr[i];
-    }
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-  }
+  if(gvs->gvs_pbo_ptr[0] == NULL)
+    pbo_map(gvs, gvc);
 
   TAILQ_INSERT_TAIL(&gv->gv_avail_queue, gvs, gvs_link);
   hts_cond_signal(&gv->gv_avail_queue_cond);
@@ -613,13 +651,11 @@ glw_video_input_yuvp(glw_video_t *gv,
 		     uint8_t * const data[], const int pitch[],
 		     const frame_info_t *fi)
 {
-  int hvec[3], wvec[3];
-  int i, h, w;
-  uint8_t *src;
-  uint8_t *dst;
+  int hvec[3], wvec[3], svec[3];
+  int i, rows;
   int tff;
   int hshift, vshift;
-  glw_video_surface_t *s;
+  glw_video_surface_t *s, *s2;
   const int parity = 0;
   int64_t pts = fi->pts;
 
@@ -631,8 +667,16 @@ glw_video_input_yuvp(glw_video_t *gv,
   hvec[0] = fi->height >> fi->interlaced;
   hvec[1] = fi->height >> (vshift + fi->interlaced);
   hvec[2] = fi->height >> (vshift + fi->interlaced);
-
-  if(glw_video_configure(gv, &glw_video_opengl, wvec, hvec, 3,
+  svec[0] = pitch[0];
+  svec[1] = pitch[1];
+  svec[2] = pitch[2];
+
+  /*
+   * Both fields of an interlaced frame must be held at once, so we
+   * need one more surface to not starve the display
+   */
+  if(glw_video_configure(gv, &glw_video_opengl, wvec, hvec, svec,
+			 fi->interlaced ? 4 : 3,
 			 fi->interlaced ? (GVC_YHALF | GVC_CUTBORDER) : 0))
     return;
   
@@ -641,20 +685,17 @@ glw_video_input_yuvp(glw_video_t *gv,
   if((s = glw_video_get_surface(gv)) == NULL)
     return;
 
-  if(!fi->interlaced) {
+  /*
+   * Copy each plane as a single block, including the decoder's line
+   * padding. The last line is cut at the width as the padding there
+   * might not be backed by memory
+   */
+  for(i = 0; i < 3; i++) {
+    rows = hvec[i] << fi->interlaced;
+    memcpy(s->gvs_data[i], data[i], pitch[i] * (rows - 1) + wvec[i]);
+  }
 
-    for(i = 0; i < 3; i++) {
-      w = wvec[i];
-      h = hvec[i];
-      src = data[i];
-      dst = s->gvs_data[i];
- 
-      while(h--) {
-	memcpy(dst, src, w);
-	dst += w;
-	src += pitch[i];
-      }
-    }
+  if(!fi->interlaced) {
 
     glw_video_put_surface(gv, s, pts, fi->epoch, fi->duration, 0);
 
@@ -664,42 +705,19 @@ glw_video_input_yuvp(glw_video_t *gv,
 
     tff = fi->tff ^ parity;
 
-    for(i = 0; i < 3; i++) {
-      w = wvec[i];
-      h = hvec[i];
-      
-      src = data[i]; 
-      dst = s->gvs_data[i];
-      
-      while(h -= 2 > 0) {
-	memcpy(dst, src, w);
-	dst += w;
-	src += pitch[i] * 2;
-      }
-    }
-    
-    glw_video_put_surface(gv, s, pts, fi->epoch, duration, !tff);
-
-    if((s = glw_video_get_surface(gv)) == NULL)
+    if((s2 = glw_video_get_surface(gv)) == NULL)
       return;
 
-    for(i = 0; i < 3; i++) {
-      w = wvec[i];
-      h = hvec[i];
-      
-      src = data[i] + pitch[i];
-      dst = s->gvs_data[i];
-      
-      while(h -= 2 > 0) {
-	memcpy(dst, src, w);
-	dst += w;
-	src += pitch[i] * 2;
-      }
-    }
-    
+    // The second field is uploaded from the first one's PBOs
+    s->gvs_pbo_user = s2;
+    s2->gvs_pbo_src = s;
+    s2->gvs_pbo_row = 1;
+
+    glw_video_put_surface(gv, s, pts, fi->epoch, duration, !tff);
+
     if(pts != AV_NOPTS_VALUE)
       pts += duration;
 
-    glw_video_put_surface(gv, s, pts, fi->epoch, duration, tff);
+    glw_video_put_surface(gv, s2, pts, fi->epoch, duration, tff);
   }
 }
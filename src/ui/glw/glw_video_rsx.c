@@ -586,7 +586,7 @@ glw_video_input_yuvp(glw_video_t *gv,
   hvec[1] = fi->height >> (vshift + fi->interlaced);
   hvec[2] = fi->height >> (vshift + fi->interlaced);
 
-  if(glw_video_configure(gv, &glw_video_opengl, wvec, hvec, 3,
+  if(glw_video_configure(gv, &glw_video_opengl, wvec, hvec, NULL, 3,
 			 fi->interlaced ? (GVC_YHALF | GVC_CUTBORDER) : 0))
     return;
   
@@ -690,7 +690,7 @@ glw_video_input_rsx_mem(glw_video_t *gv, void *frame,
   hvec[2] = fi->height >> (vshift + fi->interlaced);
 
 
-  if(glw_video_configure(gv, &glw_video_rsxmem, wvec, hvec, 3,
+  if(glw_video_configure(gv, &glw_video_rsxmem, wvec, hvec, NULL, 3,
 			 fi->interlaced ? (GVC_YHALF | GVC_CUTBORDER) : 0))
     return;
   
@@ -422,7 +422,7 @@ glw_video_input_vdpau(glw_video_t *gv,
 		       fi->height };
 #endif
 
-  if(glw_video_configure(gv, &glw_video_vdpau, wvec, hvec, 4, 0))
+  if(glw_video_configure(gv, &glw_video_vdpau, wvec, hvec, NULL, 4, 0))
     return;
 
   if((s = glw_video_get_surface(gv)) == NULL)
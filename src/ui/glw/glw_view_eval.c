@@ -1713,6 +1713,10 @@ subscribe_prop(glw_view_eval_context_t *ec, struct token *self, int type)
   if(ec->w->glw_class->gc_flags & GLW_EXPEDITE_SUBSCRIPTIONS)
     f |= PROP_SUB_EXPEDITE;
 
+  // Plain value bindings only care about the most recent value
+  if(type == GPS_VALUE)
+    f |= PROP_SUB_COALESCE;
+
   if(ec->debug || ec->w->glw_flags & GLW_DEBUG)
     f |= PROP_SUB_DEBUG;
 
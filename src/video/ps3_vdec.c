@@ -613,8 +613,10 @@ decoder_decode(struct media_codec *mc, struct video_decoder *vd,
     vdd->extradata_injected = 1;
   }
 
-  if(vdd->convert_to_annexb)
+  if(vdd->convert_to_annexb) {
     h264_to_annexb(mb->mb_data, mb->mb_size);
+    mb->mb_no_retain = 1;
+  }
   
   submit_au(vdd, &au, mb->mb_data, mb->mb_size, mb->mb_skip == 1, vd);
   vd->vd_do_flush = 0;
@@ -401,7 +401,7 @@ vd_thread(void *aux)
     }
 
     hts_mutex_lock(&mp->mp_mutex);
-    media_buf_free_locked(mp, mb);
+    media_buf_retire_locked(mp, mq, mb);
   }
 
   hts_mutex_unlock(&mp->mp_mutex);
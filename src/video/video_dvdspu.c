@@ -17,6 +17,8 @@
  */
 
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "showtime.h"
 #include "video_decoder.h"
@@ -298,7 +300,8 @@ dvdspu_enqueue(video_decoder_t *vd, media_buf_t *mb)
     return;
 
   d = calloc(1, sizeof(dvdspu_t));
-  d->d_data = mb->mb_data;
+  d->d_data = malloc(mb->mb_size);
+  memcpy(d->d_data, mb->mb_data, mb->mb_size);
   d->d_size = mb->mb_size;
   d->d_cmdpos = getbe16(d->d_data + 2);
   d->d_pts = mb->mb_pts;
@@ -306,8 +309,6 @@ dvdspu_enqueue(video_decoder_t *vd, media_buf_t *mb)
   hts_mutex_lock(&vd->vd_spu_mutex);
   TAILQ_INSERT_TAIL(&vd->vd_spu_queue, d, d_link);
   hts_mutex_unlock(&vd->vd_spu_mutex);
-
-  mb->mb_data = NULL;
 }
 
 /**
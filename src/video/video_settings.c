@@ -183,6 +183,18 @@ set_played_threshold(void *opaque, int v)
   video_settings.played_threshold = v;
 }
 
+static void
+set_backbuffer_time(void *opaque, int v)
+{
+  video_settings.backbuffer_time = v;
+}
+
+static void
+set_backbuffer_size(void *opaque, int v)
+{
+  video_settings.backbuffer_size = v;
+}
+
 static void
 set_continuous_playback(void *opaque, int v)
 {
@@ -288,6 +300,24 @@ video_settings_init(void)
 		       settings_generic_save_settings, 
 		       (void *)"videoplayback");
 
+  settings_create_int(s, "backbuffer_time",
+		      _p("Keep played video for seeking back"),
+		      30, store, 0, 300,
+		      5, set_backbuffer_time, NULL,
+		      SETTINGS_INITIAL_UPDATE,
+		      "s", NULL,
+		      settings_generic_save_settings, 
+		      (void *)"videoplayback");
+
+  settings_create_int(s, "backbuffer_size",
+		      _p("Max memory for seeking back"),
+		      16, store, 0, 256,
+		      4, set_backbuffer_size, NULL,
+		      SETTINGS_INITIAL_UPDATE,
+		      "MB", NULL,
+		      settings_generic_save_settings, 
+		      (void *)"videoplayback");
+
 
   //----------------------------------------------------------
 
@@ -35,6 +35,8 @@ struct video_settings {
   int vdpau_deinterlace_resolution_limit;
   int continuous_playback;
   int vda;
+  int backbuffer_time;   // Seconds of played packets kept for seeking back
+  int backbuffer_size;   // Max MB per pipe kept for seeking back
 };
 
 extern struct video_settings video_settings;